@@ -0,0 +1,478 @@
+#include "protocol.h"
+#include "request_pool.h"
+#include "scheduler.h"
+#include "search.h"
+#include "storage.h"
+#include "utils.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace std;
+
+// Every allocation made through operator new is counted, so each benchmark
+// can report heap allocations per operation alongside its timings.
+static atomic<uint64_t> allocation_count(0);
+
+void* operator new(size_t size) {
+    allocation_count.fetch_add(1, memory_order_relaxed);
+    if (void* p = malloc(size ? size : 1)) {
+        return p;
+    }
+    throw bad_alloc();
+}
+
+// GCC treats the free() in a replacement operator delete as a mismatch.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+#pragma GCC diagnostic pop
+
+struct BenchResult {
+    string name;
+    uint64_t ops;
+    double ns_per_op;
+    double ops_per_sec;
+    double mb_per_sec;
+    double p50_ns;
+    double p99_ns;
+    double max_ns;
+    double allocs_per_op;
+};
+
+struct BenchOptions {
+    string data_dir = "testdata";
+    string baseline_path = "results/bench_baseline.csv";
+    string filter;
+    double min_time_s = 0.3;
+    double threshold = 0.30;
+    bool update_baseline = false;
+};
+
+static BenchOptions options;
+
+// Runs fn(batch) repeatedly for at least min_time_s. Each call performs
+// `batch` operations; per-op percentiles are taken over batch averages so
+// that timer overhead does not dominate nanosecond-scale operations.
+static BenchResult run_timed(const string& name, size_t bytes_per_op, size_t batch,
+                             const function<void(size_t)>& fn) {
+    fn(batch);
+
+    vector<double> samples;
+    samples.reserve(1 << 16);
+    uint64_t ops = 0;
+    uint64_t allocations_before = allocation_count.load(memory_order_relaxed);
+    long long start = get_current_time_ns();
+    long long deadline = start + static_cast<long long>(options.min_time_s * 1e9);
+    long long now = start;
+    while (now < deadline || samples.size() < 5) {
+        long long t0 = get_current_time_ns();
+        fn(batch);
+        now = get_current_time_ns();
+        samples.push_back(static_cast<double>(now - t0) / batch);
+        ops += batch;
+    }
+    double elapsed_ns = static_cast<double>(now - start);
+    uint64_t allocations = allocation_count.load(memory_order_relaxed) - allocations_before;
+
+    sort(samples.begin(), samples.end());
+    BenchResult result;
+    result.name = name;
+    result.ops = ops;
+    result.ns_per_op = elapsed_ns / ops;
+    result.ops_per_sec = ops / (elapsed_ns / 1e9);
+    result.mb_per_sec = bytes_per_op * result.ops_per_sec / 1e6;
+    result.p50_ns = samples[samples.size() / 2];
+    result.p99_ns = samples[min(samples.size() - 1, samples.size() * 99 / 100)];
+    result.max_ns = samples.back();
+    result.allocs_per_op = static_cast<double>(allocations) / ops;
+    return result;
+}
+
+static BenchResult from_latencies(const string& name, size_t bytes_per_op,
+                                  vector<long long>& latencies, long long elapsed_ns,
+                                  uint64_t allocations) {
+    sort(latencies.begin(), latencies.end());
+    BenchResult result;
+    result.name = name;
+    result.ops = latencies.size();
+    result.ns_per_op = static_cast<double>(elapsed_ns) / max<size_t>(1, latencies.size());
+    result.ops_per_sec = latencies.size() / (elapsed_ns / 1e9);
+    result.mb_per_sec = bytes_per_op * result.ops_per_sec / 1e6;
+    result.p50_ns = latencies.empty() ? 0 : latencies[latencies.size() / 2];
+    result.p99_ns = latencies.empty() ? 0 : latencies[min(latencies.size() - 1, latencies.size() * 99 / 100)];
+    result.max_ns = latencies.empty() ? 0 : latencies.back();
+    result.allocs_per_op = static_cast<double>(allocations) / max<size_t>(1, latencies.size());
+    return result;
+}
+
+struct TestFile {
+    string name;
+    string path;
+    vector<string> lines;
+    string data;
+    size_t size;
+};
+
+static vector<TestFile> load_test_files() {
+    vector<string> paths;
+    vector<TestFile> files;
+    if (!list_files(options.data_dir, paths)) {
+        return files;
+    }
+    sort(paths.begin(), paths.end());
+    for (const auto& path : paths) {
+        string name = get_filename(path);
+        if (name.find(".txt") == string::npos) {
+            continue;
+        }
+        TestFile f;
+        f.name = name.substr(0, name.find(".txt"));
+        f.path = path;
+        if (read_file_lines(path, f.lines) && read_file_data(path, f.data)) {
+            f.size = get_file_size(f.lines);
+            files.push_back(move(f));
+        }
+    }
+    return files;
+}
+
+static void bench_socket_transfer(const vector<TestFile>& files, vector<BenchResult>& out) {
+    for (const auto& f : files) {
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+            cerr << "Error: socketpair failed" << endl;
+            return;
+        }
+        auto response = build_response(FileVersion(), make_file_data(f.data));
+        out.push_back(run_timed("transfer/" + f.name, f.size, 1, [&](size_t n) {
+            thread sender([&] {
+                for (size_t i = 0; i < n; ++i) {
+                    send_response(fds[0], *response, false, 10);
+                }
+            });
+            string status, size_line, received;
+            for (size_t i = 0; i < n; ++i) {
+                recv_line(fds[1], status);
+                recv_line(fds[1], size_line);
+                recv_file_data(fds[1], f.size, received);
+            }
+            sender.join();
+        }));
+        close(fds[0]);
+        close(fds[1]);
+    }
+}
+
+static void bench_scheduler(SchedulingPolicy policy, const string& name, vector<BenchResult>& out) {
+    const int producers = 4;
+    const int consumers = 4;
+    const int per_producer = 50000;
+
+    auto sched = create_scheduler(policy, 5);
+    vector<long long> latencies(static_cast<size_t>(producers) * per_producer);
+    atomic<int> consumed(0);
+
+    uint64_t allocations_before = allocation_count.load(memory_order_relaxed);
+    long long start = get_current_time_ns();
+    vector<thread> threads;
+    for (int c = 0; c < consumers; ++c) {
+        threads.emplace_back([&] {
+            while (auto req = sched->get_next_request()) {
+                consumed.fetch_add(1, memory_order_relaxed);
+            }
+        });
+    }
+    vector<thread> producer_threads;
+    for (int p = 0; p < producers; ++p) {
+        producer_threads.emplace_back([&, p] {
+            for (int i = 0; i < per_producer; ++i) {
+                auto req = make_shared<Request>();
+                req->file_size = static_cast<size_t>((i * 7919) % 810000);
+                long long t0 = get_current_time_ns();
+                sched->add_request(req);
+                latencies[static_cast<size_t>(p) * per_producer + i] = get_current_time_ns() - t0;
+            }
+        });
+    }
+    for (auto& t : producer_threads) {
+        t.join();
+    }
+    while (consumed.load() < producers * per_producer) {
+        this_thread::yield();
+    }
+    long long elapsed = get_current_time_ns() - start;
+    uint64_t allocations = allocation_count.load(memory_order_relaxed) - allocations_before;
+    sched->signal_shutdown();
+    for (auto& t : threads) {
+        t.join();
+    }
+    out.push_back(from_latencies("scheduler/" + name, 0, latencies, elapsed, allocations));
+}
+
+static void bench_storage(const vector<TestFile>& files, vector<BenchResult>& out) {
+    FileStore store;
+    for (const auto& f : files) {
+        store.publish(f.name, make_file_data(f.data));
+    }
+    for (const auto& f : files) {
+        out.push_back(run_timed("store/" + f.name, f.size, 4, [&](size_t n) {
+            for (size_t i = 0; i < n; ++i) {
+                store.publish(f.name, make_file_data(f.data));
+            }
+        }));
+    }
+
+    for (const auto& f : files) {
+        const int readers = 4;
+        out.push_back(run_timed("retrieve_x4/" + f.name, f.size, readers * 4, [&](size_t n) {
+            vector<thread> threads;
+            for (int r = 0; r < readers; ++r) {
+                threads.emplace_back([&] {
+                    volatile size_t sink = 0;
+                    for (size_t i = 0; i < n / readers; ++i) {
+                        sink = sink + store.lookup(f.name)->size();
+                    }
+                });
+            }
+            for (auto& t : threads) {
+                t.join();
+            }
+        }));
+    }
+}
+
+struct CompletionRecord {
+    RequestType type;
+    string filename;
+    size_t file_size;
+    long long arrival_time;
+    long long start_time;
+    long long finish_time;
+};
+
+// One GET through the server's per-request path: take a request, parse its
+// header from a socket, queue and dequeue it and keep a completion record.
+// "unpooled" allocates a fresh request and keeps a copy of it when done, as
+// the server did before it pooled requests.
+static void bench_request_lifecycle(vector<BenchResult>& out) {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+        cerr << "Error: socketpair failed" << endl;
+        return;
+    }
+    auto sched = create_scheduler(SchedulingPolicy::FCFS, 5);
+    const string header = "GET medium_file_1.txt zlib VERSION 12-00000000deadbeef\n";
+
+    vector<Request> copies;
+    out.push_back(run_timed("lifecycle/unpooled", 0, 64, [&](size_t n) {
+        for (size_t i = 0; i < n; ++i) {
+            send_bytes(fds[0], header.data(), header.size());
+            auto request = make_shared<Request>();
+            request->arrival_time = get_current_time_ns();
+            parse_request(fds[1], *request);
+            sched->add_request(request);
+            auto next = sched->get_next_request();
+            next->finish_time = get_current_time_ns();
+            copies.push_back(*next);
+        }
+        copies.clear();
+    }));
+
+    RequestPool pool;
+    vector<CompletionRecord> records;
+    out.push_back(run_timed("lifecycle/pooled", 0, 64, [&](size_t n) {
+        for (size_t i = 0; i < n; ++i) {
+            send_bytes(fds[0], header.data(), header.size());
+            auto request = pool.acquire();
+            request->arrival_time = get_current_time_ns();
+            parse_request(fds[1], *request);
+            sched->add_request(move(request));
+            auto next = sched->get_next_request();
+            next->finish_time = get_current_time_ns();
+            records.push_back({next->type, next->filename, next->file_size,
+                               next->arrival_time, next->start_time, next->finish_time});
+            pool.release(move(next));
+        }
+        records.clear();
+    }));
+
+    sched->signal_shutdown();
+    close(fds[0]);
+    close(fds[1]);
+}
+
+static void bench_utils(const vector<TestFile>& files, vector<BenchResult>& out) {
+    for (const auto& f : files) {
+        volatile size_t sink = 0;
+        out.push_back(run_timed("get_file_size/" + f.name, f.size, 64, [&](size_t n) {
+            for (size_t i = 0; i < n; ++i) {
+                sink = sink + get_file_size(f.lines);
+            }
+        }));
+        out.push_back(run_timed("read_file_lines/" + f.name, f.size, 2, [&](size_t n) {
+            vector<string> lines;
+            for (size_t i = 0; i < n; ++i) {
+                read_file_lines(f.path, lines);
+            }
+        }));
+    }
+}
+
+static void bench_search(const vector<TestFile>& files, vector<BenchResult>& out) {
+    for (const auto& f : files) {
+        volatile size_t sink = 0;
+        out.push_back(run_timed("find_substring/" + f.name, f.size, 64, [&](size_t n) {
+            for (size_t i = 0; i < n; ++i) {
+                sink = sink + find_substring(f.data, "no such text");
+            }
+        }));
+        out.push_back(run_timed("append_matching_lines/" + f.name, f.size, 16, [&](size_t n) {
+            string lines;
+            for (size_t i = 0; i < n; ++i) {
+                lines.clear();
+                sink = sink + append_matching_lines(f.data, "ab", lines);
+            }
+        }));
+    }
+}
+
+static map<string, double> load_baseline(const string& path) {
+    map<string, double> baseline;
+    ifstream file(path);
+    string line;
+    getline(file, line);
+    while (getline(file, line)) {
+        istringstream iss(line);
+        string name, ops, ns_per_op;
+        if (getline(iss, name, ',') && getline(iss, ops, ',') && getline(iss, ns_per_op, ',')) {
+            baseline[name] = atof(ns_per_op.c_str());
+        }
+    }
+    return baseline;
+}
+
+static const char* CSV_HEADER = "benchmark,ops,ns_per_op,ops_per_sec,mb_per_sec,p50_ns,p99_ns,max_ns,allocs_per_op";
+
+static string to_csv(const BenchResult& r) {
+    ostringstream oss;
+    oss << fixed << setprecision(1)
+        << r.name << "," << r.ops << "," << r.ns_per_op << "," << r.ops_per_sec << ","
+        << setprecision(2) << r.mb_per_sec << "," << setprecision(1)
+        << r.p50_ns << "," << r.p99_ns << "," << r.max_ns << ","
+        << setprecision(2) << r.allocs_per_op;
+    return oss.str();
+}
+
+static void print_usage(const char* prog_name) {
+    cout << "Usage: " << prog_name << " [options]\n"
+         << "Options:\n"
+         << "  --data <dir>          Directory with test files (default: testdata)\n"
+         << "  --baseline <path>     Baseline CSV to compare against (default: results/bench_baseline.csv)\n"
+         << "  --update-baseline     Write this run's results as the new baseline\n"
+         << "  --threshold <X>       Flag ns/op regressions above X (default: 0.30 = 30%)\n"
+         << "  --min-time <S>        Minimum seconds per benchmark (default: 0.3)\n"
+         << "  --filter <substr>     Only run benchmarks whose group contains substr\n"
+         << "  --help                Show this help message\n";
+}
+
+int main(int argc, char* argv[]) {
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--data" && i + 1 < argc) {
+            options.data_dir = argv[++i];
+        } else if (arg == "--baseline" && i + 1 < argc) {
+            options.baseline_path = argv[++i];
+        } else if (arg == "--update-baseline") {
+            options.update_baseline = true;
+        } else if (arg == "--threshold" && i + 1 < argc) {
+            options.threshold = atof(argv[++i]);
+        } else if (arg == "--min-time" && i + 1 < argc) {
+            options.min_time_s = atof(argv[++i]);
+        } else if (arg == "--filter" && i + 1 < argc) {
+            options.filter = argv[++i];
+        } else {
+            print_usage(argv[0]);
+            return arg == "--help" ? 0 : 1;
+        }
+    }
+
+    vector<TestFile> files = load_test_files();
+    if (files.empty()) {
+        cerr << "Error: No test files found in " << options.data_dir << endl;
+        return 1;
+    }
+
+    auto selected = [](const string& group) {
+        return options.filter.empty() || group.find(options.filter) != string::npos;
+    };
+
+    vector<BenchResult> results;
+    if (selected("transfer")) bench_socket_transfer(files, results);
+    if (selected("scheduler")) {
+        bench_scheduler(SchedulingPolicy::FCFS, "fcfs", results);
+        bench_scheduler(SchedulingPolicy::SJF, "sjf", results);
+        bench_scheduler(SchedulingPolicy::RR, "rr", results);
+    }
+    if (selected("storage")) bench_storage(files, results);
+    if (selected("lifecycle")) bench_request_lifecycle(results);
+    if (selected("search")) bench_search(files, results);
+    if (selected("utils")) bench_utils(files, results);
+
+    map<string, double> baseline = load_baseline(options.baseline_path);
+    int regressions = 0;
+
+    cout << CSV_HEADER << ",baseline_ns_per_op,change_pct,status\n";
+    for (const auto& r : results) {
+        cout << to_csv(r);
+        auto it = baseline.find(r.name);
+        if (it == baseline.end() || it->second <= 0) {
+            cout << ",,,new\n";
+            continue;
+        }
+        double change = (r.ns_per_op - it->second) / it->second;
+        bool regressed = change > options.threshold;
+        regressions += regressed ? 1 : 0;
+        cout << fixed << setprecision(1) << "," << it->second << "," << change * 100.0 << ","
+             << (regressed ? "REGRESSION" : "ok") << "\n";
+        cout.unsetf(ios::fixed);
+    }
+
+    if (options.update_baseline) {
+        ofstream file(options.baseline_path);
+        if (!file.is_open()) {
+            cerr << "Error: Cannot write baseline " << options.baseline_path << endl;
+            return 1;
+        }
+        file << CSV_HEADER << "\n";
+        for (const auto& r : results) {
+            file << to_csv(r) << "\n";
+        }
+        cerr << "[Bench] Baseline written to " << options.baseline_path << endl;
+        return 0;
+    }
+
+    if (regressions > 0) {
+        cerr << "[Bench] " << regressions << " benchmark(s) regressed by more than "
+             << options.threshold * 100.0 << "% versus " << options.baseline_path << endl;
+        return 2;
+    }
+    return 0;
+}
@@ -0,0 +1,112 @@
+#include "compression.h"
+#include "stats.h"
+#include "utils.h"
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+using namespace std;
+
+struct Timing {
+    double wall_s;
+    double cpu_s;
+};
+
+static double cpu_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Repeats op until min_time has passed and returns the per-call average.
+template <typename Op>
+static Timing time_op(double min_time, Op op) {
+    long long start = get_current_time_ns();
+    double cpu_start = cpu_seconds();
+    long long calls = 0;
+    do {
+        op();
+        ++calls;
+    } while ((get_current_time_ns() - start) / 1e9 < min_time);
+    return {(get_current_time_ns() - start) / 1e9 / calls, (cpu_seconds() - cpu_start) / calls};
+}
+
+static vector<int> parse_levels(const string& list) {
+    vector<int> levels;
+    istringstream iss(list);
+    string item;
+    while (getline(iss, item, ',')) {
+        int level = atoi(item.c_str());
+        if (level >= 1 && level <= 9) {
+            levels.push_back(level);
+        }
+    }
+    return levels;
+}
+
+int main(int argc, char* argv[]) {
+    string data_dir = "testdata";
+    vector<int> levels = {1, 3, 6, 9};
+    double link_mbps = 1000.0;
+    double min_time = 0.2;
+
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--data" && i + 1 < argc) {
+            data_dir = argv[++i];
+        } else if (arg == "--levels" && i + 1 < argc) {
+            levels = parse_levels(argv[++i]);
+        } else if (arg == "--link-mbps" && i + 1 < argc) {
+            link_mbps = atof(argv[++i]);
+        } else if (arg == "--min-time" && i + 1 < argc) {
+            min_time = atof(argv[++i]);
+        } else {
+            cout << "Usage: " << argv[0] << " [--data dir] [--levels 1,3,6,9] [--link-mbps M] [--min-time S]\n";
+            return arg == "--help" ? 0 : 1;
+        }
+    }
+
+    vector<string> paths;
+    if (!list_files(data_dir, paths) || levels.empty() || link_mbps <= 0) {
+        cerr << "Error: Cannot list files in " << data_dir << endl;
+        return 1;
+    }
+    sort(paths.begin(), paths.end());
+
+    // transfer_ms models a GET over a link of link_mbps: the plain body, or the
+    // cached compressed body plus client-side inflate (cold adds the deflate).
+    cout << "file,size_class,raw_bytes,level,wire_bytes,ratio,compress_mb_s,compress_cpu_ms,"
+         << "decompress_mb_s,decompress_cpu_ms,plain_transfer_ms,cached_transfer_ms,cold_transfer_ms\n";
+    double bytes_per_ms = link_mbps * 1e6 / 8 / 1000;
+    for (const auto& path : paths) {
+        string data;
+        if (!read_file_data(path, data) || data.empty()) {
+            continue;
+        }
+        for (int level : levels) {
+            string wire;
+            Timing deflate = time_op(min_time, [&] { compress_data(data, wire, level); });
+            string decoded;
+            Timing inflate = time_op(min_time, [&] { decompress_data(wire, data.size(), decoded); });
+            if (decoded != data) {
+                cerr << "Error: round trip mismatch for " << path << endl;
+                return 1;
+            }
+
+            double mb = data.size() / 1e6;
+            double plain_ms = data.size() / bytes_per_ms;
+            double cached_ms = wire.size() / bytes_per_ms + inflate.wall_s * 1000;
+            char row[512];
+            snprintf(row, sizeof(row), "%s,%s,%zu,%d,%zu,%.2f,%.1f,%.3f,%.1f,%.3f,%.3f,%.3f,%.3f",
+                     get_filename(path).c_str(), size_class_name(size_class_of(data.size())),
+                     data.size(), level, wire.size(), static_cast<double>(data.size()) / wire.size(),
+                     mb / deflate.wall_s, deflate.cpu_s * 1000, mb / inflate.wall_s, inflate.cpu_s * 1000,
+                     plain_ms, cached_ms, cached_ms + deflate.wall_s * 1000);
+            cout << row << "\n";
+        }
+    }
+    return 0;
+}
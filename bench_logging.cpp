@@ -0,0 +1,111 @@
+#include "logger.h"
+#include "utils.h"
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstring>
+
+using namespace std;
+
+enum class BenchMode {
+    COUT,
+    ASYNC,
+    OFF
+};
+
+static const char* mode_name(BenchMode mode) {
+    switch (mode) {
+        case BenchMode::COUT: return "cout+endl";
+        case BenchMode::ASYNC: return "async";
+        case BenchMode::OFF: return "off";
+    }
+    return "?";
+}
+
+// Emits the same two lines per request that the server does on its hot path:
+// the accept notice and the completion notice.
+static void simulate_requests(BenchMode mode, int thread_id, int requests) {
+    string filename = "large_" + to_string(thread_id) + ".txt";
+    for (int i = 0; i < requests; ++i) {
+        double response_ms = 0.25 + (i % 100) * 0.01;
+        if (mode == BenchMode::COUT) {
+            cout << "[Server] Accepted connection from 127.0.0.1" << endl;
+            cout << "[Worker] Completed GET " << filename
+                 << " (Response time: " << response_ms << " ms)" << endl;
+        } else {
+            LOG(INFO) << "[Server] Accepted connection from 127.0.0.1";
+            LOG(INFO) << "[Worker] Completed GET " << filename
+                      << " (Response time: " << response_ms << " ms)";
+        }
+    }
+}
+
+static double run_mode(BenchMode mode, int threads, int requests_per_thread, const string& out_path) {
+    fflush(stdout);
+    cout.flush();
+    int saved_stdout = dup(STDOUT_FILENO);
+    int out_fd = open(out_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (saved_stdout < 0 || out_fd < 0) {
+        cerr << "Error: Cannot open " << out_path << endl;
+        return 0;
+    }
+    dup2(out_fd, STDOUT_FILENO);
+    close(out_fd);
+
+    set_log_level(mode == BenchMode::OFF ? LogLevel::OFF : LogLevel::INFO);
+    if (mode == BenchMode::ASYNC) {
+        start_logger();
+    }
+
+    long long start = get_current_time_ns();
+    vector<thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back(simulate_requests, mode, t, requests_per_thread);
+    }
+    for (auto& w : workers) {
+        w.join();
+    }
+    long long elapsed = get_current_time_ns() - start;
+
+    if (mode == BenchMode::ASYNC) {
+        stop_logger();
+    }
+    cout.flush();
+    fflush(stdout);
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+
+    return static_cast<double>(threads) * requests_per_thread / (elapsed / 1e9);
+}
+
+int main(int argc, char* argv[]) {
+    int threads = 8;
+    int requests = 50000;
+    string out_path = "/dev/null";
+
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--threads" && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        } else if (arg == "--requests" && i + 1 < argc) {
+            requests = atoi(argv[++i]);
+        } else if (arg == "--out" && i + 1 < argc) {
+            out_path = argv[++i];
+        } else {
+            cout << "Usage: " << argv[0] << " [--threads N] [--requests N] [--out path]\n";
+            return arg == "--help" ? 0 : 1;
+        }
+    }
+
+    cout << "mode,threads,requests_per_thread,requests_per_sec\n";
+    const BenchMode modes[] = {BenchMode::COUT, BenchMode::ASYNC, BenchMode::OFF};
+    for (BenchMode mode : modes) {
+        double rps = run_mode(mode, threads, requests, out_path);
+        cout << mode_name(mode) << "," << threads << "," << requests << ","
+             << static_cast<long long>(rps) << endl;
+    }
+    return 0;
+}
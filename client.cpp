@@ -1,5 +1,10 @@
+#include "client_cache.h"
+#include "compression.h"
 #include "config.h"
+#include "hash.h"
+#include "loadgen.h"
 #include "protocol.h"
+#include "swarm.h"
 #include "utils.h"
 #include <iostream>
 #include <thread>
@@ -10,11 +15,19 @@
 #include <unistd.h>
 #include <cstring>
 #include <random>
+#include <sstream>
 #include <chrono>
+#include <csignal>
 #include <sys/stat.h>
+#include <fcntl.h>
 
 using namespace std;
 
+bool verbose = true;
+int compress_level = 0;
+bool dedup = false;
+unique_ptr<ClientCache> cache;
+
 int connect_to_server(const string& ip, int port) {
     int sock = socket(AF_INET, SOCK_STREAM, 0);
   if (sock < 0) {
@@ -37,37 +50,77 @@ int connect_to_server(const string& ip, int port) {
 
 bool send_put_request(const string& server_ip, int server_port, 
                      const string& filename) {
-    vector<string> lines;
-  if (!read_file_lines(filename, lines)) {
+    int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
         cerr << "[Client] Cannot read file: " << filename << endl;
-      return false;
+        if (fd >= 0) {
+            close(fd);
+        }
+        return false;
     }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    size_t file_bytes = static_cast<size_t>(st.st_size);
+    char last = '\n';
+    if (file_bytes > 0 && pread(fd, &last, 1, st.st_size - 1) != 1) {
+        close(fd);
+        return false;
+    }
+    bool add_newline = last != '\n';
+    size_t file_size = file_bytes + (add_newline ? 1 : 0);
     
     int sock = connect_to_server(server_ip, server_port);
     if (sock < 0) {
   cerr << "[Client] Cannot connect to server" << endl;
+        close(fd);
         return false;
     }
     
   string base_filename = get_filename(filename);
-    if (!send_line(sock, PROTOCOL_PUT + " " + base_filename)) {
-        close(sock);
-        return false;
+    bool sent = send_line(sock, PROTOCOL_PUT + " " + base_filename);
+    if (sent && dedup) {
+        // Offer the content hash first; the body is only sent if the server
+        // does not already hold these bytes.
+        uint64_t hash = 0;
+        size_t hashed_size = 0;
+        string reply;
+        sent = content_hash_fd(fd, hash, hashed_size) && lseek(fd, 0, SEEK_SET) == 0 &&
+               send_line(sock, PROTOCOL_HASH + " " + hash_to_hex(hash) + " " + to_string(hashed_size)) &&
+               recv_line(sock, reply);
+        if (sent && reply != PROTOCOL_SEND) {
+            close(fd);
+            close(sock);
+            if (reply != PROTOCOL_OK) {
+                cerr << "[Client] PUT " << base_filename << " - FAILED: " << reply << endl;
+                return false;
+            }
+            if (verbose) {
+                cout << "[Client] PUT " << base_filename << " - SUCCESS (deduplicated)" << endl;
+            }
+            return true;
+        }
     }
-    
-    size_t file_size = get_file_size(lines);
-  if (!send_line(sock, PROTOCOL_SIZE + " " + to_string(file_size))) {
-        close(sock);
-        return false;
-  }
-    
-    if (!send_file(sock, lines, 1)) {
-      close(sock);
-        return false;
+    // The compressed body must be built before its SIZE line can be sent;
+    // it is typically a fraction of the file, which is still never buffered.
+    string wire;
+    size_t decoded_size = 0;
+    if (sent && compress_level > 0 && file_size >= MIN_COMPRESS_SIZE &&
+        compress_fd(fd, wire, decoded_size, compress_level) && wire.size() < decoded_size) {
+        sent = send_line(sock, PROTOCOL_ENCODING + " " + ENCODING_ZLIB + " " + to_string(decoded_size)) &&
+               send_line(sock, PROTOCOL_SIZE + " " + to_string(wire.size())) &&
+               send_bytes(sock, wire.data(), wire.size()) &&
+               send_line(sock, PROTOCOL_END);
+    } else if (sent) {
+        sent = lseek(fd, 0, SEEK_SET) == 0 &&
+               send_line(sock, PROTOCOL_SIZE + " " + to_string(file_size)) &&
+               send_file_fd(sock, fd, file_bytes, add_newline);
     }
+    close(fd);
     
   string response;
-    if (!recv_line(sock, response)) {
+    if (!recv_line(sock, response) || (!sent && response == PROTOCOL_OK)) {
+        cerr << "[Client] PUT " << base_filename << " - FAILED: connection lost" << endl;
         close(sock);
       return false;
     }
@@ -75,7 +128,9 @@ bool send_put_request(const string& server_ip, int server_port,
     close(sock);
     
   if (response == PROTOCOL_OK) {
-        cout << "[Client] PUT " << base_filename << " - SUCCESS" << endl;
+        if (verbose) {
+            cout << "[Client] PUT " << base_filename << " - SUCCESS" << endl;
+        }
         return true;
     } else {
       cerr << "[Client] PUT " << base_filename << " - FAILED: " << response << endl;
@@ -83,15 +138,140 @@ bool send_put_request(const string& server_ip, int server_port,
     }
 }
 
+// Adds the lines of a local file to the end of remote_name on the server.
+bool send_append_request(const string& server_ip, int server_port,
+                         const string& filename, const string& remote_name) {
+    string lines;
+    if (!read_file_data(filename, lines)) {
+        return false;
+    }
+    int sock = connect_to_server(server_ip, server_port);
+    if (sock < 0) {
+        cerr << "[Client] Cannot connect to server" << endl;
+        return false;
+    }
+    string response;
+    bool ok = send_line(sock, PROTOCOL_APPEND + " " + remote_name) &&
+              send_line(sock, PROTOCOL_SIZE + " " + to_string(lines.size())) &&
+              send_bytes(sock, lines.data(), lines.size()) &&
+              send_line(sock, PROTOCOL_END) &&
+              recv_line(sock, response) && response == PROTOCOL_OK;
+    close(sock);
+    if (!ok) {
+        cerr << "[Client] APPEND " << remote_name << " - FAILED: "
+             << (response.empty() ? "connection lost" : response) << endl;
+        return false;
+    }
+    if (verbose) {
+        cout << "[Client] APPEND " << remote_name << " - SUCCESS (" << lines.size() << " bytes)" << endl;
+    }
+    return true;
+}
+
+// Fetches only the lines of filename that contain pattern, found by the
+// server, into output_path.
+bool send_grep_request(const string& server_ip, int server_port, const string& filename,
+                       const string& pattern, const string& output_path) {
+    int sock = connect_to_server(server_ip, server_port);
+    if (sock < 0) {
+        cerr << "[Client] Cannot connect to server" << endl;
+        return false;
+    }
+    string response, size_line;
+    size_t size = 0;
+    if (!send_line(sock, PROTOCOL_GREP + " " + filename + " " + pattern) ||
+        !recv_line(sock, response) || response != PROTOCOL_OK ||
+        !recv_line(sock, size_line) || sscanf(size_line.c_str(), "SIZE %zu", &size) != 1) {
+        cerr << "[Client] GREP " << filename << " - FAILED: "
+             << (response.empty() ? "connection lost" : response) << endl;
+        close(sock);
+        return false;
+    }
+    int fd = open(output_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        cerr << "Error: Cannot create file " << output_path << endl;
+        close(sock);
+        return false;
+    }
+    bool received = recv_file_fd(sock, size, fd);
+    close(sock);
+    if (close(fd) != 0 || !received) {
+        return false;
+    }
+    if (verbose) {
+        cout << "[Client] GREP " << filename << " - SUCCESS (" << size << " bytes)" << endl;
+    }
+    return true;
+}
+
+// Follows filename until count versions have been pushed, keeping
+// output_path equal to the latest. The first push is the current contents.
+bool send_watch_request(const string& server_ip, int server_port, const string& filename,
+                        const string& output_path, int count) {
+    int sock = connect_to_server(server_ip, server_port);
+    if (sock < 0) {
+        cerr << "[Client] Cannot connect to server" << endl;
+        return false;
+    }
+    string response, version_line;
+    if (!send_line(sock, PROTOCOL_WATCH + " " + filename + " " + WATCH_BODY + " " +
+                             PROTOCOL_VERSION + " " + VERSION_NONE) ||
+        !recv_line(sock, response) || response != PROTOCOL_OK || !recv_line(sock, version_line)) {
+        cerr << "[Client] WATCH " << filename << " - FAILED: "
+             << (response.empty() ? "connection lost" : response) << endl;
+        close(sock);
+        return false;
+    }
+    int fd = open(output_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        cerr << "Error: Cannot create file " << output_path << endl;
+        close(sock);
+        return false;
+    }
+    bool ok = true;
+    for (int i = 0; i < count && ok; ++i) {
+        string event, size_line, end;
+        size_t size = 0;
+        ok = recv_line(sock, event) && recv_line(sock, size_line) &&
+             sscanf(size_line.c_str(), "SIZE %zu", &size) == 1;
+        if (!ok) {
+            break;
+        }
+        // CHANGED replaces the contents; APPENDED adds to them.
+        bool appended = event.compare(0, PROTOCOL_APPENDED.size(), PROTOCOL_APPENDED) == 0;
+        ok = (appended ? lseek(fd, 0, SEEK_END) >= 0
+                       : ftruncate(fd, 0) == 0 && lseek(fd, 0, SEEK_SET) == 0) &&
+             recv_file_fd(sock, size, fd) && recv_line(sock, end) && end == PROTOCOL_END;
+        if (ok && verbose) {
+            cout << "[Client] WATCH " << filename << " - " << event << " (" << size << " bytes)" << endl;
+        }
+    }
+    close(sock);
+    return close(fd) == 0 && ok;
+}
+
+// With a cache, the GET names the version already held so the server can
+// answer NOT-MODIFIED instead of resending it. revalidate=false asks for the
+// body regardless, for when the cached copy turns out to be unusable.
 bool send_get_request(const string& server_ip, int server_port, 
-                     const string& filename, const string& output_path) {
+                     const string& filename, const string& output_path,
+                     bool revalidate = true) {
   int sock = connect_to_server(server_ip, server_port);
     if (sock < 0) {
         cerr << "[Client] Cannot connect to server" << endl;
       return false;
     }
     
-    if (!send_line(sock, PROTOCOL_GET + " " + filename)) {
+    string get_line = PROTOCOL_GET + " " + filename;
+    if (compress_level > 0) {
+        get_line += " " + ENCODING_ZLIB;
+    }
+    FileVersion cached;
+    if (cache) {
+        bool held = revalidate && cache->version(filename, cached);
+        get_line += " " + PROTOCOL_VERSION + " " + (held ? format_version(cached) : VERSION_NONE);
+    }
+    if (!send_line(sock, get_line)) {
   close(sock);
         return false;
     }
@@ -101,39 +281,119 @@ bool send_get_request(const string& server_ip, int server_port,
         close(sock);
         return false;
     }
+
+    if (cache && response.compare(0, PROTOCOL_NOT_MODIFIED.size() + 1, PROTOCOL_NOT_MODIFIED + " ") == 0) {
+        close(sock);
+        FileVersion current;
+        if (!parse_version(response.substr(PROTOCOL_NOT_MODIFIED.size() + 1), current) ||
+            !cache->restore(filename, current, output_path)) {
+            return send_get_request(server_ip, server_port, filename, output_path, false);
+        }
+        if (verbose) {
+            cout << "[Client] GET " << filename << " - SUCCESS (not modified, from cache)" << endl;
+        }
+        return true;
+    }
     
   if (response != PROTOCOL_OK) {
         cerr << "[Client] GET " << filename << " - FAILED: " << response << endl;
         close(sock);
       return false;
     }
-    
+
+    FileVersion version;
     string size_line;
+    if (cache) {
+        if (!recv_line(sock, size_line) ||
+            size_line.compare(0, PROTOCOL_VERSION.size() + 1, PROTOCOL_VERSION + " ") != 0 ||
+            !parse_version(size_line.substr(PROTOCOL_VERSION.size() + 1), version)) {
+            close(sock);
+            return false;
+        }
+    }
+    
     if (!recv_line(sock, size_line)) {
   close(sock);
         return false;
     }
+
+    size_t decoded_size = 0;
+    bool compressed = sscanf(size_line.c_str(), "ENCODING zlib %zu", &decoded_size) == 1;
+    if (compressed && !recv_line(sock, size_line)) {
+        close(sock);
+        return false;
+    }
     
   size_t file_size;
     sscanf(size_line.c_str(), "SIZE %zu", &file_size);
     
-    vector<string> lines;
-  if (!recv_file(sock, file_size, lines)) {
+    int fd = open(output_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        cerr << "Error: Cannot create file " << output_path << endl;
         close(sock);
         return false;
     }
-    
+
+    bool received = compressed ? recv_compressed_fd(sock, file_size, decoded_size, fd)
+                               : recv_file_fd(sock, file_size, fd);
   close(sock);
-    
-    if (!write_file_lines(output_path, lines)) {
+    if (close(fd) != 0 || !received) {
       return false;
     }
+    if (cache) {
+        cache->store(filename, version, output_path);
+    }
     
-    cout << "[Client] GET " << filename << " - SUCCESS (" 
-  << lines.size() << " lines)" << endl;
+    if (verbose) {
+        cout << "[Client] GET " << filename << " - SUCCESS (" 
+             << (compressed ? decoded_size : file_size) << " bytes";
+        if (compressed) {
+            cout << ", " << file_size << " on the wire";
+        }
+        cout << ")" << endl;
+    }
     return true;
 }
 
+bool send_stats_request(const string& server_ip, int server_port) {
+    int sock = connect_to_server(server_ip, server_port);
+    if (sock < 0) {
+        cerr << "[Client] Cannot connect to server" << endl;
+        return false;
+    }
+
+    if (!send_line(sock, PROTOCOL_STATS)) {
+        close(sock);
+        return false;
+    }
+
+    string response;
+    if (!recv_line(sock, response) || response != PROTOCOL_OK) {
+        cerr << "[Client] STATS - FAILED: " << response << endl;
+        close(sock);
+        return false;
+    }
+
+    string size_line;
+    if (!recv_line(sock, size_line)) {
+        close(sock);
+        return false;
+    }
+
+    size_t size;
+    sscanf(size_line.c_str(), "SIZE %zu", &size);
+
+    vector<string> lines;
+    bool ok = recv_file(sock, size, lines);
+    close(sock);
+
+    for (const auto& line : lines) {
+        cout << line << "\n";
+    }
+    cout << flush;
+    return ok;
+}
+
 void client_thread_func(int thread_id, const Config& config, 
                        const vector<string>& test_files,
                        int num_requests_per_thread) {
@@ -167,7 +427,11 @@ void interactive_mode(const Config& config) {
   cout << "\n=== Interactive Client Mode ===\n"
               << "Commands:\n"
               << "  put <local_file>       Upload file to server\n"
+              << "  append <local> <remote> Add the lines of <local> to <remote>\n"
   << "  get <remote_file>      Download file from server\n"
+              << "  grep <remote> <text>   Download the lines of <remote> containing <text>\n"
+              << "  watch <remote> <N>     Follow <remote> for N pushed versions\n"
+              << "  stats                  Show live server statistics\n"
               << "  quit                   Exit\n"
               << "===============================\n" << endl;
     
@@ -190,6 +454,16 @@ void interactive_mode(const Config& config) {
                 continue;
             }
   send_put_request(config.server_ip, config.server_port, filename);
+        } else if (op == "append") {
+            string remote;
+            iss >> remote;
+            if (filename.empty() || remote.empty()) {
+                cout << "Usage: append <local_file> <remote_file>" << endl;
+                continue;
+            }
+            send_append_request(config.server_ip, config.server_port, filename, remote);
+        } else if (op == "stats") {
+            send_stats_request(config.server_ip, config.server_port);
         } else if (op == "get") {
             if (filename.empty()) {
   cout << "Usage: get <remote_file>" << endl;
@@ -197,6 +471,24 @@ void interactive_mode(const Config& config) {
             }
             string output = "client_outputs/downloaded_" + filename;
   send_get_request(config.server_ip, config.server_port, filename, output);
+        } else if (op == "grep") {
+            string pattern;
+            getline(iss >> ws, pattern);
+            if (filename.empty() || pattern.empty()) {
+                cout << "Usage: grep <remote_file> <text>" << endl;
+                continue;
+            }
+            string output = "client_outputs/grep_" + filename;
+            send_grep_request(config.server_ip, config.server_port, filename, pattern, output);
+        } else if (op == "watch") {
+            int count = 0;
+            iss >> count;
+            if (filename.empty() || count <= 0) {
+                cout << "Usage: watch <remote_file> <versions>" << endl;
+                continue;
+            }
+            string output = "client_outputs/watched_" + filename;
+            send_watch_request(config.server_ip, config.server_port, filename, output, count);
         } else {
             cout << "Unknown command: " << op << endl;
   }
@@ -234,16 +526,90 @@ void test_mode(const Config& config, const vector<string>& test_files,
               << "====================\n" << endl;
 }
 
+void open_loop_mode(const Config& config, const vector<string>& test_files,
+                    const LoadSpec& spec) {
+    mkdir("client_outputs", 0755);
+    vector<LoadFile> files = classify_load_files(test_files);
+
+    cout << "\n=== Running Open-Loop Mode ===\n"
+         << "Target rate: " << spec.rate << " req/s ("
+         << (spec.arrivals == ArrivalProcess::POISSON ? "poisson" : "fixed") << " arrivals)\n"
+         << "Duration: " << spec.duration_s << " s\n"
+         << "PUT ratio: " << spec.put_ratio << "\n"
+         << "Senders: " << spec.senders << "\n"
+         << "Test files: " << files.size() << "\n"
+         << "==============================\n" << endl;
+
+    verbose = false;
+    auto execute = [&config](const LoadOp& op) {
+        if (op.is_put) {
+            return send_put_request(config.server_ip, config.server_port, op.file->path);
+        }
+        string output = "client_outputs/output_ol_" + to_string(op.sequence % 64) + "_" +
+                        get_filename(op.file->path);
+        return send_get_request(config.server_ip, config.server_port,
+                                get_filename(op.file->path), output);
+    };
+
+    auto start_time = get_current_time_ns();
+    vector<LoadResult> results = run_open_loop(spec, files, execute);
+    auto wall_ns = get_current_time_ns() - start_time;
+    verbose = true;
+
+    write_load_report(spec, results, wall_ns);
+}
+
+void swarm_mode(const vector<string>& test_files, const SwarmSpec& spec) {
+    vector<LoadFile> files = classify_load_files(test_files);
+
+    cout << "\n=== Running Swarm Mode ===\n"
+         << "Simulated clients: " << spec.clients << "\n"
+         << "Event loops: " << spec.loops << "\n"
+         << "Requests per client: " << spec.requests_per_client << "\n"
+         << "Think time: " << spec.think_ms << " ms\n"
+         << "Test files: " << files.size() << "\n"
+         << "==========================\n" << endl;
+
+    auto start_time = get_current_time_ns();
+    vector<LoadResult> results = run_swarm(spec, files);
+    auto wall_ns = get_current_time_ns() - start_time;
+
+    write_latency_report("Swarm Report (latency from connect to last byte)",
+                         spec.report_prefix, wall_ns / 1e9, results, wall_ns);
+}
+
 void print_usage(const char* prog_name) {
   cout << "Usage: " << prog_name << " [options]\n"
               << "Options:\n"
               << "  --interactive         Run in interactive mode\n"
   << "  --test <dir>          Run test mode with files from directory\n"
               << "  --requests <N>        Number of requests per thread in test mode (default: 10)\n"
+              << "  --stats               Print live server statistics and exit\n"
+              << "  --compress            Send and accept zlib-compressed bodies (any mode)\n"
+              << "  --compress-level <N>  zlib level for uploads, implies --compress (default: 6)\n"
+              << "  --dedup               Offer a content hash before each upload and skip\n"
+              << "                        the body if the server already has it (not swarm)\n"
+              << "  --cache-dir <dir>     Keep downloaded files in dir and revalidate them\n"
+              << "                        with conditional GETs (not swarm)\n"
+              << "  --open-loop <dir>     Open-loop load from files in directory\n"
+              << "    --rate <R>          Target requests per second (default: 100)\n"
+              << "    --duration <S>      Seconds to generate load (default: 10)\n"
+              << "    --arrivals <A>      poisson or fixed (default: poisson)\n"
+              << "    --put-ratio <X>     Fraction of requests that are PUT (default: 0.5)\n"
+              << "    --size-mix <M>      e.g. small=0.5,medium=0.3,large=0.15,xlarge=0.05\n"
+              << "    --senders <N>       Concurrent request senders (default: 64)\n"
+              << "    --report <prefix>   Report file prefix (default: openloop)\n"
+              << "  --swarm <dir>         Closed-loop clients multiplexed over epoll threads\n"
+              << "    --clients <N>       Simulated clients (default: 1000)\n"
+              << "    --loops <N>         Event-loop threads (default: 4)\n"
+              << "    --think-ms <N>      Pause between a client's requests (default: 10)\n"
+              << "    --ramp-ms <N>       Spread client start times over N ms (default: 1000)\n"
+              << "    (also takes --requests, --put-ratio, --seed and --report; default report: swarm)\n"
               << "  --help                Show this help message\n";
 }
 
 int main(int argc, char* argv[]) {
+    signal(SIGPIPE, SIG_IGN);
   Config config;
     try {
         config = parse_config("config.json");
@@ -258,13 +624,65 @@ int main(int argc, char* argv[]) {
   << "============================\n" << endl;
     
     bool interactive = false;
+    bool stats = false;
   string test_dir;
+    string open_loop_dir;
+    string swarm_dir;
+    LoadSpec spec;
+    SwarmSpec swarm;
+    bool report_given = false;
     int num_requests = 10;
     
     for (int i = 1; i < argc; ++i) {
   string arg = argv[i];
         if (arg == "--interactive") {
             interactive = true;
+        } else if (arg == "--stats") {
+            stats = true;
+        } else if (arg == "--dedup") {
+            dedup = true;
+        } else if (arg == "--cache-dir" && i + 1 < argc) {
+            cache.reset(new ClientCache(argv[++i]));
+        } else if (arg == "--compress") {
+            compress_level = DEFAULT_COMPRESSION_LEVEL;
+        } else if (arg == "--compress-level" && i + 1 < argc) {
+            compress_level = atoi(argv[++i]);
+        } else if (arg == "--open-loop" && i + 1 < argc) {
+            open_loop_dir = argv[++i];
+        } else if (arg == "--rate" && i + 1 < argc) {
+            spec.rate = atof(argv[++i]);
+        } else if (arg == "--duration" && i + 1 < argc) {
+            spec.duration_s = atof(argv[++i]);
+        } else if (arg == "--put-ratio" && i + 1 < argc) {
+            spec.put_ratio = atof(argv[++i]);
+        } else if (arg == "--senders" && i + 1 < argc) {
+            spec.senders = atoi(argv[++i]);
+        } else if (arg == "--seed" && i + 1 < argc) {
+            spec.seed = static_cast<unsigned>(atoi(argv[++i]));
+        } else if (arg == "--report" && i + 1 < argc) {
+            spec.report_prefix = argv[++i];
+            report_given = true;
+        } else if (arg == "--swarm" && i + 1 < argc) {
+            swarm_dir = argv[++i];
+        } else if (arg == "--clients" && i + 1 < argc) {
+            swarm.clients = atoi(argv[++i]);
+        } else if (arg == "--loops" && i + 1 < argc) {
+            swarm.loops = atoi(argv[++i]);
+        } else if (arg == "--think-ms" && i + 1 < argc) {
+            swarm.think_ms = atoi(argv[++i]);
+        } else if (arg == "--ramp-ms" && i + 1 < argc) {
+            swarm.ramp_ms = atoi(argv[++i]);
+        } else if ((arg == "--arrivals" || arg == "--size-mix") && i + 1 < argc) {
+            try {
+                if (arg == "--arrivals") {
+                    spec.arrivals = parse_arrival_process(argv[++i]);
+                } else {
+                    parse_size_mix(argv[++i], spec.size_weights);
+                }
+            } catch (const exception& e) {
+                cerr << "Error: " << e.what() << endl;
+                return 1;
+            }
         } else if (arg == "--test" && i + 1 < argc) {
   test_dir = argv[++i];
         } else if (arg == "--requests" && i + 1 < argc) {
@@ -275,8 +693,51 @@ int main(int argc, char* argv[]) {
         }
   }
     
-    if (interactive) {
+    if (compress_level < 0 || compress_level > 9) {
+        cerr << "Error: --compress-level must be between 0 (off) and 9" << endl;
+        return 1;
+    }
+    if (cache && !cache->open()) {
+        cerr << "Error: Cannot use cache directory" << endl;
+        return 1;
+    }
+
+    if (stats) {
+        return send_stats_request(config.server_ip, config.server_port) ? 0 : 1;
+    } else if (interactive) {
         interactive_mode(config);
+    } else if (!open_loop_dir.empty()) {
+        vector<string> test_files;
+        if (!list_files(open_loop_dir, test_files) || test_files.empty()) {
+            cerr << "Error: Cannot list files in " << open_loop_dir << endl;
+            return 1;
+        }
+        if (spec.rate <= 0 || spec.duration_s <= 0 || spec.put_ratio < 0 || spec.put_ratio > 1) {
+            cerr << "Error: --rate and --duration must be positive and --put-ratio in [0, 1]" << endl;
+            return 1;
+        }
+        open_loop_mode(config, test_files, spec);
+    } else if (!swarm_dir.empty()) {
+        vector<string> test_files;
+        if (!list_files(swarm_dir, test_files) || test_files.empty()) {
+            cerr << "Error: Cannot list files in " << swarm_dir << endl;
+            return 1;
+        }
+        if (swarm.clients < 1 || swarm.loops < 1 || num_requests < 1 || swarm.think_ms < 0 ||
+            spec.put_ratio < 0 || spec.put_ratio > 1) {
+            cerr << "Error: --clients, --loops and --requests must be positive and --put-ratio in [0, 1]" << endl;
+            return 1;
+        }
+        swarm.server_ip = config.server_ip;
+        swarm.server_port = config.server_port;
+        swarm.requests_per_client = num_requests;
+        swarm.put_ratio = spec.put_ratio;
+        swarm.seed = spec.seed;
+        swarm.compress_level = compress_level;
+        if (report_given) {
+            swarm.report_prefix = spec.report_prefix;
+        }
+        swarm_mode(test_files, swarm);
   } else if (!test_dir.empty()) {
         vector<string> test_files;
         if (!list_files(test_dir, test_files) || test_files.empty()) {
@@ -290,5 +751,9 @@ int main(int argc, char* argv[]) {
   return 1;
     }
     
+    if (cache) {
+        cout << "[Client] Cache: " << cache->hit_count() << " GETs not modified ("
+             << cache->bytes_restored() << " bytes served locally)" << endl;
+    }
     return 0;
 }
\ No newline at end of file
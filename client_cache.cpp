@@ -0,0 +1,141 @@
+#include "client_cache.h"
+#include <cerrno>
+#include <cstdio>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+static bool make_dir(const string& path) {
+    return mkdir(path.c_str(), 0755) == 0 || errno == EEXIST;
+}
+
+// Copies src to dst in the kernel. Returns the bytes copied, or -1.
+static long long copy_file(const string& src, const string& dst) {
+    int in = open(src.c_str(), O_RDONLY | O_CLOEXEC);
+    if (in < 0) {
+        return -1;
+    }
+    int out = open(dst.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (out < 0) {
+        close(in);
+        return -1;
+    }
+    long long total = 0;
+    while (true) {
+        ssize_t copied = copy_file_range(in, nullptr, out, nullptr, 1 << 30, 0);
+        if (copied < 0 && errno == EINTR) {
+            continue;
+        }
+        if (copied <= 0) {
+            if (copied < 0) {
+                total = -1;
+            }
+            break;
+        }
+        total += copied;
+    }
+    close(in);
+    if (close(out) != 0) {
+        total = -1;
+    }
+    return total;
+}
+
+ClientCache::ClientCache(const string& dir)
+    : dir(dir), temp_counter(0), hits(0), restored_bytes(0) {}
+
+bool ClientCache::open() {
+    return make_dir(dir) && make_dir(dir + "/bodies") && make_dir(dir + "/versions");
+}
+
+string ClientCache::body_path(const string& filename) const {
+    return dir + "/bodies/" + filename;
+}
+
+string ClientCache::version_path(const string& filename) const {
+    return dir + "/versions/" + filename;
+}
+
+string ClientCache::temp_path() {
+    return dir + "/tmp." + to_string(getpid()) + "." + to_string(temp_counter++);
+}
+
+bool ClientCache::read_version(const string& filename, FileVersion& version) {
+    if (filename.empty() || filename.find('/') != string::npos) {
+        return false;
+    }
+    FILE* f = fopen(version_path(filename).c_str(), "r");
+    if (!f) {
+        return false;
+    }
+    char tag[64] = {0};
+    bool ok = fgets(tag, sizeof(tag), f) != nullptr;
+    fclose(f);
+    string line = ok ? tag : "";
+    while (!line.empty() && (line.back() == '\n' || line.back() == '\r')) {
+        line.pop_back();
+    }
+    return ok && parse_version(line, version);
+}
+
+bool ClientCache::write_version(const string& filename, const FileVersion& version) {
+    string tmp = temp_path();
+    FILE* f = fopen(tmp.c_str(), "w");
+    if (!f) {
+        return false;
+    }
+    bool ok = fprintf(f, "%s\n", format_version(version).c_str()) > 0;
+    ok = fclose(f) == 0 && ok;
+    if (!ok || rename(tmp.c_str(), version_path(filename).c_str()) != 0) {
+        unlink(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool ClientCache::version(const string& filename, FileVersion& version) {
+    lock_guard<mutex> lock(cache_mutex);
+    return read_version(filename, version);
+}
+
+bool ClientCache::restore(const string& filename, const FileVersion& version,
+                          const string& output_path) {
+    lock_guard<mutex> lock(cache_mutex);
+    FileVersion held;
+    if (!read_version(filename, held) || held.hash != version.hash) {
+        return false;
+    }
+    long long copied = copy_file(body_path(filename), output_path);
+    if (copied < 0) {
+        return false;
+    }
+    if (held.number != version.number) {
+        write_version(filename, version);
+    }
+    hits.fetch_add(1, memory_order_relaxed);
+    restored_bytes.fetch_add(copied, memory_order_relaxed);
+    return true;
+}
+
+bool ClientCache::store(const string& filename, const FileVersion& version,
+                        const string& source_path) {
+    if (filename.empty() || filename.find('/') != string::npos) {
+        return false;
+    }
+    lock_guard<mutex> lock(cache_mutex);
+    string tmp = temp_path();
+    if (copy_file(source_path, tmp) < 0) {
+        unlink(tmp.c_str());
+        return false;
+    }
+    // Drop the old tag first: until the new one is written the body is
+    // simply not cached.
+    unlink(version_path(filename).c_str());
+    if (rename(tmp.c_str(), body_path(filename).c_str()) != 0) {
+        unlink(tmp.c_str());
+        return false;
+    }
+    return write_version(filename, version);
+}
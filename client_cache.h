@@ -0,0 +1,50 @@
+#ifndef CLIENT_CACHE_H
+#define CLIENT_CACHE_H
+
+#include "protocol.h"
+#include <atomic>
+#include <mutex>
+#include <string>
+
+using namespace std;
+
+// On-disk copies of downloaded files for conditional GETs, keyed by filename
+// and version: <dir>/bodies/<name> holds the bytes and <dir>/versions/<name>
+// the version tag they belong to. A body is only trusted while its tag file
+// exists, so an interrupted update never passes one version off as another.
+// Operations are serialized; test-mode threads share one cache.
+class ClientCache {
+public:
+    explicit ClientCache(const string& dir);
+
+    // Creates the cache directories. Returns false if they cannot be used.
+    bool open();
+
+    // The version held for filename, if any.
+    bool version(const string& filename, FileVersion& version);
+
+    // Copies the cached body of filename to output_path if it is still the
+    // given version, recording the server's current version number.
+    bool restore(const string& filename, const FileVersion& version, const string& output_path);
+
+    // Caches the file at source_path as the given version of filename.
+    bool store(const string& filename, const FileVersion& version, const string& source_path);
+
+    uint64_t hit_count() const { return hits.load(memory_order_relaxed); }
+    uint64_t bytes_restored() const { return restored_bytes.load(memory_order_relaxed); }
+
+private:
+    string body_path(const string& filename) const;
+    string version_path(const string& filename) const;
+    string temp_path();
+    bool read_version(const string& filename, FileVersion& version);
+    bool write_version(const string& filename, const FileVersion& version);
+
+    string dir;
+    mutex cache_mutex;
+    uint64_t temp_counter;
+    atomic<uint64_t> hits;
+    atomic<uint64_t> restored_bytes;
+};
+
+#endif
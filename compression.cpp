@@ -0,0 +1,153 @@
+#include "compression.h"
+#include <algorithm>
+#include <cerrno>
+#include <vector>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <zlib.h>
+
+using namespace std;
+
+static const size_t CHUNK = 256 * 1024;
+
+static bool write_all(int fd, const char* data, size_t len) {
+    size_t written = 0;
+    while (written < len) {
+        ssize_t w = write(fd, data + written, len - written);
+        if (w < 0 && errno == EINTR) {
+            continue;
+        }
+        if (w <= 0) {
+            return false;
+        }
+        written += w;
+    }
+    return true;
+}
+
+bool compress_data(string_view in, string& out, int level) {
+    uLongf bound = compressBound(in.size());
+    out.resize(bound);
+    int rc = compress2(reinterpret_cast<Bytef*>(&out[0]), &bound,
+                       reinterpret_cast<const Bytef*>(in.data()), in.size(), level);
+    if (rc != Z_OK) {
+        out.clear();
+        return false;
+    }
+    out.resize(bound);
+    return true;
+}
+
+bool decompress_data(const string& in, size_t decoded_size, string& out) {
+    out.resize(decoded_size);
+    uLongf out_len = decoded_size;
+    int rc = uncompress(reinterpret_cast<Bytef*>(&out[0]), &out_len,
+                        reinterpret_cast<const Bytef*>(in.data()), in.size());
+    if (rc != Z_OK || out_len != decoded_size) {
+        out.clear();
+        return false;
+    }
+    return true;
+}
+
+bool compress_fd(int fd, string& out, size_t& decoded_size, int level) {
+    z_stream zs = {};
+    if (deflateInit(&zs, level) != Z_OK) {
+        return false;
+    }
+
+    vector<char> in_buf(CHUNK);
+    vector<char> out_buf(CHUNK);
+    out.clear();
+    decoded_size = 0;
+    char last = '\n';
+    bool ok = true;
+
+    while (ok) {
+        ssize_t got = read(fd, in_buf.data(), in_buf.size());
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got < 0) {
+            ok = false;
+            break;
+        }
+        int flush = Z_NO_FLUSH;
+        if (got == 0) {
+            flush = Z_FINISH;
+            if (last != '\n') {
+                in_buf[0] = '\n';
+                got = 1;
+            }
+        } else {
+            last = in_buf[got - 1];
+        }
+        decoded_size += got;
+
+        zs.next_in = reinterpret_cast<Bytef*>(in_buf.data());
+        zs.avail_in = static_cast<uInt>(got);
+        do {
+            zs.next_out = reinterpret_cast<Bytef*>(out_buf.data());
+            zs.avail_out = static_cast<uInt>(out_buf.size());
+            if (deflate(&zs, flush) == Z_STREAM_ERROR) {
+                ok = false;
+                break;
+            }
+            out.append(out_buf.data(), out_buf.size() - zs.avail_out);
+        } while (zs.avail_out == 0);
+
+        if (flush == Z_FINISH) {
+            break;
+        }
+    }
+
+    deflateEnd(&zs);
+    return ok;
+}
+
+bool recv_compressed_fd(int sockfd, size_t size, size_t decoded_size, int fd) {
+    z_stream zs = {};
+    if (inflateInit(&zs) != Z_OK) {
+        return false;
+    }
+
+    vector<char> in_buf(CHUNK);
+    vector<char> out_buf(CHUNK);
+    size_t received = 0;
+    size_t produced = 0;
+    int rc = Z_OK;
+    bool ok = true;
+
+    while (ok && received < size) {
+        ssize_t got = recv(sockfd, in_buf.data(), min(in_buf.size(), size - received), 0);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            ok = false;
+            break;
+        }
+        received += got;
+
+        zs.next_in = reinterpret_cast<Bytef*>(in_buf.data());
+        zs.avail_in = static_cast<uInt>(got);
+        do {
+            zs.next_out = reinterpret_cast<Bytef*>(out_buf.data());
+            zs.avail_out = static_cast<uInt>(out_buf.size());
+            rc = inflate(&zs, Z_NO_FLUSH);
+            if (rc != Z_OK && rc != Z_STREAM_END) {
+                ok = false;
+                break;
+            }
+            size_t have = out_buf.size() - zs.avail_out;
+            produced += have;
+            if (produced > decoded_size || !write_all(fd, out_buf.data(), have)) {
+                ok = false;
+                break;
+            }
+        } while (zs.avail_out == 0 && rc != Z_STREAM_END);
+    }
+
+    inflateEnd(&zs);
+    return ok && rc == Z_STREAM_END && produced == decoded_size;
+}
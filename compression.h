@@ -0,0 +1,35 @@
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
+#include <string>
+#include <string_view>
+
+using namespace std;
+
+// Encoding names as they appear on the wire. A client lists the encodings it
+// accepts after the filename of a GET; a compressed body in either direction
+// is preceded by "ENCODING <name> <decoded size>" ahead of the SIZE line.
+const string ENCODING_ZLIB = "zlib";
+const string PROTOCOL_ENCODING = "ENCODING";
+
+const int DEFAULT_COMPRESSION_LEVEL = 6;
+
+// Bodies smaller than this are always sent as-is; the zlib header and the
+// extra framing line would eat most of the saving.
+const size_t MIN_COMPRESS_SIZE = 1024;
+
+bool compress_data(string_view in, string& out, int level);
+
+// Inflates exactly decoded_size bytes; fails on corrupt input or any size
+// mismatch, so a peer cannot make us allocate more than it declared.
+bool decompress_data(const string& in, size_t decoded_size, string& out);
+
+// Deflates an open file in chunks without holding the plain text in memory.
+// A final line without a newline is terminated, as send_file_fd() would.
+bool compress_fd(int fd, string& out, size_t& decoded_size, int level);
+
+// Receives size compressed body bytes, inflating them into fd as they
+// arrive. Like recv_file_fd(), the trailing END line is left unread.
+bool recv_compressed_fd(int sockfd, size_t size, size_t decoded_size, int fd);
+
+#endif
@@ -29,6 +29,30 @@ static int extract_int_value(const string& line) {
   }
 }
 
+// Reads a one-line list such as "worker_cpus": [0, 1, 2, 3].
+static vector<int> extract_int_list(const string& line) {
+    size_t open = line.find('[');
+    size_t close = line.find(']');
+    if (open == string::npos || close == string::npos || close < open) {
+        throw runtime_error("Expected a list of integers in config: " + line);
+    }
+    vector<int> values;
+    stringstream items(line.substr(open + 1, close - open - 1));
+    string item;
+    while (getline(items, item, ',')) {
+        item = trim(item);
+        if (item.empty()) {
+            continue;
+        }
+        try {
+            values.push_back(stoi(item));
+        } catch (...) {
+            throw runtime_error("Invalid integer value in config: " + line);
+        }
+    }
+    return values;
+}
+
 Config parse_config(const string& filename) {
     ifstream file(filename);
   if (!file.is_open()) {
@@ -54,6 +78,24 @@ Config parse_config(const string& filename) {
   } else if (line.find("client_threads") != string::npos) {
             config.client_threads = extract_int_value(line);
             found_client_threads = true;
+        } else if (line.find("metrics_port") != string::npos) {
+            config.metrics_port = extract_int_value(line);
+        } else if (line.find("acceptor_threads") != string::npos) {
+            config.acceptor_threads = extract_int_value(line);
+        } else if (line.find("acceptor_cpus") != string::npos) {
+            config.acceptor_cpus = extract_int_list(line);
+        } else if (line.find("worker_cpus") != string::npos) {
+            config.worker_cpus = extract_int_list(line);
+        } else if (line.find("shards") != string::npos) {
+            config.shards = extract_int_value(line);
+        } else if (line.find("pool_min_threads") != string::npos) {
+            config.pool_min_threads = extract_int_value(line);
+        } else if (line.find("pool_max_threads") != string::npos) {
+            config.pool_max_threads = extract_int_value(line);
+        } else if (line.find("pool_target_wait_ms") != string::npos) {
+            config.pool_target_wait_ms = extract_int_value(line);
+        } else if (line.find("pool_idle_ms") != string::npos) {
+            config.pool_idle_ms = extract_int_value(line);
         }
   }
     
@@ -75,6 +117,37 @@ Config parse_config(const string& filename) {
   if (config.client_threads < 1 || config.client_threads > 1000) {
         throw runtime_error("client_threads must be between 1 and 1000");
     }
+    if (config.metrics_port != 0 &&
+        (config.metrics_port < 1024 || config.metrics_port > 65535 ||
+         config.metrics_port == config.server_port)) {
+        throw runtime_error("metrics_port must be 0 (disabled) or a port between 1024 and 65535 other than server_port");
+    }
+    if (config.acceptor_threads < 1 || config.acceptor_threads > 64) {
+        throw runtime_error("acceptor_threads must be between 1 and 64");
+    }
+    if (config.shards < 1 || config.shards > 64 || config.shards > config.server_threads) {
+        throw runtime_error("shards must be between 1 and 64 and no more than server_threads");
+    }
+    if (config.pool_max_threads != 0) {
+        if (config.pool_min_threads == 0) {
+            config.pool_min_threads = config.shards;
+        }
+        if (config.pool_min_threads < config.shards || config.pool_min_threads > config.server_threads ||
+            config.pool_max_threads < config.server_threads || config.pool_max_threads > 100) {
+            throw runtime_error("pool_min_threads and pool_max_threads must satisfy "
+                                "shards <= pool_min_threads <= server_threads <= pool_max_threads <= 100");
+        }
+        if (config.pool_target_wait_ms < 1 || config.pool_idle_ms < 1) {
+            throw runtime_error("pool_target_wait_ms and pool_idle_ms must be positive");
+        }
+    }
+    for (const vector<int>* cpus : {&config.acceptor_cpus, &config.worker_cpus}) {
+        for (int cpu : *cpus) {
+            if (cpu < 0) {
+                throw runtime_error("acceptor_cpus and worker_cpus must list CPU numbers (0 or more)");
+            }
+        }
+    }
     
   return config;
 }
\ No newline at end of file
@@ -3,6 +3,7 @@
 
 #include <string>
 #include <stdexcept>
+#include <vector>
 
 using namespace std;
 
@@ -11,9 +12,33 @@ struct Config {
 int server_port;
   int server_threads;
     int client_threads;
+    int metrics_port;
+
+    // Listening sockets share the port through SO_REUSEPORT, one acceptor
+    // thread each. Acceptor i and worker i run on cpus[i % size] when a CPU
+    // list is given.
+    int acceptor_threads;
+    vector<int> acceptor_cpus;
+    vector<int> worker_cpus;
+
+    // Above 1, files are partitioned by name hash over this many shards,
+    // each with its own listener, acceptor, scheduler and share of the
+    // workers. acceptor_threads is then ignored: every shard has one.
+    int shards;
+
+    // With pool_max_threads above 0 the workers are elastic: server_threads
+    // is the starting size, and the pool grows up to pool_max_threads while
+    // the queue wait exceeds pool_target_wait_ms and shrinks down to
+    // pool_min_threads (default: one per shard) after pool_idle_ms spare.
+    int pool_min_threads;
+    int pool_max_threads;
+    int pool_target_wait_ms;
+    int pool_idle_ms;
     
   Config() : server_ip("127.0.0.1"), server_port(9000), 
-         server_threads(4), client_threads(8) {}
+         server_threads(4), client_threads(8), metrics_port(0), acceptor_threads(1),
+         shards(1), pool_min_threads(0), pool_max_threads(0), pool_target_wait_ms(10),
+         pool_idle_ms(1000) {}
 };
 
 Config parse_config(const string& filename);
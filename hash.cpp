@@ -0,0 +1,164 @@
+#include "hash.h"
+#include <cerrno>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <unistd.h>
+
+using namespace std;
+
+static const uint64_t PRIME1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t PRIME3 = 0x165667B19E3779F9ULL;
+static const uint64_t PRIME4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t PRIME5 = 0x27D4EB2F165667C5ULL;
+
+static inline uint64_t rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t read64(const unsigned char* p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t read32(const unsigned char* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t xxh_round(uint64_t acc, uint64_t input) {
+    acc += input * PRIME2;
+    acc = rotl(acc, 31);
+    return acc * PRIME1;
+}
+
+static inline uint64_t merge_round(uint64_t acc, uint64_t val) {
+    acc ^= xxh_round(0, val);
+    return acc * PRIME1 + PRIME4;
+}
+
+ContentHasher::ContentHasher() : buffered(0), total_len(0) {
+    acc[0] = PRIME1 + PRIME2;
+    acc[1] = PRIME2;
+    acc[2] = 0;
+    acc[3] = 0 - PRIME1;
+}
+
+void ContentHasher::update(const char* data, size_t len) {
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(data);
+    const unsigned char* end = p + len;
+    total_len += len;
+
+    if (buffered + len < 32) {
+        memcpy(buffer + buffered, p, len);
+        buffered += len;
+        return;
+    }
+    if (buffered > 0) {
+        size_t fill = 32 - buffered;
+        memcpy(buffer + buffered, p, fill);
+        for (int i = 0; i < 4; ++i) {
+            acc[i] = xxh_round(acc[i], read64(buffer + 8 * i));
+        }
+        p += fill;
+        buffered = 0;
+    }
+    while (p + 32 <= end) {
+        for (int i = 0; i < 4; ++i) {
+            acc[i] = xxh_round(acc[i], read64(p + 8 * i));
+        }
+        p += 32;
+    }
+    buffered = end - p;
+    memcpy(buffer, p, buffered);
+}
+
+uint64_t ContentHasher::digest() const {
+    uint64_t h;
+    if (total_len >= 32) {
+        h = rotl(acc[0], 1) + rotl(acc[1], 7) + rotl(acc[2], 12) + rotl(acc[3], 18);
+        for (int i = 0; i < 4; ++i) {
+            h = merge_round(h, acc[i]);
+        }
+    } else {
+        h = acc[2] + PRIME5;
+    }
+    h += total_len;
+
+    const unsigned char* p = buffer;
+    const unsigned char* end = buffer + buffered;
+    while (p + 8 <= end) {
+        h ^= xxh_round(0, read64(p));
+        h = rotl(h, 27) * PRIME1 + PRIME4;
+        p += 8;
+    }
+    if (p + 4 <= end) {
+        h ^= static_cast<uint64_t>(read32(p)) * PRIME1;
+        h = rotl(h, 23) * PRIME2 + PRIME3;
+        p += 4;
+    }
+    while (p < end) {
+        h ^= (*p) * PRIME5;
+        h = rotl(h, 11) * PRIME1;
+        ++p;
+    }
+
+    h ^= h >> 33;
+    h *= PRIME2;
+    h ^= h >> 29;
+    h *= PRIME3;
+    h ^= h >> 32;
+    return h;
+}
+
+uint64_t content_hash(const char* data, size_t len) {
+    ContentHasher hasher;
+    hasher.update(data, len);
+    return hasher.digest();
+}
+
+bool content_hash_fd(int fd, uint64_t& hash, size_t& size) {
+    ContentHasher hasher;
+    vector<char> buf(1 << 20);
+    char last = '\n';
+    size = 0;
+    while (true) {
+        ssize_t got = read(fd, buf.data(), buf.size());
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got < 0) {
+            return false;
+        }
+        if (got == 0) {
+            break;
+        }
+        hasher.update(buf.data(), got);
+        last = buf[got - 1];
+        size += got;
+    }
+    if (last != '\n') {
+        hasher.update("\n", 1);
+        ++size;
+    }
+    hash = hasher.digest();
+    return true;
+}
+
+string hash_to_hex(uint64_t hash) {
+    char hex[17];
+    snprintf(hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(hash));
+    return hex;
+}
+
+bool parse_hash_hex(string_view hex, uint64_t& hash) {
+    if (hex.size() != 16) {
+        return false;
+    }
+    auto result = from_chars(hex.data(), hex.data() + hex.size(), hash, 16);
+    return result.ec == errc() && result.ptr == hex.data() + hex.size();
+}
@@ -0,0 +1,43 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+using namespace std;
+
+// XXH64 (seed 0): fast, non-cryptographic content hash used to recognise
+// bodies the server already holds. Identical bytes always hash the same;
+// the store compares bytes before a received body shares a buffer, but a
+// HASH link trusts the hash and size alone.
+class ContentHasher {
+public:
+    ContentHasher();
+
+    void update(const char* data, size_t len);
+
+    uint64_t digest() const;
+
+private:
+    uint64_t acc[4];
+    unsigned char buffer[32];
+    size_t buffered;
+    uint64_t total_len;
+};
+
+uint64_t content_hash(const char* data, size_t len);
+
+inline uint64_t content_hash(string_view data) {
+    return content_hash(data.data(), data.size());
+}
+
+// Hashes an open file as it would be stored: a final line without a newline
+// is hashed as if it had one. Returns false on a read error.
+bool content_hash_fd(int fd, uint64_t& hash, size_t& size);
+
+string hash_to_hex(uint64_t hash);
+
+bool parse_hash_hex(string_view hex, uint64_t& hash);
+
+#endif
@@ -0,0 +1,99 @@
+#include "io_waiter.h"
+#include <cerrno>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+using namespace std;
+
+IoWaiter::IoWaiter(function<void(shared_ptr<Request>)> ready)
+    : ready(move(ready)), epoll_fd(-1), stop_fd(-1) {}
+
+IoWaiter::~IoWaiter() {
+    stop();
+}
+
+bool IoWaiter::start() {
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    stop_fd = eventfd(0, EFD_CLOEXEC);
+    if (epoll_fd < 0 || stop_fd < 0) {
+        return false;
+    }
+    struct epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.fd = stop_fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, stop_fd, &event) < 0) {
+        return false;
+    }
+    loop = thread(&IoWaiter::run, this);
+    return true;
+}
+
+void IoWaiter::stop() {
+    if (loop.joinable()) {
+        uint64_t one = 1;
+        ssize_t ignored = write(stop_fd, &one, sizeof(one));
+        (void)ignored;
+        loop.join();
+    }
+    if (epoll_fd >= 0) {
+        close(epoll_fd);
+        epoll_fd = -1;
+    }
+    if (stop_fd >= 0) {
+        close(stop_fd);
+        stop_fd = -1;
+    }
+}
+
+void IoWaiter::park(shared_ptr<Request> request, bool writable) {
+    int fd = request->client_id;
+    struct epoll_event event = {};
+    // EPOLLHUP and EPOLLERR, always reported, hand back a request whose
+    // client reset the connection, to be cancelled. EPOLLRDHUP is not asked
+    // for: a half-closed client still reads its reply, see peer_closed().
+    event.events = (writable ? EPOLLOUT : EPOLLIN) | EPOLLONESHOT;
+    event.data.fd = fd;
+
+    {
+        lock_guard<mutex> lock(waiting_mutex);
+        waiting[fd] = request;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == 0) {
+            return;
+        }
+        waiting.erase(fd);
+    }
+    // Let the coroutine run into the socket error itself.
+    ready(move(request));
+}
+
+void IoWaiter::run() {
+    struct epoll_event events[64];
+    while (true) {
+        int n = epoll_wait(epoll_fd, events, 64, -1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        for (int i = 0; i < n; ++i) {
+            int fd = events[i].data.fd;
+            if (fd == stop_fd) {
+                return;
+            }
+            shared_ptr<Request> request;
+            {
+                lock_guard<mutex> lock(waiting_mutex);
+                auto it = waiting.find(fd);
+                if (it == waiting.end()) {
+                    continue;
+                }
+                request = move(it->second);
+                waiting.erase(it);
+                epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+            }
+            ready(move(request));
+        }
+    }
+}
@@ -0,0 +1,39 @@
+#ifndef IO_WAITER_H
+#define IO_WAITER_H
+
+#include "protocol.h"
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+using namespace std;
+
+// Holds requests whose coroutine is waiting on its client socket, so they
+// occupy no worker, and hands each one to ready() once the socket can make
+// progress (or has failed).
+class IoWaiter {
+public:
+    explicit IoWaiter(function<void(shared_ptr<Request>)> ready);
+    ~IoWaiter();
+
+    bool start();
+
+    void stop();
+
+    // Waits for client_id to become writable, or readable if writable is false.
+    void park(shared_ptr<Request> request, bool writable);
+
+private:
+    void run();
+
+    function<void(shared_ptr<Request>)> ready;
+    int epoll_fd;
+    int stop_fd;
+    mutex waiting_mutex;
+    map<int, shared_ptr<Request>> waiting;
+    thread loop;
+};
+
+#endif
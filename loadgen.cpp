@@ -0,0 +1,267 @@
+#include "loadgen.h"
+#include "utils.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <thread>
+
+using namespace std;
+
+ArrivalProcess parse_arrival_process(const string& arrivals_str) {
+    if (arrivals_str == "poisson") return ArrivalProcess::POISSON;
+    if (arrivals_str == "fixed") return ArrivalProcess::FIXED;
+    throw runtime_error("Invalid arrival process: " + arrivals_str + " (must be poisson or fixed)");
+}
+
+void parse_size_mix(const string& mix, double weights[NUM_SIZE_CLASSES]) {
+    for (int c = 0; c < NUM_SIZE_CLASSES; ++c) {
+        weights[c] = 0;
+    }
+    istringstream iss(mix);
+    string item;
+    while (getline(iss, item, ',')) {
+        size_t eq = item.find('=');
+        if (eq == string::npos) {
+            throw runtime_error("Invalid size mix entry: " + item);
+        }
+        string name = item.substr(0, eq);
+        double weight = stod(item.substr(eq + 1));
+        bool found = false;
+        for (int c = 0; c < NUM_SIZE_CLASSES; ++c) {
+            if (name == size_class_name(static_cast<SizeClass>(c))) {
+                weights[c] = weight;
+                found = true;
+            }
+        }
+        if (!found || weight < 0) {
+            throw runtime_error("Invalid size mix entry: " + item);
+        }
+    }
+}
+
+vector<LoadFile> classify_load_files(const vector<string>& paths) {
+    vector<LoadFile> files;
+    for (const auto& path : paths) {
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0) {
+            continue;
+        }
+        size_t size = static_cast<size_t>(st.st_size);
+        files.push_back({path, size, size_class_of(size)});
+    }
+    return files;
+}
+
+static vector<LoadOp> build_schedule(const LoadSpec& spec, const vector<LoadFile>& files,
+                                     long long start_ns) {
+    mt19937_64 gen(spec.seed);
+    exponential_distribution<double> gap_dist(spec.rate);
+    bernoulli_distribution put_dist(spec.put_ratio);
+
+    vector<vector<const LoadFile*>> by_class(NUM_SIZE_CLASSES);
+    for (const auto& f : files) {
+        by_class[static_cast<int>(f.size_class)].push_back(&f);
+    }
+    vector<double> weights(NUM_SIZE_CLASSES, 0.0);
+    bool any_weight = false;
+    for (int c = 0; c < NUM_SIZE_CLASSES; ++c) {
+        if (!by_class[c].empty() && spec.size_weights[c] > 0) {
+            weights[c] = spec.size_weights[c];
+            any_weight = true;
+        }
+    }
+    discrete_distribution<int> class_dist(weights.begin(), weights.end());
+    uniform_int_distribution<size_t> any_file(0, files.size() - 1);
+
+    vector<LoadOp> ops;
+    ops.reserve(static_cast<size_t>(spec.rate * spec.duration_s * 1.1) + 16);
+    double t = 0.0;
+    while (true) {
+        t += spec.arrivals == ArrivalProcess::POISSON ? gap_dist(gen) : 1.0 / spec.rate;
+        if (t >= spec.duration_s) {
+            break;
+        }
+        const LoadFile* file;
+        if (any_weight) {
+            const auto& candidates = by_class[class_dist(gen)];
+            file = candidates[uniform_int_distribution<size_t>(0, candidates.size() - 1)(gen)];
+        } else {
+            file = &files[any_file(gen)];
+        }
+        ops.push_back({ops.size(), put_dist(gen), file,
+                       start_ns + static_cast<long long>(t * 1e9)});
+    }
+    return ops;
+}
+
+vector<LoadResult> run_open_loop(const LoadSpec& spec, const vector<LoadFile>& files,
+                                 const LoadExecutor& execute) {
+    if (files.empty() || spec.rate <= 0 || spec.duration_s <= 0) {
+        return {};
+    }
+
+    long long start_ns = get_current_time_ns() + 100'000'000LL;
+    vector<LoadOp> ops = build_schedule(spec, files, start_ns);
+    vector<LoadResult> results(ops.size());
+
+    mutex pending_mutex;
+    condition_variable pending_cv;
+    deque<const LoadOp*> pending;
+    bool dispatch_done = false;
+    size_t max_backlog = 0;
+
+    auto sender = [&]() {
+        while (true) {
+            const LoadOp* op;
+            {
+                unique_lock<mutex> lock(pending_mutex);
+                pending_cv.wait(lock, [&] { return !pending.empty() || dispatch_done; });
+                if (pending.empty()) {
+                    return;
+                }
+                op = pending.front();
+                pending.pop_front();
+            }
+            LoadResult& result = results[op->sequence];
+            result.op = *op;
+            result.send_ns = get_current_time_ns();
+            result.success = execute(*op);
+            result.finish_ns = get_current_time_ns();
+        }
+    };
+
+    vector<thread> senders;
+    for (int i = 0; i < max(1, spec.senders); ++i) {
+        senders.emplace_back(sender);
+    }
+
+    for (const auto& op : ops) {
+        long long wait_ns = op.intended_ns - get_current_time_ns();
+        if (wait_ns > 0) {
+            this_thread::sleep_for(chrono::nanoseconds(wait_ns));
+        }
+        lock_guard<mutex> lock(pending_mutex);
+        pending.push_back(&op);
+        max_backlog = max(max_backlog, pending.size());
+        pending_cv.notify_one();
+    }
+    {
+        lock_guard<mutex> lock(pending_mutex);
+        dispatch_done = true;
+        pending_cv.notify_all();
+    }
+    for (auto& t : senders) {
+        t.join();
+    }
+
+    if (max_backlog > 1) {
+        cout << "[LoadGen] Peak client-side backlog: " << max_backlog
+             << " requests waiting for a sender" << endl;
+    }
+    return results;
+}
+
+static double percentile_ms(const vector<long long>& sorted_ns, double p) {
+    if (sorted_ns.empty()) {
+        return 0.0;
+    }
+    size_t rank = static_cast<size_t>(p / 100.0 * sorted_ns.size());
+    if (rank >= sorted_ns.size()) {
+        rank = sorted_ns.size() - 1;
+    }
+    return ns_to_ms(sorted_ns[rank]);
+}
+
+bool write_load_report(const LoadSpec& spec, const vector<LoadResult>& results,
+                       long long wall_ns) {
+    return write_latency_report("Open-Loop Report (latency from intended send time)",
+                                spec.report_prefix, spec.duration_s, results, wall_ns);
+}
+
+bool write_latency_report(const string& title, const string& report_prefix,
+                          double offered_window_s, const vector<LoadResult>& results,
+                          long long wall_ns) {
+    string requests_path = report_prefix + "_requests.csv";
+    string summary_path = report_prefix + "_summary.csv";
+
+    ofstream requests(requests_path);
+    ofstream summary(summary_path);
+    if (!requests.is_open() || !summary.is_open()) {
+        cerr << "Error: Cannot create load report " << report_prefix << "_*.csv" << endl;
+        return false;
+    }
+
+    requests << "request_type,filename,file_size,intended_time_ns,send_time_ns,finish_time_ns,"
+             << "latency_ms,service_time_ms,client_queue_ms,success\n";
+
+    vector<long long> latencies[3];
+    size_t errors[3] = {0, 0, 0};
+    for (const auto& r : results) {
+        int t = r.op.is_put ? 0 : 1;
+        long long latency = r.finish_ns - r.op.intended_ns;
+        requests << (r.op.is_put ? "PUT" : "GET") << ","
+                 << get_filename(r.op.file->path) << ","
+                 << r.op.file->size << ","
+                 << r.op.intended_ns << ","
+                 << r.send_ns << ","
+                 << r.finish_ns << ","
+                 << ns_to_ms(latency) << ","
+                 << ns_to_ms(r.finish_ns - r.send_ns) << ","
+                 << ns_to_ms(r.send_ns - r.op.intended_ns) << ","
+                 << (r.success ? 1 : 0) << "\n";
+        if (!r.success) {
+            errors[t]++;
+            errors[2]++;
+        }
+        latencies[t].push_back(latency);
+        latencies[2].push_back(latency);
+    }
+
+    summary << "request_type,count,errors,offered_rps,achieved_rps,mean_ms,p50_ms,p90_ms,"
+            << "p99_ms,p999_ms,max_ms\n";
+    cout << "\n=== " << title << " ===\n";
+
+    const char* names[3] = {"PUT", "GET", "ALL"};
+    double wall_s = wall_ns / 1e9;
+    for (int t = 0; t < 3; ++t) {
+        auto& lat = latencies[t];
+        sort(lat.begin(), lat.end());
+        double sum = 0;
+        for (long long v : lat) {
+            sum += v;
+        }
+        double mean_ms = lat.empty() ? 0.0 : ns_to_ms(static_cast<long long>(sum / lat.size()));
+        double offered = offered_window_s > 0 ? lat.size() / offered_window_s : 0.0;
+        double achieved = wall_s > 0 ? (lat.size() - errors[t]) / wall_s : 0.0;
+
+        ostringstream row;
+        row << fixed << setprecision(3)
+            << names[t] << "," << lat.size() << "," << errors[t] << ","
+            << offered << "," << achieved << "," << mean_ms << ","
+            << percentile_ms(lat, 50) << "," << percentile_ms(lat, 90) << ","
+            << percentile_ms(lat, 99) << "," << percentile_ms(lat, 99.9) << ","
+            << (lat.empty() ? 0.0 : ns_to_ms(lat.back()));
+        summary << row.str() << "\n";
+
+        cout << fixed << setprecision(3)
+             << names[t] << ": n=" << lat.size() << " errors=" << errors[t]
+             << " achieved=" << achieved << " req/s"
+             << " p50=" << percentile_ms(lat, 50) << "ms"
+             << " p99=" << percentile_ms(lat, 99) << "ms"
+             << " p99.9=" << percentile_ms(lat, 99.9) << "ms"
+             << " max=" << (lat.empty() ? 0.0 : ns_to_ms(lat.back())) << "ms\n";
+    }
+    cout << "Reports: " << requests_path << ", " << summary_path << "\n"
+         << "=========================================================\n" << endl;
+    cout.unsetf(ios::fixed);
+    return true;
+}
@@ -0,0 +1,78 @@
+#ifndef LOADGEN_H
+#define LOADGEN_H
+
+#include "stats.h"
+#include <functional>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+enum class ArrivalProcess {
+    POISSON,
+    FIXED
+};
+
+struct LoadFile {
+    string path;
+    size_t size;
+    SizeClass size_class;
+};
+
+struct LoadSpec {
+    double rate;
+    double duration_s;
+    ArrivalProcess arrivals;
+    double put_ratio;
+    double size_weights[NUM_SIZE_CLASSES];
+    int senders;
+    unsigned seed;
+    string report_prefix;
+
+    LoadSpec() : rate(100.0), duration_s(10.0), arrivals(ArrivalProcess::POISSON),
+                 put_ratio(0.5), size_weights{0, 0, 0, 0}, senders(64), seed(1),
+                 report_prefix("openloop") {}
+};
+
+struct LoadOp {
+    uint64_t sequence;
+    bool is_put;
+    const LoadFile* file;
+    long long intended_ns;
+};
+
+struct LoadResult {
+    LoadOp op;
+    long long send_ns;
+    long long finish_ns;
+    bool success;
+};
+
+// Performs one request and returns whether it succeeded.
+using LoadExecutor = function<bool(const LoadOp&)>;
+
+ArrivalProcess parse_arrival_process(const string& arrivals_str);
+
+// Parses "small=0.5,medium=0.3,large=0.2" into per-size-class weights.
+void parse_size_mix(const string& mix, double weights[NUM_SIZE_CLASSES]);
+
+vector<LoadFile> classify_load_files(const vector<string>& paths);
+
+// Issues requests at their scheduled times regardless of whether earlier
+// ones have completed. Latency is measured from the intended send time, so
+// time spent waiting for a free sender counts against the server (no
+// coordinated omission).
+vector<LoadResult> run_open_loop(const LoadSpec& spec, const vector<LoadFile>& files,
+                                 const LoadExecutor& execute);
+
+// Writes <prefix>_requests.csv and <prefix>_summary.csv and prints a summary.
+bool write_load_report(const LoadSpec& spec, const vector<LoadResult>& results,
+                       long long wall_ns);
+
+// Same report for any load source. Offered rate is counted over
+// offered_window_s; closed-loop runs pass the wall time.
+bool write_latency_report(const string& title, const string& report_prefix,
+                          double offered_window_s, const vector<LoadResult>& results,
+                          long long wall_ns);
+
+#endif
@@ -0,0 +1,236 @@
+#include "logger.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+struct LogRecord {
+    uint64_t sequence;
+    long long timestamp_ns;
+    LogLevel level;
+    string message;
+};
+
+// Each thread appends to its own buffer; the mutex is only ever contended by
+// the writer thread when it swaps the vector out.
+struct ThreadLogBuffer {
+    mutex buffer_mutex;
+    vector<LogRecord> records;
+};
+
+const size_t WAKE_THRESHOLD = 256;
+const auto FLUSH_INTERVAL = chrono::milliseconds(50);
+
+atomic<int> current_level(static_cast<int>(LogLevel::INFO));
+atomic<uint64_t> next_sequence(0);
+atomic<bool> writer_running(false);
+
+mutex registry_mutex;
+vector<shared_ptr<ThreadLogBuffer>> registry;
+
+mutex writer_mutex;
+condition_variable writer_cv;
+bool writer_stop = false;
+bool writer_wakeup = false;
+thread writer;
+
+thread_local shared_ptr<ThreadLogBuffer> local_buffer;
+
+long long wall_clock_ns() {
+    return chrono::duration_cast<chrono::nanoseconds>(
+        chrono::system_clock::now().time_since_epoch()).count();
+}
+
+void format_record(string& out, const LogRecord& record) {
+    time_t seconds = static_cast<time_t>(record.timestamp_ns / 1000000000LL);
+    int millis = static_cast<int>((record.timestamp_ns / 1000000LL) % 1000);
+    struct tm tm_buf;
+    localtime_r(&seconds, &tm_buf);
+
+    char prefix[48];
+    snprintf(prefix, sizeof(prefix), "%02d:%02d:%02d.%03d %-5s ",
+             tm_buf.tm_hour, tm_buf.tm_min, tm_buf.tm_sec, millis,
+             log_level_name(record.level));
+    out += prefix;
+    out += record.message;
+    out += '\n';
+}
+
+void write_records(vector<LogRecord>& records) {
+    if (records.empty()) {
+        return;
+    }
+    sort(records.begin(), records.end(), [](const LogRecord& a, const LogRecord& b) {
+        return a.sequence < b.sequence;
+    });
+
+    string out_batch, err_batch;
+    for (const auto& record : records) {
+        format_record(record.level >= LogLevel::WARN ? err_batch : out_batch, record);
+    }
+    if (!out_batch.empty()) {
+        fwrite(out_batch.data(), 1, out_batch.size(), stdout);
+        fflush(stdout);
+    }
+    if (!err_batch.empty()) {
+        fwrite(err_batch.data(), 1, err_batch.size(), stderr);
+        fflush(stderr);
+    }
+}
+
+void drain_buffers(vector<LogRecord>& batch) {
+    lock_guard<mutex> registry_lock(registry_mutex);
+    for (auto it = registry.begin(); it != registry.end();) {
+        auto& buffer = *it;
+        {
+            lock_guard<mutex> lock(buffer->buffer_mutex);
+            if (batch.empty()) {
+                batch.swap(buffer->records);
+            } else {
+                move(buffer->records.begin(), buffer->records.end(), back_inserter(batch));
+                buffer->records.clear();
+            }
+        }
+        if (buffer.use_count() == 1) {
+            it = registry.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void writer_loop() {
+    vector<LogRecord> batch;
+    unique_lock<mutex> lock(writer_mutex);
+    while (true) {
+        writer_cv.wait_for(lock, FLUSH_INTERVAL, [] { return writer_stop || writer_wakeup; });
+        bool stopping = writer_stop;
+        writer_wakeup = false;
+        lock.unlock();
+
+        drain_buffers(batch);
+        write_records(batch);
+        batch.clear();
+
+        lock.lock();
+        if (stopping) {
+            break;
+        }
+    }
+}
+
+ThreadLogBuffer& thread_buffer() {
+    if (!local_buffer) {
+        local_buffer = make_shared<ThreadLogBuffer>();
+        lock_guard<mutex> lock(registry_mutex);
+        registry.push_back(local_buffer);
+    }
+    return *local_buffer;
+}
+
+}
+
+LogLevel parse_log_level(const string& level_str) {
+    string lower = level_str;
+    transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+
+    if (lower == "debug") return LogLevel::DEBUG;
+    if (lower == "info") return LogLevel::INFO;
+    if (lower == "warn") return LogLevel::WARN;
+    if (lower == "error") return LogLevel::ERROR;
+    if (lower == "off") return LogLevel::OFF;
+
+    throw runtime_error("Invalid log level: " + level_str +
+                        " (must be debug, info, warn, error, or off)");
+}
+
+const char* log_level_name(LogLevel level) {
+    switch (level) {
+        case LogLevel::DEBUG: return "DEBUG";
+        case LogLevel::INFO: return "INFO";
+        case LogLevel::WARN: return "WARN";
+        case LogLevel::ERROR: return "ERROR";
+        case LogLevel::OFF: return "OFF";
+    }
+    return "?";
+}
+
+void set_log_level(LogLevel level) {
+    current_level.store(static_cast<int>(level), memory_order_relaxed);
+}
+
+bool log_enabled(LogLevel level) {
+    return level != LogLevel::OFF &&
+           static_cast<int>(level) >= current_level.load(memory_order_relaxed);
+}
+
+void start_logger() {
+    lock_guard<mutex> lock(writer_mutex);
+    if (writer_running) {
+        return;
+    }
+    writer_stop = false;
+    writer = thread(writer_loop);
+    writer_running = true;
+}
+
+void stop_logger() {
+    {
+        lock_guard<mutex> lock(writer_mutex);
+        if (!writer_running) {
+            return;
+        }
+        writer_stop = true;
+        writer_running = false;
+    }
+    writer_cv.notify_all();
+    writer.join();
+
+    vector<LogRecord> batch;
+    drain_buffers(batch);
+    write_records(batch);
+}
+
+LogLine& LogLine::operator<<(double value) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%g", value);
+    text += buf;
+    return *this;
+}
+
+void log_message(LogLevel level, string message) {
+    LogRecord record{next_sequence.fetch_add(1, memory_order_relaxed), wall_clock_ns(),
+                     level, move(message)};
+
+    if (!writer_running.load(memory_order_acquire)) {
+        vector<LogRecord> single;
+        single.push_back(move(record));
+        write_records(single);
+        return;
+    }
+
+    ThreadLogBuffer& buffer = thread_buffer();
+    size_t pending;
+    {
+        lock_guard<mutex> lock(buffer.buffer_mutex);
+        buffer.records.push_back(move(record));
+        pending = buffer.records.size();
+    }
+
+    if (pending == WAKE_THRESHOLD) {
+        lock_guard<mutex> lock(writer_mutex);
+        writer_wakeup = true;
+        writer_cv.notify_one();
+    }
+}
@@ -0,0 +1,62 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <string>
+#include <type_traits>
+
+using namespace std;
+
+enum class LogLevel {
+    DEBUG,
+    INFO,
+    WARN,
+    ERROR,
+    OFF
+};
+
+LogLevel parse_log_level(const string& level_str);
+
+const char* log_level_name(LogLevel level);
+
+void set_log_level(LogLevel level);
+
+bool log_enabled(LogLevel level);
+
+// Starts the background writer. Until it runs, and after stop_logger(),
+// records are written synchronously so nothing is lost at startup/shutdown.
+void start_logger();
+
+// Drains every thread's buffer, writes what is left and joins the writer.
+void stop_logger();
+
+void log_message(LogLevel level, string message);
+
+// Collects one record with stream syntax and hands it to the logger when the
+// statement ends. Formats straight into a string rather than an ostringstream,
+// whose construction dominates the per-record cost. Use through LOG() so
+// disabled levels skip formatting entirely.
+class LogLine {
+public:
+    explicit LogLine(LogLevel level) : level(level) {}
+    ~LogLine() { log_message(level, move(text)); }
+
+    LogLine& operator<<(const string& value) { text += value; return *this; }
+    LogLine& operator<<(const char* value) { text += value; return *this; }
+    LogLine& operator<<(char value) { text += value; return *this; }
+    LogLine& operator<<(double value);
+
+    template <typename T, typename = enable_if_t<is_integral<T>::value>>
+    LogLine& operator<<(T value) {
+        text += to_string(value);
+        return *this;
+    }
+
+private:
+    LogLevel level;
+    string text;
+};
+
+#define LOG(level) \
+    if (!log_enabled(LogLevel::level)) {} else LogLine(LogLevel::level)
+
+#endif
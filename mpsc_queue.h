@@ -0,0 +1,56 @@
+#ifndef MPSC_QUEUE_H
+#define MPSC_QUEUE_H
+
+#include <atomic>
+#include <utility>
+
+using namespace std;
+
+// Unbounded multi-producer, single-consumer queue (Vyukov's linked list).
+// push() is one atomic exchange and never blocks; only the owning thread may
+// call pop(). A push that is still linking its node can make pop() report
+// empty for a moment, so producers signal the consumer after pushing.
+template <typename T>
+class MpscQueue {
+public:
+    MpscQueue() : head(new Node()), tail(head.load(memory_order_relaxed)) {}
+
+    ~MpscQueue() {
+        T value;
+        while (pop(value)) {
+        }
+        delete tail;
+    }
+
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+
+    void push(T value) {
+        Node* node = new Node();
+        node->value = move(value);
+        Node* prev = head.exchange(node, memory_order_acq_rel);
+        prev->next.store(node, memory_order_release);
+    }
+
+    bool pop(T& value) {
+        Node* next = tail->next.load(memory_order_acquire);
+        if (!next) {
+            return false;
+        }
+        value = move(next->value);
+        delete tail;
+        tail = next;
+        return true;
+    }
+
+private:
+    struct Node {
+        atomic<Node*> next{nullptr};
+        T value;
+    };
+
+    atomic<Node*> head;
+    Node* tail;
+};
+
+#endif
@@ -0,0 +1,342 @@
+#include "prometheus.h"
+#include "scheduler.h"
+#include "storage.h"
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+
+using namespace std;
+
+static const double HISTOGRAM_BOUNDS_S[] = {
+    0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025,
+    0.05, 0.1, 0.25, 0.5, 1.0, 2.5, 5.0, 10.0
+};
+
+static const char* type_label(RequestType type) {
+    switch (type) {
+        case RequestType::PUT: return "PUT";
+        case RequestType::GET: return "GET";
+        case RequestType::STATS: return "STATS";
+        default: return "UNKNOWN";
+    }
+}
+
+static void write_histogram(ostringstream& out, const string& name, const string& labels,
+                            const HistogramSnapshot& snap) {
+    size_t bucket = 0;
+    uint64_t cumulative = 0;
+    for (double bound_s : HISTOGRAM_BOUNDS_S) {
+        uint64_t bound_ns = static_cast<uint64_t>(bound_s * 1e9);
+        while (bucket < snap.counts.size() &&
+               LatencyHistogram::bucket_upper_bound(static_cast<int>(bucket)) <= bound_ns) {
+            cumulative += snap.counts[bucket];
+            ++bucket;
+        }
+        out << name << "_bucket{" << labels << ",le=\"" << bound_s << "\"} " << cumulative << "\n";
+    }
+    out << name << "_bucket{" << labels << ",le=\"+Inf\"} " << snap.total_count << "\n";
+    out << name << "_sum{" << labels << "} " << snap.sum / 1e9 << "\n";
+    out << name << "_count{" << labels << "} " << snap.total_count << "\n";
+}
+
+// Sharded servers have one such lock per shard; they are reported together.
+static void write_lock(ostringstream& out, const string& name, const vector<const LockStats*>& locks) {
+    uint64_t acquisitions = 0, contended = 0, wait_ns = 0;
+    for (const LockStats* lock : locks) {
+        acquisitions += lock->acquisitions.load(memory_order_relaxed);
+        contended += lock->contended.load(memory_order_relaxed);
+        wait_ns += lock->wait_ns.load(memory_order_relaxed);
+    }
+    out << "fileserver_lock_acquisitions_total{lock=\"" << name << "\"} " << acquisitions << "\n";
+    out << "fileserver_lock_contended_total{lock=\"" << name << "\"} " << contended << "\n";
+    out << "fileserver_lock_wait_seconds_total{lock=\"" << name << "\"} " << wait_ns / 1e9 << "\n";
+}
+
+template <typename Result>
+static uint64_t sum_stores(const vector<const FileStore*>& stores, Result (FileStore::*value)() const) {
+    uint64_t total = 0;
+    for (const FileStore* store : stores) {
+        total += (store->*value)();
+    }
+    return total;
+}
+
+template <typename Result>
+static uint64_t sum_ingest(const vector<const FileStore*>& stores, Result (IngestBudget::*value)() const) {
+    uint64_t total = 0;
+    for (const FileStore* store : stores) {
+        total += (store->ingest().*value)();
+    }
+    return total;
+}
+
+string render_prometheus(const ServerStats& stats, const vector<const Scheduler*>& schedulers,
+                         const vector<const FileStore*>& stores) {
+    ostringstream out;
+
+    out << "# HELP fileserver_uptime_seconds Seconds since the server started.\n"
+        << "# TYPE fileserver_uptime_seconds gauge\n"
+        << "fileserver_uptime_seconds " << stats.uptime_seconds() << "\n";
+
+    out << "# HELP fileserver_requests_total Completed requests by type and outcome.\n"
+        << "# TYPE fileserver_requests_total counter\n";
+    const RequestType types[] = {RequestType::PUT, RequestType::GET, RequestType::STATS};
+    for (RequestType type : types) {
+        out << "fileserver_requests_total{type=\"" << type_label(type) << "\",outcome=\"ok\"} "
+            << stats.requests(type, true) << "\n";
+        out << "fileserver_requests_total{type=\"" << type_label(type) << "\",outcome=\"error\"} "
+            << stats.requests(type, false) << "\n";
+    }
+    out << "fileserver_requests_total{type=\"UNKNOWN\",outcome=\"rejected\"} "
+        << stats.rejected() << "\n";
+    out << "# HELP fileserver_cancelled_total Requests dropped because the client disconnected.\n"
+        << "# TYPE fileserver_cancelled_total counter\n"
+        << "fileserver_cancelled_total{stage=\"queued\"} " << stats.cancelled(false) << "\n"
+        << "fileserver_cancelled_total{stage=\"started\"} " << stats.cancelled(true) << "\n";
+
+    out << "# HELP fileserver_connections_accepted_total Accepted client connections.\n"
+        << "# TYPE fileserver_connections_accepted_total counter\n"
+        << "fileserver_connections_accepted_total " << stats.accepted() << "\n";
+
+    out << "# HELP fileserver_bytes_received_total File payload bytes received.\n"
+        << "# TYPE fileserver_bytes_received_total counter\n"
+        << "fileserver_bytes_received_total " << stats.bytes_in() << "\n";
+    out << "# HELP fileserver_bytes_sent_total File payload bytes sent.\n"
+        << "# TYPE fileserver_bytes_sent_total counter\n"
+        << "fileserver_bytes_sent_total " << stats.bytes_out() << "\n";
+    out << "# HELP fileserver_dedup_hits_total PUTs whose body the server already held.\n"
+        << "# TYPE fileserver_dedup_hits_total counter\n"
+        << "fileserver_dedup_hits_total " << stats.dedup_hits() << "\n";
+    out << "# HELP fileserver_dedup_bytes_saved_total PUT body bytes not transferred thanks to dedup.\n"
+        << "# TYPE fileserver_dedup_bytes_saved_total counter\n"
+        << "fileserver_dedup_bytes_saved_total " << stats.dedup_bytes_saved() << "\n";
+    out << "# HELP fileserver_not_modified_total Conditional GETs answered without a body.\n"
+        << "# TYPE fileserver_not_modified_total counter\n"
+        << "fileserver_not_modified_total " << stats.not_modified() << "\n";
+    out << "# HELP fileserver_not_modified_bytes_saved_total GET body bytes not sent thanks to NOT-MODIFIED.\n"
+        << "# TYPE fileserver_not_modified_bytes_saved_total counter\n"
+        << "fileserver_not_modified_bytes_saved_total " << stats.not_modified_bytes_saved() << "\n";
+    out << "# HELP fileserver_filtered_gets_total GREPs answered with the matching lines only.\n"
+        << "# TYPE fileserver_filtered_gets_total counter\n"
+        << "fileserver_filtered_gets_total " << stats.filtered() << "\n";
+    out << "# HELP fileserver_filtered_bytes_saved_total GET body bytes not sent because GREP left the lines out.\n"
+        << "# TYPE fileserver_filtered_bytes_saved_total counter\n"
+        << "fileserver_filtered_bytes_saved_total " << stats.filtered_bytes_saved() << "\n";
+    out << "# HELP fileserver_watches_total WATCH requests handed to the watch hubs.\n"
+        << "# TYPE fileserver_watches_total counter\n"
+        << "fileserver_watches_total " << stats.watches() << "\n";
+    out << "# HELP fileserver_watch_pushes_total Changes pushed to WATCH connections.\n"
+        << "# TYPE fileserver_watch_pushes_total counter\n"
+        << "fileserver_watch_pushes_total " << stats.watch_pushes() << "\n";
+
+    out << "# HELP fileserver_queue_depth Requests waiting in the scheduler.\n"
+        << "# TYPE fileserver_queue_depth gauge\n"
+        << "fileserver_queue_depth " << stats.queue_depth() << "\n";
+    out << "# HELP fileserver_in_flight Accepted requests not yet completed.\n"
+        << "# TYPE fileserver_in_flight gauge\n"
+        << "fileserver_in_flight " << stats.in_flight() << "\n";
+    out << "# HELP fileserver_watchers Open WATCH connections.\n"
+        << "# TYPE fileserver_watchers gauge\n"
+        << "fileserver_watchers " << stats.watchers() << "\n";
+    out << "# HELP fileserver_workers Worker threads in the pool.\n"
+        << "# TYPE fileserver_workers gauge\n"
+        << "fileserver_workers " << stats.active_workers() << "\n";
+    out << "# HELP fileserver_pool_resizes_total Elastic pool resizes by direction.\n"
+        << "# TYPE fileserver_pool_resizes_total counter\n"
+        << "fileserver_pool_resizes_total{direction=\"grow\"} " << stats.pool_grows() << "\n"
+        << "fileserver_pool_resizes_total{direction=\"shrink\"} " << stats.pool_shrinks() << "\n";
+
+    out << "# HELP fileserver_worker_busy_seconds_total Time each worker spent processing requests.\n"
+        << "# TYPE fileserver_worker_busy_seconds_total counter\n";
+    for (int i = 0; i < stats.worker_count(); ++i) {
+        out << "fileserver_worker_busy_seconds_total{worker=\"" << i << "\"} "
+            << stats.worker_busy_ns(i) / 1e9 << "\n";
+    }
+
+    out << "# HELP fileserver_lock_acquisitions_total Lock acquisitions.\n"
+        << "# TYPE fileserver_lock_acquisitions_total counter\n"
+        << "# HELP fileserver_lock_contended_total Lock acquisitions that had to block.\n"
+        << "# TYPE fileserver_lock_contended_total counter\n"
+        << "# HELP fileserver_lock_wait_seconds_total Time spent blocked acquiring a lock.\n"
+        << "# TYPE fileserver_lock_wait_seconds_total counter\n";
+    vector<const LockStats*> storage_locks, queue_locks;
+    for (const FileStore* store : stores) {
+        storage_locks.push_back(&store->lock_stats());
+    }
+    for (const Scheduler* scheduler : schedulers) {
+        queue_locks.push_back(&scheduler->lock_stats());
+    }
+    if (!storage_locks.empty()) {
+        write_lock(out, "storage_mutex", storage_locks);
+    }
+    if (!queue_locks.empty()) {
+        write_lock(out, "queue_mutex", queue_locks);
+    }
+
+    out << "# HELP fileserver_scheduler_policy Ordering each shard's scheduler currently applies.\n"
+        << "# TYPE fileserver_scheduler_policy gauge\n";
+    for (size_t i = 0; i < schedulers.size(); ++i) {
+        out << "fileserver_scheduler_policy{shard=\"" << i << "\",policy=\""
+            << policy_name(schedulers[i]->active_policy()) << "\"} 1\n";
+    }
+
+    if (!stores.empty()) {
+        out << "# HELP fileserver_ingest_bytes_in_flight PUT bytes reserved by uploads being received.\n"
+            << "# TYPE fileserver_ingest_bytes_in_flight gauge\n"
+            << "fileserver_ingest_bytes_in_flight " << sum_ingest(stores, &IngestBudget::bytes_in_flight) << "\n";
+        out << "# HELP fileserver_ingest_budget_bytes Limit on PUT bytes being received at once.\n"
+            << "# TYPE fileserver_ingest_budget_bytes gauge\n"
+            << "fileserver_ingest_budget_bytes " << sum_ingest(stores, &IngestBudget::capacity_bytes) << "\n";
+        out << "# HELP fileserver_ingest_waits_total Uploads that waited for ingest budget.\n"
+            << "# TYPE fileserver_ingest_waits_total counter\n"
+            << "fileserver_ingest_waits_total " << sum_ingest(stores, &IngestBudget::wait_count) << "\n";
+        out << "# HELP fileserver_ingest_rejected_total Uploads refused as larger than the upload limit.\n"
+            << "# TYPE fileserver_ingest_rejected_total counter\n"
+            << "fileserver_ingest_rejected_total " << sum_ingest(stores, &IngestBudget::rejected_count) << "\n";
+        out << "# HELP fileserver_compress_builds_total Stored versions compressed for a GET.\n"
+            << "# TYPE fileserver_compress_builds_total counter\n"
+            << "fileserver_compress_builds_total " << sum_stores(stores, &FileStore::compress_build_count) << "\n";
+        out << "# HELP fileserver_compress_cache_hits_total Compressed GETs served from the cached copy.\n"
+            << "# TYPE fileserver_compress_cache_hits_total counter\n"
+            << "fileserver_compress_cache_hits_total " << sum_stores(stores, &FileStore::compress_hit_count) << "\n";
+        out << "# HELP fileserver_dedup_shared_total Received bodies merged into an identical stored copy.\n"
+            << "# TYPE fileserver_dedup_shared_total counter\n"
+            << "fileserver_dedup_shared_total " << sum_stores(stores, &FileStore::dedup_shared_count) << "\n";
+        out << "# HELP fileserver_store_resident_bytes File data held in memory.\n"
+            << "# TYPE fileserver_store_resident_bytes gauge\n"
+            << "fileserver_store_resident_bytes " << sum_stores(stores, &FileStore::resident_bytes) << "\n";
+        out << "# HELP fileserver_store_budget_bytes Limit on file data held in memory, 0 for none.\n"
+            << "# TYPE fileserver_store_budget_bytes gauge\n"
+            << "fileserver_store_budget_bytes " << sum_stores(stores, &FileStore::memory_budget_bytes) << "\n";
+        out << "# HELP fileserver_store_spilled_bytes File data kept in the spill directory.\n"
+            << "# TYPE fileserver_store_spilled_bytes gauge\n"
+            << "fileserver_store_spilled_bytes " << sum_stores(stores, &FileStore::spilled_bytes) << "\n";
+        out << "# HELP fileserver_store_lookups_total GET lookups by whether the file was in memory.\n"
+            << "# TYPE fileserver_store_lookups_total counter\n"
+            << "fileserver_store_lookups_total{result=\"hit\"} " << sum_stores(stores, &FileStore::memory_hit_count) << "\n"
+            << "fileserver_store_lookups_total{result=\"miss\"} " << sum_stores(stores, &FileStore::memory_miss_count) << "\n";
+        out << "# HELP fileserver_store_evictions_total Files evicted from memory to the spill directory.\n"
+            << "# TYPE fileserver_store_evictions_total counter\n"
+            << "fileserver_store_evictions_total " << sum_stores(stores, &FileStore::eviction_count) << "\n";
+        out << "# HELP fileserver_store_admissions_rejected_total Spilled files read back but not kept in memory.\n"
+            << "# TYPE fileserver_store_admissions_rejected_total counter\n"
+            << "fileserver_store_admissions_rejected_total " << sum_stores(stores, &FileStore::admission_reject_count) << "\n";
+        out << "# HELP fileserver_store_coalesced_reads_total GETs of a spilled file served by another GET's read.\n"
+            << "# TYPE fileserver_store_coalesced_reads_total counter\n"
+            << "fileserver_store_coalesced_reads_total " << sum_stores(stores, &FileStore::coalesced_read_count) << "\n";
+    }
+
+    const RequestType tracked[] = {RequestType::PUT, RequestType::GET};
+    out << "# HELP fileserver_response_seconds Arrival to completion time.\n"
+        << "# TYPE fileserver_response_seconds histogram\n";
+    for (RequestType type : tracked) {
+        for (int c = 0; c < NUM_SIZE_CLASSES; ++c) {
+            SizeClass cls = static_cast<SizeClass>(c);
+            string labels = string("type=\"") + type_label(type) + "\",size_class=\"" + size_class_name(cls) + "\"";
+            write_histogram(out, "fileserver_response_seconds", labels, stats.response_histogram(type, cls));
+        }
+    }
+    out << "# HELP fileserver_waiting_seconds Arrival to first service time.\n"
+        << "# TYPE fileserver_waiting_seconds histogram\n";
+    for (RequestType type : tracked) {
+        for (int c = 0; c < NUM_SIZE_CLASSES; ++c) {
+            SizeClass cls = static_cast<SizeClass>(c);
+            string labels = string("type=\"") + type_label(type) + "\",size_class=\"" + size_class_name(cls) + "\"";
+            write_histogram(out, "fileserver_waiting_seconds", labels, stats.waiting_histogram(type, cls));
+        }
+    }
+
+    return out.str();
+}
+
+static bool send_all(int sockfd, const string& data) {
+    size_t total_sent = 0;
+    while (total_sent < data.size()) {
+        ssize_t sent = send(sockfd, data.c_str() + total_sent, data.size() - total_sent, MSG_NOSIGNAL);
+        if (sent <= 0) {
+            return false;
+        }
+        total_sent += sent;
+    }
+    return true;
+}
+
+static void serve_scrape(int client_sock, const ServerStats& stats,
+                         const vector<const Scheduler*>& schedulers,
+                         const vector<const FileStore*>& stores) {
+    string request;
+    char buf[1024];
+    while (request.find("\r\n\r\n") == string::npos && request.size() < 8192) {
+        ssize_t received = recv(client_sock, buf, sizeof(buf), 0);
+        if (received <= 0) {
+            return;
+        }
+        request.append(buf, received);
+    }
+
+    istringstream iss(request);
+    string method, path;
+    iss >> method >> path;
+
+    string status = "200 OK";
+    string body;
+    if (method != "GET") {
+        status = "405 Method Not Allowed";
+        body = "method not allowed\n";
+    } else if (path == "/metrics" || path == "/") {
+        body = render_prometheus(stats, schedulers, stores);
+    } else {
+        status = "404 Not Found";
+        body = "not found\n";
+    }
+
+    string response = "HTTP/1.1 " + status + "\r\n"
+                      "Content-Type: text/plain; version=0.0.4\r\n"
+                      "Content-Length: " + to_string(body.size()) + "\r\n"
+                      "Connection: close\r\n\r\n" + body;
+    send_all(client_sock, response);
+}
+
+void metrics_listener_thread(int listen_sock, const ServerStats& stats,
+                             vector<const Scheduler*> schedulers,
+                             vector<const FileStore*> stores) {
+    while (true) {
+        int client_sock = accept(listen_sock, nullptr, nullptr);
+        if (client_sock < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            break;
+        }
+        struct timeval timeout = {2, 0};
+        setsockopt(client_sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        serve_scrape(client_sock, stats, schedulers, stores);
+        close(client_sock);
+    }
+}
+
+int open_metrics_socket(const string& ip, int port) {
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0) {
+        return -1;
+    }
+
+    int opt_val = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &opt_val, sizeof(opt_val));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    inet_pton(AF_INET, ip.c_str(), &addr.sin_addr);
+
+    if (::bind(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(sock, 16) < 0) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
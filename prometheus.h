@@ -0,0 +1,25 @@
+#ifndef PROMETHEUS_H
+#define PROMETHEUS_H
+
+#include "stats.h"
+#include <string>
+#include <vector>
+
+using namespace std;
+
+class Scheduler;
+class FileStore;
+
+// Takes one scheduler and store per shard; their figures are summed.
+string render_prometheus(const ServerStats& stats, const vector<const Scheduler*>& schedulers,
+                         const vector<const FileStore*>& stores);
+
+// Serves GET /metrics on the given port until the listening socket is closed.
+// Scrapes only read relaxed atomics, so they never block request processing.
+void metrics_listener_thread(int listen_sock, const ServerStats& stats,
+                             vector<const Scheduler*> schedulers,
+                             vector<const FileStore*> stores);
+
+int open_metrics_socket(const string& ip, int port);
+
+#endif
@@ -1,25 +1,33 @@
 #include "protocol.h"
+#include "compression.h"
+#include "hash.h"
+#include <poll.h>
 #include <sys/socket.h>
+#include <sys/sendfile.h>
 #include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
 #include <cstring>
 #include <iostream>
-#include <sstream>
 
 using namespace std;
 
+static const size_t STREAM_CHUNK = 1 << 20;
+
+static const size_t SHORT_LINE = 256;
+
 bool send_line(int sockfd, const string& message) {
-  string msg = message + "\n";
-    ssize_t total_sent = 0;
-    ssize_t len = msg.length();
-    
-  while (total_sent < len) {
-        ssize_t sent = send(sockfd, msg.c_str() + total_sent, len - total_sent, 0);
-        if (sent <= 0) {
-  return false;
-        }
-        total_sent += sent;
+    // Protocol lines are short; frame them on the stack instead of copying
+    // into a new string.
+    if (message.size() < SHORT_LINE) {
+        char line[SHORT_LINE];
+        memcpy(line, message.data(), message.size());
+        line[message.size()] = '\n';
+        return send_bytes(sockfd, line, message.size() + 1);
     }
-  return true;
+    string msg = message + "\n";
+    return send_bytes(sockfd, msg.data(), msg.size());
 }
 
 bool recv_line(int sockfd, string& line) {
@@ -39,6 +47,26 @@ bool recv_line(int sockfd, string& line) {
   return true;
 }
 
+int recv_line_nonblocking(int sockfd, string& line) {
+    char c;
+    while (true) {
+        ssize_t received = recv(sockfd, &c, 1, MSG_DONTWAIT);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 0;
+        }
+        if (received <= 0) {
+            return -1;
+        }
+        if (c == '\n') {
+            return 1;
+        }
+        line += c;
+    }
+}
+
 bool send_file(int sockfd, const vector<string>& lines, int packet_size) {
     size_t i = 0;
   while (i < lines.size()) {
@@ -87,43 +115,373 @@ bool recv_file(int sockfd, size_t size, vector<string>& lines) {
   return true;
 }
 
+bool send_file_fd(int sockfd, int fd, size_t file_bytes, bool add_newline) {
+    off_t offset = 0;
+    while (static_cast<size_t>(offset) < file_bytes) {
+        size_t chunk = min(STREAM_CHUNK, file_bytes - static_cast<size_t>(offset));
+        ssize_t sent = sendfile(sockfd, fd, &offset, chunk);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            return false;
+        }
+    }
+    if (add_newline && !send_line(sockfd, "")) {
+        return false;
+    }
+    return send_line(sockfd, PROTOCOL_END);
+}
+
+bool recv_file_fd(int sockfd, size_t size, int fd) {
+    vector<char> buffer(min(STREAM_CHUNK, max(size, static_cast<size_t>(1))));
+    size_t received = 0;
+    while (received < size) {
+        ssize_t got = recv(sockfd, buffer.data(), min(buffer.size(), size - received), 0);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            return false;
+        }
+        size_t written = 0;
+        while (written < static_cast<size_t>(got)) {
+            ssize_t w = write(fd, buffer.data() + written, got - written);
+            if (w < 0 && errno == EINTR) {
+                continue;
+            }
+            if (w <= 0) {
+                return false;
+            }
+            written += w;
+        }
+        received += got;
+    }
+    return true;
+}
+
+bool send_bytes(int sockfd, const char* data, size_t len) {
+    size_t total_sent = 0;
+    while (total_sent < len) {
+        ssize_t sent = send(sockfd, data + total_sent, len - total_sent, 0);
+        if (sent <= 0) {
+            return false;
+        }
+        total_sent += sent;
+    }
+    return true;
+}
+
+bool peer_closed(int sockfd) {
+    struct pollfd pfd = {sockfd, 0, 0};
+    if (poll(&pfd, 1, 0) < 0) {
+        return false;
+    }
+    return (pfd.revents & (POLLHUP | POLLERR | POLLNVAL)) != 0;
+}
+
+bool recv_body(int sockfd, size_t size, string& data) {
+    data.resize(size);
+    size_t received = 0;
+    while (received < size) {
+        ssize_t got = recv(sockfd, &data[received], min(STREAM_CHUNK, size - received), 0);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            return false;
+        }
+        received += got;
+    }
+    string end_line;
+    return recv_line(sockfd, end_line) && end_line == PROTOCOL_END;
+}
+
+bool recv_file_data(int sockfd, size_t size, string& data) {
+    return recv_body(sockfd, size, data) && (data.empty() || data.back() == '\n');
+}
+
+static const string RESPONSE_END = PROTOCOL_END + "\n";
+
+FileData make_file_data(shared_ptr<const void> owner, string_view bytes) {
+    struct View {
+        shared_ptr<const void> owner;
+        string_view bytes;
+    };
+    auto view = make_shared<const View>(View{move(owner), bytes});
+    return FileData(view, &view->bytes);
+}
+
+FileData make_file_data(string bytes) {
+    struct Owned {
+        string bytes;
+        string_view view;
+    };
+    auto owned = make_shared<Owned>();
+    owned->bytes = move(bytes);
+    owned->view = owned->bytes;
+    return FileData(owned, &owned->view);
+}
+
+shared_ptr<const WireResponse> build_response(const FileVersion& version, FileData body,
+                                              bool encoded, size_t decoded_size) {
+    auto response = make_shared<WireResponse>();
+    string tail;
+    if (encoded) {
+        tail = PROTOCOL_ENCODING + " " + ENCODING_ZLIB + " " + to_string(decoded_size) + "\n";
+    }
+    tail += PROTOCOL_SIZE + " " + to_string(body->size()) + "\n";
+    response->head = PROTOCOL_OK + "\n" + tail;
+    response->conditional_head =
+        PROTOCOL_OK + "\n" + PROTOCOL_VERSION + " " + format_version(version) + "\n" + tail;
+    response->body = move(body);
+    response->encoded = encoded;
+    return response;
+}
+
+size_t response_size(const WireResponse& response, bool conditional) {
+    const string& head = conditional ? response.conditional_head : response.head;
+    return head.size() + response.body->size() + RESPONSE_END.size();
+}
+
+ssize_t send_response_packet(int sockfd, const WireResponse& response, bool conditional,
+                             size_t offset, int packet_size, int flags) {
+    const string& head = conditional ? response.conditional_head : response.head;
+    string_view body = *response.body;
+    struct iovec parts[3];
+    int count = 0;
+    if (offset < head.size()) {
+        parts[count++] = {const_cast<char*>(head.data() + offset), head.size() - offset};
+        offset = 0;
+    } else {
+        offset -= head.size();
+    }
+
+    if (offset < body.size()) {
+        size_t packet_end = offset;
+        if (response.encoded) {
+            packet_end = min(body.size(), offset + ENCODED_PACKET);
+        } else {
+            for (int i = 0; i < packet_size && packet_end < body.size(); ++i) {
+                const char* newline = static_cast<const char*>(
+                    memchr(body.data() + packet_end, '\n', body.size() - packet_end));
+                packet_end = newline ? newline - body.data() + 1 : body.size();
+            }
+        }
+        parts[count++] = {const_cast<char*>(body.data() + offset), packet_end - offset};
+        offset = packet_end;
+    }
+
+    if (offset >= body.size()) {
+        offset -= body.size();
+        if (offset < RESPONSE_END.size()) {
+            parts[count++] = {const_cast<char*>(RESPONSE_END.data() + offset),
+                              RESPONSE_END.size() - offset};
+        }
+    }
+    if (count == 0) {
+        return 0;
+    }
+    struct msghdr message = {};
+    message.msg_iov = parts;
+    message.msg_iovlen = count;
+    return sendmsg(sockfd, &message, flags | MSG_NOSIGNAL);
+}
+
+bool send_response(int sockfd, const WireResponse& response, bool conditional, int packet_size) {
+    size_t total = response_size(response, conditional);
+    size_t sent_bytes = 0;
+    while (sent_bytes < total) {
+        ssize_t sent = send_response_packet(sockfd, response, conditional, sent_bytes,
+                                            packet_size, 0);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            return false;
+        }
+        sent_bytes += sent;
+    }
+    return true;
+}
+
+string format_version(const FileVersion& version) {
+    return to_string(version.number) + "-" + hash_to_hex(version.hash);
+}
+
+bool parse_version(string_view tag, FileVersion& version) {
+    size_t dash = tag.find('-');
+    if (dash == string_view::npos || dash == 0) {
+        return false;
+    }
+    auto result = from_chars(tag.data(), tag.data() + dash, version.number);
+    return result.ec == errc() && result.ptr == tag.data() + dash &&
+           parse_hash_hex(tag.substr(dash + 1), version.hash);
+}
+
+void Request::reset() {
+    type = RequestType::UNKNOWN;
+    filename.clear();
+    file_size = 0;
+    file_data.reset();
+    client_id = 0;
+    encoding.clear();
+    decoded_size = 0;
+    response.reset();
+    has_hash = false;
+    content_hash = 0;
+    append = false;
+    pattern.clear();
+    watch = false;
+    watch_body = false;
+    conditional = false;
+    has_client_version = false;
+    client_version = FileVersion();
+    version = FileVersion();
+    spill_fd = -1;
+    arrival_time = 0;
+    start_time = 0;
+    finish_time = 0;
+    bytes_sent = 0;
+    shard = 0;
+    pool_shard = 0;
+    trace.reset();
+    task.reset();
+    header_line.clear();
+}
+
+// Splits the next whitespace-separated token off rest, as operator>> would,
+// without copying it.
+static string_view next_token(string_view& rest) {
+    size_t begin = rest.find_first_not_of(" \t\r");
+    if (begin == string_view::npos) {
+        rest = string_view();
+        return rest;
+    }
+    size_t end = min(rest.find_first_of(" \t\r", begin), rest.size());
+    string_view token = rest.substr(begin, end - begin);
+    rest.remove_prefix(end);
+    return token;
+}
+
+static bool parse_size(string_view token, size_t& value) {
+    auto result = from_chars(token.data(), token.data() + token.size(), value);
+    return !token.empty() && result.ec == errc() && result.ptr == token.data() + token.size();
+}
+
+bool parse_put_header_line(string_view line, Request& request, bool& more) {
+    string_view rest = line;
+    string_view cmd = next_token(rest);
+    if (cmd == PROTOCOL_ENCODING && request.encoding.empty()) {
+        if (next_token(rest) != ENCODING_ZLIB ||
+            !parse_size(next_token(rest), request.decoded_size)) {
+            return false;
+        }
+        request.encoding = ENCODING_ZLIB;
+        more = true;
+        return true;
+    }
+    more = false;
+    return cmd == PROTOCOL_SIZE && parse_size(next_token(rest), request.file_size);
+}
+
+// Parses the ENCODING/SIZE lines starting from the one in header_line.
+static bool parse_put_header(int sockfd, Request& request) {
+    bool more = false;
+    while (parse_put_header_line(request.header_line, request, more)) {
+        if (!more) {
+            return true;
+        }
+        if (!recv_line(sockfd, request.header_line)) {
+            return false;
+        }
+    }
+    return false;
+}
+
+// Reads the tag after VERSION in a GET or WATCH line.
+static bool parse_client_version(string_view tag, Request& request) {
+    if (tag.empty()) {
+        return false;
+    }
+    request.conditional = true;
+    request.has_client_version = tag != VERSION_NONE;
+    return !request.has_client_version || parse_version(tag, request.client_version);
+}
+
+bool recv_put_header(int sockfd, Request& request) {
+    return recv_line(sockfd, request.header_line) && parse_put_header(sockfd, request);
+}
+
 bool parse_request(int sockfd, Request& request) {
-    string command;
-  if (!recv_line(sockfd, command)) {
+    string& line = request.header_line;
+    if (!recv_line(sockfd, line)) {
         return false;
     }
-    
-  istringstream iss(command);
-    string cmd, filename;
-    iss >> cmd >> filename;
-    
-  if (cmd == PROTOCOL_PUT) {
+
+    string_view rest = line;
+    string_view cmd = next_token(rest);
+    string_view filename = next_token(rest);
+
+    if (cmd == PROTOCOL_PUT) {
         request.type = RequestType::PUT;
-        request.filename = filename;
-        
-  string size_line;
-        if (!recv_line(sockfd, size_line)) {
+        request.filename.assign(filename.data(), filename.size());
+
+        if (!recv_line(sockfd, line)) {
             return false;
         }
-        
-  istringstream size_iss(size_line);
-        string size_cmd;
-        size_iss >> size_cmd >> request.file_size;
-        
-  if (size_cmd != PROTOCOL_SIZE) {
-            return false;
+        rest = line;
+        if (next_token(rest) == PROTOCOL_HASH) {
+            request.has_hash = parse_hash_hex(next_token(rest), request.content_hash) &&
+                               parse_size(next_token(rest), request.file_size);
+            return request.has_hash;
         }
-        
-  if (!recv_file(sockfd, request.file_size, request.file_lines)) {
+        return parse_put_header(sockfd, request);
+    } else if (cmd == PROTOCOL_APPEND) {
+        request.type = RequestType::PUT;
+        request.append = true;
+        request.filename.assign(filename.data(), filename.size());
+        return recv_put_header(sockfd, request);
+    } else if (cmd == PROTOCOL_GREP) {
+        // The pattern is the rest of the line after one space, so it may
+        // hold spaces of its own. A CRLF client's \r is not part of it.
+        request.type = RequestType::GET;
+        request.filename.assign(filename.data(), filename.size());
+        if (!rest.empty() && rest.back() == '\r') {
+            rest.remove_suffix(1);
+        }
+        if (rest.size() < 2 || rest[0] != ' ') {
             return false;
         }
-        
-  return true;
+        request.pattern.assign(rest.data() + 1, rest.size() - 1);
+        return true;
     } else if (cmd == PROTOCOL_GET) {
         request.type = RequestType::GET;
-  request.filename = filename;
+        request.filename.assign(filename.data(), filename.size());
+        for (string_view token = next_token(rest); !token.empty(); token = next_token(rest)) {
+            if (token == ENCODING_ZLIB) {
+                request.encoding = ENCODING_ZLIB;
+            } else if (token == PROTOCOL_VERSION && !parse_client_version(next_token(rest), request)) {
+                return false;
+            }
+        }
+        return true;
+    } else if (cmd == PROTOCOL_WATCH) {
+        request.type = RequestType::GET;
+        request.watch = true;
+        request.filename.assign(filename.data(), filename.size());
+        for (string_view token = next_token(rest); !token.empty(); token = next_token(rest)) {
+            if (token == WATCH_BODY) {
+                request.watch_body = true;
+            } else if (token == PROTOCOL_VERSION && !parse_client_version(next_token(rest), request)) {
+                return false;
+            }
+        }
+        return true;
+    } else if (cmd == PROTOCOL_STATS) {
+        request.type = RequestType::STATS;
         return true;
     }
-    
-  return false;
-}
\ No newline at end of file
+
+    return false;
+}
@@ -1,49 +1,223 @@
 #ifndef PROTOCOL_H
 #define PROTOCOL_H
 
+#include <cstdint>
+#include <memory>
 #include <string>
+#include <string_view>
+#include <sys/types.h>
 #include <vector>
 
 using namespace std;
 
 const string PROTOCOL_PUT = "PUT";
 const string PROTOCOL_GET = "GET";
+const string PROTOCOL_APPEND = "APPEND";
+const string PROTOCOL_GREP = "GREP";
+const string PROTOCOL_WATCH = "WATCH";
 const string PROTOCOL_OK = "OK";
 const string PROTOCOL_ERROR = "ERROR";
 const string PROTOCOL_SIZE = "SIZE";
 const string PROTOCOL_END = "END";
+const string PROTOCOL_STATS = "STATS";
+const string PROTOCOL_HASH = "HASH";
+const string PROTOCOL_SEND = "SEND";
+const string PROTOCOL_VERSION = "VERSION";
+const string PROTOCOL_NOT_MODIFIED = "NOT-MODIFIED";
+const string PROTOCOL_CHANGED = "CHANGED";
+const string PROTOCOL_APPENDED = "APPENDED";
+const string VERSION_NONE = "none";
+const string WATCH_BODY = "BODY";
 
 enum class RequestType {
     PUT,
     GET,
+    STATS,
     UNKNOWN
 };
 
+struct RequestTrace;
+class RequestTask;
+
+// Identifies one stored version of a file: a number that grows with every
+// change, plus the content hash. Sent as "<number>-<16 hex digits>".
+struct FileVersion {
+    uint64_t number = 0;
+    uint64_t hash = 0;
+};
+
+string format_version(const FileVersion& version);
+
+bool parse_version(string_view tag, FileVersion& version);
+
+// One immutable version of a file: its newline-terminated lines stored
+// contiguously, as a view that keeps the buffer under it alive. A GET holds
+// the version it started with, so a concurrent PUT or APPEND never changes
+// bytes that are already being sent. The versions of a file grown by APPEND
+// view ever longer prefixes of one buffer.
+using FileData = shared_ptr<const string_view>;
+
+// FileData over bytes that owner keeps alive.
+FileData make_file_data(shared_ptr<const void> owner, string_view bytes);
+
+// FileData that owns bytes.
+FileData make_file_data(string bytes);
+
+// Body bytes per send for a zlib body, which has no lines to packetize by.
+const size_t ENCODED_PACKET = 64 << 10;
+
+// A GET reply prepared once per stored version: the lines that precede the
+// body, plain and with the VERSION line a conditional GET gets, and the body.
+// END follows the body. Sending one is a sendmsg() per packet with no
+// formatting; the first carries the head and the last END.
+struct WireResponse {
+    string head;
+    string conditional_head;
+    FileData body;
+    bool encoded = false;
+};
+
+// Reply for body, a version of a file; encoded marks body as the zlib form of
+// decoded_size bytes.
+shared_ptr<const WireResponse> build_response(const FileVersion& version, FileData body,
+                                              bool encoded = false, size_t decoded_size = 0);
+
+size_t response_size(const WireResponse& response, bool conditional);
+
+// Sends the reply from byte offset to the end of the packet offset falls in:
+// packet_size lines of a plain body, ENCODED_PACKET bytes of a zlib one.
+// Returns what sendmsg() does.
+ssize_t send_response_packet(int sockfd, const WireResponse& response, bool conditional,
+                             size_t offset, int packet_size, int flags);
+
+// Sends the whole reply, blocking.
+bool send_response(int sockfd, const WireResponse& response, bool conditional, int packet_size);
+
 struct Request {
     RequestType type;
     string filename;
     size_t file_size;
-    vector<string> file_lines;
+    FileData file_data;
     int client_id;
 
+    // PUT: encoding of the body on the wire and its decoded size.
+    // GET: the encoding the client accepts; response is the prepared reply,
+    // the plain one found with the file until sending picks the final one.
+    string encoding;
+    size_t decoded_size = 0;
+    shared_ptr<const WireResponse> response;
+
+    // PUT: content hash the client offered before sending the body. The
+    // server answers OK if it already holds those bytes, SEND otherwise.
+    bool has_hash = false;
+    uint64_t content_hash = 0;
+
+    // PUT sent as APPEND: the body is added to the end of the file, which
+    // is created if missing. file_size is the size of the added lines only.
+    bool append = false;
+
+    // GET sent as GREP: only the lines containing pattern are sent, found
+    // by the worker in the stored file. file_size stays the stored size,
+    // so the request is scheduled by the bytes it scans.
+    string pattern;
+
+    // GET sent as WATCH: the connection is kept and told of every later
+    // version of the file, with its contents if watch_body is set. A
+    // client_version that is not current is reported at once.
+    bool watch = false;
+    bool watch_body = false;
+
+    // GET: the client asked for the version tag (conditional is set), and
+    // may hold client_version already. version is the stored version that
+    // file_data was taken from.
+    bool conditional = false;
+    bool has_client_version = false;
+    FileVersion client_version;
+    FileVersion version;
+
+    // GET: open spilled copy of the file when file_data was not in memory
+    // at accept; the worker reads it back.
+    int spill_fd = -1;
+
     long long arrival_time;
     long long start_time;
     long long finish_time;
 
-    size_t lines_processed = 0;
+    size_t bytes_sent = 0;
+
+    // Server: index of the shard that owns filename and runs the request.
+    int shard = 0;
+    // Server: index of the shard that accepted the request, whose pool it
+    // came from.
+    int pool_shard = 0;
+
+    shared_ptr<RequestTrace> trace;
+
+    // Server, coroutine mode: the handler, suspended between slices.
+    shared_ptr<RequestTask> task;
+
+    // Holds the header line being parsed. It outlives the parse so a pooled
+    // request reads its next header without allocating.
+    string header_line;
 
     Request() : type(RequestType::UNKNOWN), file_size(0), client_id(0),
                 arrival_time(0), start_time(0), finish_time(0) {}
+
+    // Returns every field to its constructed value for reuse, keeping string
+    // capacity. A field added above has to be cleared here as well.
+    void reset();
 };
 
 bool send_line(int sockfd, const string& message);
 
 bool recv_line(int sockfd, string& line);
 
+// recv_line() for a handler that must not block: appends whatever part of the
+// line has arrived to line. Returns 1 once the newline has been read, 0 if
+// no more bytes are available yet, and -1 on error or end of stream.
+int recv_line_nonblocking(int sockfd, string& line);
+
 bool send_file(int sockfd, const vector<string>& lines, int packet_size);
 
 bool recv_file(int sockfd, size_t size, vector<string>& lines);
 
+// Streams a SIZE-framed body from an open file with sendfile(), so the file
+// is never held in memory. add_newline terminates a file whose last line has
+// no newline, matching what send_file() would put on the wire.
+bool send_file_fd(int sockfd, int fd, size_t file_bytes, bool add_newline);
+
+// Copies size body bytes from the socket into fd through a fixed buffer.
+// Like recv_file(), the trailing END line is left unread.
+bool recv_file_fd(int sockfd, size_t size, int fd);
+
+bool send_bytes(int sockfd, const char* data, size_t len);
+
+// True once the connection has been reset or hung up in both directions.
+// A FIN alone does not count: a client may shut down its sending side after
+// the request and still read the reply, and until the server writes, that
+// half-close cannot be told from a full close. A client that did close is
+// found by the first send, which fails once its reset comes back. Never
+// blocks and leaves unread input on the socket.
+bool peer_closed(int sockfd);
+
+// Receives a SIZE-framed body straight into data in large chunks and consumes
+// the END line.
+bool recv_body(int sockfd, size_t size, string& data);
+
+// recv_body() that also fails unless the body is newline-terminated lines.
+bool recv_file_data(int sockfd, size_t size, string& data);
+
+// Reads the request line, and for PUT the optional ENCODING line and the SIZE
+// line. A PUT body is left on the socket for the worker to stream into storage.
+// A PUT that opens with a HASH line stops there: file_size is the declared
+// decoded size and the body header follows only after the server sends SEND.
 bool parse_request(int sockfd, Request& request);
 
+// Reads the ENCODING/SIZE lines of a PUT that offered a HASH first.
+bool recv_put_header(int sockfd, Request& request);
+
+// Parses one ENCODING/SIZE line of a PUT header. more is set when another
+// line (the SIZE after ENCODING) has to follow.
+bool parse_put_header_line(string_view line, Request& request, bool& more);
+
 #endif
\ No newline at end of file
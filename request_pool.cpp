@@ -0,0 +1,33 @@
+#include "request_pool.h"
+
+using namespace std;
+
+RequestPool::RequestPool(size_t max_idle) : max_idle(max_idle), created(0), reused(0) {
+    idle.reserve(max_idle);
+}
+
+shared_ptr<Request> RequestPool::acquire() {
+    {
+        lock_guard<mutex> lock(pool_mutex);
+        if (!idle.empty()) {
+            shared_ptr<Request> request = move(idle.back());
+            idle.pop_back();
+            reused.fetch_add(1, memory_order_relaxed);
+            return request;
+        }
+    }
+    created.fetch_add(1, memory_order_relaxed);
+    return make_shared<Request>();
+}
+
+void RequestPool::release(shared_ptr<Request> request) {
+    if (!request || request.use_count() != 1) {
+        return;
+    }
+    // Resetting drops file data and the trace, so do it before taking the lock.
+    request->reset();
+    lock_guard<mutex> lock(pool_mutex);
+    if (idle.size() < max_idle) {
+        idle.push_back(move(request));
+    }
+}
@@ -0,0 +1,34 @@
+#ifndef REQUEST_POOL_H
+#define REQUEST_POOL_H
+
+#include "protocol.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+using namespace std;
+
+// Recycles Request objects so the accept path does not allocate a control
+// block, strings and header buffers for every connection. A released request
+// is reset and kept only if nothing else still refers to it.
+class RequestPool {
+public:
+    explicit RequestPool(size_t max_idle = 1024);
+
+    shared_ptr<Request> acquire();
+
+    void release(shared_ptr<Request> request);
+
+    uint64_t created_count() const { return created.load(memory_order_relaxed); }
+    uint64_t reused_count() const { return reused.load(memory_order_relaxed); }
+
+private:
+    mutex pool_mutex;
+    vector<shared_ptr<Request>> idle;
+    size_t max_idle;
+    atomic<uint64_t> created;
+    atomic<uint64_t> reused;
+};
+
+#endif
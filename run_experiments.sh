@@ -25,7 +25,8 @@ update_config() {
     "server_ip": "127.0.0.1",
   "server_port": 9000,
     "server_threads": $1,
-    "client_threads": $2
+    "client_threads": $2,
+    "acceptor_threads": ${3:-1}
 }
 EOF
 }
@@ -42,7 +43,7 @@ run_experiment() {
   update_config $srv $cli
     
     local cmd="$SERVER_BIN --sched $sched --p $packet --file $TEST_DIR"
-  [ "$sched" = "rr" ] && cmd="$cmd --quantum $quantum"
+  [ "$sched" = "rr" ] || [ "$sched" = "adaptive" ] && cmd="$cmd --quantum $quantum"
     
     $cmd > /dev/null 2>&1 &
   local pid=$!
@@ -68,6 +69,34 @@ run_experiment() {
     sleep 1
 }
 
+# Connection rate: many swarm clients doing back-to-back short GETs, one
+# connection each, against a server with the given number of acceptors.
+run_connrate() {
+  local name=$1 acceptors=$2
+
+    print_msg "Running: $name"
+
+  pkill -9 server 2>/dev/null || true
+    sleep 2
+
+  update_config 4 8 $acceptors
+    $SERVER_BIN --sched fcfs --p 10 --file $TEST_DIR --log-level warn > /dev/null 2>&1 &
+  local pid=$!
+    sleep 3
+
+    $CLIENT_BIN --swarm $SMALL_DIR --clients 200 --loops 4 --requests 50 --think-ms 0 \
+        --ramp-ms 0 --put-ratio 0 --report "$RESULTS_DIR/$name" > /dev/null 2>&1
+
+  if [ -f "$RESULTS_DIR/${name}_summary.csv" ]; then
+        print_msg "✓ Saved: ${name}_summary.csv"
+  else
+        print_error "✗ Failed: $name"
+    fi
+
+  kill -9 $pid 2>/dev/null || true
+    sleep 1
+}
+
 mkdir -p $RESULTS_DIR
 pkill -9 server 2>/dev/null || true
 
@@ -76,12 +105,14 @@ run_experiment "exp1_fcfs" "fcfs" 0 10 4 8
 run_experiment "exp1_sjf" "sjf" 0 10 4 8
 run_experiment "exp1_rr_q5" "rr" 5 10 4 8
 run_experiment "exp1_rr_q10" "rr" 10 10 4 8
+run_experiment "exp1_adaptive" "adaptive" 5 10 4 8
 
 print_msg "=== Experiment 2: Varying Clients ==="
 for c in 2 4 8 16 32; do
   run_experiment "exp2_fcfs_c${c}" "fcfs" 0 10 4 $c
     run_experiment "exp2_sjf_c${c}" "sjf" 0 10 4 $c
     run_experiment "exp2_rr_c${c}" "rr" 5 10 4 $c
+    run_experiment "exp2_adaptive_c${c}" "adaptive" 5 10 4 $c
 done
 
 print_msg "=== Experiment 3: Varying Servers ==="
@@ -89,6 +120,7 @@ for s in 1 2 4 8 16; do
   run_experiment "exp3_fcfs_s${s}" "fcfs" 0 10 $s 8
     run_experiment "exp3_sjf_s${s}" "sjf" 0 10 $s 8
     run_experiment "exp3_rr_s${s}" "rr" 5 10 $s 8
+    run_experiment "exp3_adaptive_s${s}" "adaptive" 5 10 $s 8
 done
 
 print_msg "=== Experiment 4: Varying Packetization ==="
@@ -96,6 +128,7 @@ for p in 1 5 10 25 50 100; do
   run_experiment "exp4_fcfs_p${p}" "fcfs" 0 $p 4 8
     run_experiment "exp4_sjf_p${p}" "sjf" 0 $p 4 8
     run_experiment "exp4_rr_p${p}" "rr" 5 $p 4 8
+    run_experiment "exp4_adaptive_p${p}" "adaptive" 5 $p 4 8
 done
 
 print_msg "=== Experiment 5: Varying RR Quantum ==="
@@ -103,5 +136,14 @@ for q in 1 3 5 10 20 50; do
   run_experiment "exp5_rr_q${q}" "rr" $q 10 4 8
 done
 
+print_msg "=== Experiment 6: Connection Rate vs Acceptors ==="
+SMALL_DIR=$(mktemp -d)
+cp $TEST_DIR/small*.txt $SMALL_DIR/
+for a in 1 2 4; do
+  run_connrate "exp6_connrate_a${a}" $a
+done
+rm -rf $SMALL_DIR
+update_config 4 8
+
 print_msg "Complete! Generated $(ls -1 $RESULTS_DIR/*.csv | wc -l) CSV files"
 ls -lh $RESULTS_DIR/
\ No newline at end of file
@@ -1,34 +1,50 @@
 #include "scheduler.h"
+#include "utils.h"
 #include <algorithm>
+#include <cmath>
 #include <stdexcept>
 
 using namespace std;
 
 void Scheduler::add_request(shared_ptr<Request> req) {
-  lock_guard<mutex> lock(queue_mutex);
+  auto lock = timed_lock(queue_mutex, queue_lock_stats);
     request_queue.push(req);
     queue_cv.notify_one();
 }
 
 void Scheduler::signal_shutdown() {
-  lock_guard<mutex> lock(queue_mutex);
+  auto lock = timed_lock(queue_mutex, queue_lock_stats);
     shutdown = true;
     queue_cv.notify_all();
 }
 
+void Scheduler::retire_one() {
+    auto lock = timed_lock(queue_mutex, queue_lock_stats);
+    ++retiring;
+    queue_cv.notify_one();
+}
+
 bool Scheduler::empty() {
-  lock_guard<mutex> lock(queue_mutex);
+  auto lock = timed_lock(queue_mutex, queue_lock_stats);
     return request_queue.empty();
 }
 
+size_t Scheduler::size() {
+    auto lock = timed_lock(queue_mutex, queue_lock_stats);
+    return request_queue.size();
+}
+
 shared_ptr<Request> FCFSScheduler::get_next_request() {
-  unique_lock<mutex> lock(queue_mutex);
+  auto lock = timed_lock(queue_mutex, queue_lock_stats);
     
     queue_cv.wait(lock, [this] { 
-  return !request_queue.empty() || shutdown; 
+  return !request_queue.empty() || shutdown || retiring > 0; 
     });
     
-    if (shutdown && request_queue.empty()) {
+    if (request_queue.empty()) {
+        if (retiring > 0) {
+            --retiring;
+        }
   return nullptr;
     }
     
@@ -38,19 +54,27 @@ shared_ptr<Request> FCFSScheduler::get_next_request() {
 }
 
 void SJFScheduler::add_request(shared_ptr<Request> req) {
-  lock_guard<mutex> lock(queue_mutex);
+  auto lock = timed_lock(queue_mutex, queue_lock_stats);
     sjf_queue.push(req);
     queue_cv.notify_one();
 }
 
+size_t SJFScheduler::size() {
+    auto lock = timed_lock(queue_mutex, queue_lock_stats);
+    return sjf_queue.size();
+}
+
 shared_ptr<Request> SJFScheduler::get_next_request() {
-  unique_lock<mutex> lock(queue_mutex);
+  auto lock = timed_lock(queue_mutex, queue_lock_stats);
     
     queue_cv.wait(lock, [this] { 
-  return !sjf_queue.empty() || shutdown; 
+  return !sjf_queue.empty() || shutdown || retiring > 0; 
     });
     
-    if (shutdown && sjf_queue.empty()) {
+    if (sjf_queue.empty()) {
+        if (retiring > 0) {
+            --retiring;
+        }
   return nullptr;
     }
     
@@ -60,19 +84,22 @@ shared_ptr<Request> SJFScheduler::get_next_request() {
 }
 
 void RRScheduler::add_request(shared_ptr<Request> req) {
-  lock_guard<mutex> lock(queue_mutex);
+  auto lock = timed_lock(queue_mutex, queue_lock_stats);
     rr_queue.push(req);
     queue_cv.notify_one();
 }
 
 shared_ptr<Request> RRScheduler::get_next_request() {
-  unique_lock<mutex> lock(queue_mutex);
+  auto lock = timed_lock(queue_mutex, queue_lock_stats);
     
     queue_cv.wait(lock, [this] { 
-  return !rr_queue.empty() || shutdown; 
+  return !rr_queue.empty() || shutdown || retiring > 0; 
     });
     
-    if (shutdown && rr_queue.empty()) {
+    if (rr_queue.empty()) {
+        if (retiring > 0) {
+            --retiring;
+        }
   return nullptr;
     }
     
@@ -81,12 +108,179 @@ shared_ptr<Request> RRScheduler::get_next_request() {
     return req;
 }
 
-void RRScheduler::requeue_request(shared_ptr<Request> req) {
-  lock_guard<mutex> lock(queue_mutex);
-    rr_queue.push(req);
+size_t RRScheduler::size() {
+    auto lock = timed_lock(queue_mutex, queue_lock_stats);
+    return rr_queue.size();
+}
+
+namespace {
+
+// Heap order that keeps the smallest file on top.
+bool larger_file(const shared_ptr<Request>& a, const shared_ptr<Request>& b) {
+    return a->file_size > b->file_size;
+}
+
+}
+
+AdaptiveScheduler::AdaptiveScheduler(int q)
+    : quantum(q), mode(SchedulingPolicy::FCFS), last_eval_ns(get_current_time_ns()),
+      arrivals(0), window_arrivals(0), window_starts(0), window_busy_ns(0), service_mean_ns(0),
+      workers(1), size_mean(0), size_sq_mean(0),
+      candidate(SchedulingPolicy::FCFS) {}
+
+void AdaptiveScheduler::add_request(shared_ptr<Request> req) {
+    auto lock = timed_lock(queue_mutex, queue_lock_stats);
+    if (req->start_time == 0) {
+        // Averaged over about the last 64 arrivals; requeued slices are not
+        // arrivals.
+        double size = static_cast<double>(req->file_size);
+        double weight = arrivals < 64 ? 1.0 / (arrivals + 1) : 1.0 / 64;
+        size_mean += weight * (size - size_mean);
+        size_sq_mean += weight * (size * size - size_sq_mean);
+        ++arrivals;
+        ++window_arrivals;
+    }
+    if (mode.load(memory_order_relaxed) == SchedulingPolicy::SJF) {
+        heap.push_back(move(req));
+        push_heap(heap.begin(), heap.end(), larger_file);
+    } else {
+        fifo.push_back(move(req));
+    }
+    long long now = get_current_time_ns();
+    if (now - last_eval_ns >= EVAL_INTERVAL_NS) {
+        evaluate(now);
+    }
     queue_cv.notify_one();
 }
 
+shared_ptr<Request> AdaptiveScheduler::get_next_request() {
+    auto lock = timed_lock(queue_mutex, queue_lock_stats);
+
+    queue_cv.wait(lock, [this] {
+        return !fifo.empty() || !heap.empty() || shutdown || retiring > 0;
+    });
+
+    long long now = get_current_time_ns();
+    if (now - last_eval_ns >= EVAL_INTERVAL_NS) {
+        evaluate(now);
+    }
+
+    shared_ptr<Request> req;
+    if (!heap.empty()) {
+        pop_heap(heap.begin(), heap.end(), larger_file);
+        req = move(heap.back());
+        heap.pop_back();
+    } else if (!fifo.empty()) {
+        req = move(fifo.front());
+        fifo.pop_front();
+    } else if (retiring > 0) {
+        --retiring;
+    }
+    if (req && req->start_time == 0) {
+        ++window_starts;
+    }
+    return req;
+}
+
+size_t AdaptiveScheduler::size() {
+    auto lock = timed_lock(queue_mutex, queue_lock_stats);
+    return fifo.size() + heap.size();
+}
+
+int AdaptiveScheduler::quantum_ms() const {
+    return mode.load(memory_order_relaxed) == SchedulingPolicy::RR ? quantum : 0;
+}
+
+void AdaptiveScheduler::set_switch_listener(function<void(const PolicySwitch&)> listener) {
+    auto lock = timed_lock(queue_mutex, queue_lock_stats);
+    on_switch = move(listener);
+}
+
+vector<PolicySwitch> AdaptiveScheduler::switches() {
+    auto lock = timed_lock(queue_mutex, queue_lock_stats);
+    return history;
+}
+
+void AdaptiveScheduler::evaluate(long long now) {
+    double rate = window_arrivals / ((now - last_eval_ns) / 1e9);
+    window_arrivals = 0;
+    last_eval_ns = now;
+    // Busy time per request, averaged over about the last 8 windows.
+    // Requests finishing now may have started in an earlier window; over a
+    // few windows that evens out.
+    long long busy_ns = window_busy_ns.exchange(0, memory_order_relaxed);
+    if (window_starts > 0) {
+        double service_ns = static_cast<double>(busy_ns) / window_starts;
+        service_mean_ns = service_mean_ns > 0 ? service_mean_ns + (service_ns - service_mean_ns) / 8
+                                              : service_ns;
+        window_starts = 0;
+    }
+    size_t queued = fifo.size() + heap.size();
+    bool backlog = queued > LIGHT_QUEUE;
+    double variance = max(0.0, size_sq_mean - size_mean * size_mean);
+    double cv = size_mean > 0 ? sqrt(variance) / size_mean : 0.0;
+    // Pollaczek-Khinchine: the queue this rate builds, once it has lasted.
+    double load = rate * service_mean_ns / 1e9 / max(1, workers.load(memory_order_relaxed));
+    double predicted = load < 1.0 ? load * load * (1 + cv * cv) / (2 * (1 - load)) : HUGE_VAL;
+    bool building = predicted > LIGHT_QUEUE;
+    // Waiting time counts until a request's first turn. A request served in
+    // slices is requeued after each one and keeps its arrival time, so it
+    // would look starved for as long as its transfer runs.
+    long long oldest = now;
+    for (const auto& req : fifo) {
+        if (req->start_time == 0) {
+            oldest = min(oldest, req->arrival_time);
+        }
+    }
+    for (const auto& req : heap) {
+        if (req->start_time == 0) {
+            oldest = min(oldest, req->arrival_time);
+        }
+    }
+    bool starving = now - oldest >= STARVATION_NS;
+
+    SchedulingPolicy current = mode.load(memory_order_relaxed);
+    SchedulingPolicy choice;
+    string reason;
+    if (!backlog && !building) {
+        choice = SchedulingPolicy::FCFS;
+        reason = "light load";
+    } else if (cv >= 1.0 && starving && current != SchedulingPolicy::FCFS) {
+        choice = SchedulingPolicy::RR;
+        reason = "large requests starving under sjf";
+    } else if (cv >= 1.0) {
+        choice = SchedulingPolicy::SJF;
+        reason = backlog ? "backlog of varied sizes" : "arrival rate building a backlog, varied sizes";
+    } else {
+        choice = SchedulingPolicy::FCFS;
+        reason = backlog ? "backlog of similar sizes" : "arrival rate building a backlog, similar sizes";
+    }
+
+    if (choice == current || choice != candidate) {
+        candidate = choice;
+        return;
+    }
+
+    if (choice == SchedulingPolicy::SJF) {
+        heap.assign(make_move_iterator(fifo.begin()), make_move_iterator(fifo.end()));
+        fifo.clear();
+        make_heap(heap.begin(), heap.end(), larger_file);
+    } else if (current == SchedulingPolicy::SJF) {
+        sort(heap.begin(), heap.end(), [](const shared_ptr<Request>& a, const shared_ptr<Request>& b) {
+            return a->arrival_time < b->arrival_time;
+        });
+        fifo.assign(make_move_iterator(heap.begin()), make_move_iterator(heap.end()));
+        heap.clear();
+    }
+    mode.store(choice, memory_order_relaxed);
+
+    history.push_back(PolicySwitch{now, current, choice, reason, queued, rate, cv, load,
+                                   predicted});
+    if (on_switch) {
+        on_switch(history.back());
+    }
+}
+
 unique_ptr<Scheduler> create_scheduler(SchedulingPolicy policy, int quantum) {
   switch (policy) {
         case SchedulingPolicy::FCFS:
@@ -98,6 +292,11 @@ unique_ptr<Scheduler> create_scheduler(SchedulingPolicy policy, int quantum) {
                 throw runtime_error("Round Robin requires positive quantum value");
             }
             return make_unique<RRScheduler>(quantum);
+        case SchedulingPolicy::ADAPTIVE:
+            if (quantum <= 0) {
+                throw runtime_error("Adaptive scheduling requires positive quantum value");
+            }
+            return make_unique<AdaptiveScheduler>(quantum);
   default:
             throw runtime_error("Unknown scheduling policy");
     }
@@ -110,7 +309,18 @@ SchedulingPolicy parse_policy(const string& policy_str) {
     if (lower == "fcfs") return SchedulingPolicy::FCFS;
   if (lower == "sjf") return SchedulingPolicy::SJF;
     if (lower == "rr") return SchedulingPolicy::RR;
+    if (lower == "adaptive") return SchedulingPolicy::ADAPTIVE;
     
   throw runtime_error("Invalid scheduling policy: " + policy_str + 
-                           " (must be fcfs, sjf, or rr)");
+                           " (must be fcfs, sjf, rr or adaptive)");
+}
+
+const char* policy_name(SchedulingPolicy policy) {
+    switch (policy) {
+        case SchedulingPolicy::FCFS: return "fcfs";
+        case SchedulingPolicy::SJF: return "sjf";
+        case SchedulingPolicy::RR: return "rr";
+        case SchedulingPolicy::ADAPTIVE: return "adaptive";
+    }
+    return "unknown";
 }
\ No newline at end of file
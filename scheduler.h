@@ -2,29 +2,41 @@
 #define SCHEDULER_H
 
 #include "protocol.h"
+#include "stats.h"
 #include <queue>
 #include <mutex>
+#include <atomic>
 #include <condition_variable>
+#include <deque>
+#include <functional>
 #include <memory>
 #include <string>
+#include <vector>
 
 using namespace std;
 
 enum class SchedulingPolicy {
     FCFS,
   SJF,
-    RR
+    RR,
+    ADAPTIVE
 };
 
+const char* policy_name(SchedulingPolicy policy);
+
 class Scheduler {
 protected:
     queue<shared_ptr<Request>> request_queue;
   mutex queue_mutex;
 condition_variable queue_cv;
+    LockStats queue_lock_stats;
     bool shutdown;
+    // Workers asked to exit, handed null by the next get_next_request()
+    // that finds nothing queued.
+    int retiring;
     
 public:
-    Scheduler() : shutdown(false) {}
+    Scheduler() : shutdown(false), retiring(0) {}
     virtual ~Scheduler() {}
     
   virtual void add_request(shared_ptr<Request> req);
@@ -32,13 +44,29 @@ public:
     virtual shared_ptr<Request> get_next_request() = 0;
     
     void signal_shutdown();
+
+    // Lets one idle worker leave: its get_next_request() returns null.
+    void retire_one();
     
   bool empty();
+
+    // Requests waiting to be handed out.
+    virtual size_t size();
+
+    // Time slice in ms after which a worker requeues the request it is
+    // serving, 0 to run every request to completion.
+    virtual int quantum_ms() const { return 0; }
+
+    // The ordering currently applied.
+    virtual SchedulingPolicy active_policy() const = 0;
+
+    const LockStats& lock_stats() const { return queue_lock_stats; }
 };
 
 class FCFSScheduler : public Scheduler {
 public:
     shared_ptr<Request> get_next_request() override;
+    SchedulingPolicy active_policy() const override { return SchedulingPolicy::FCFS; }
 };
 
 class SJFScheduler : public Scheduler {
@@ -57,6 +85,8 @@ private:
 public:
     void add_request(shared_ptr<Request> req) override;
   shared_ptr<Request> get_next_request() override;
+    size_t size() override;
+    SchedulingPolicy active_policy() const override { return SchedulingPolicy::SJF; }
 };
 
 class RRScheduler : public Scheduler {
@@ -69,10 +99,88 @@ public:
     
     void add_request(shared_ptr<Request> req) override;
     shared_ptr<Request> get_next_request() override;
+    size_t size() override;
     
-    void requeue_request(shared_ptr<Request> req);
-    
-  int get_quantum() const { return quantum; }
+  int quantum_ms() const override { return quantum; }
+    SchedulingPolicy active_policy() const override { return SchedulingPolicy::RR; }
+};
+
+// One runtime change of AdaptiveScheduler's ordering.
+struct PolicySwitch {
+    long long time_ns;
+    SchedulingPolicy from;
+    SchedulingPolicy to;
+    string reason;
+    size_t queued;
+    double arrival_rate;
+    double size_cv;
+    double utilization;
+    double predicted_queue;
+};
+
+// Applies FCFS, SJF or RR, whichever suits the recent workload. Every
+// EVAL_INTERVAL_NS it looks at the queue depth, the predicted queue and the
+// spread of file sizes (coefficient of variation over recent arrivals). The
+// predicted queue is the M/G/1 mean queue length for the utilization the
+// arrival rate implies (rate times mean service time, per worker), taking
+// the size CV as the service time CV.
+// - a short queue that is also predicted to stay short gets FCFS, since
+//   ordering barely matters there;
+// - a backlog of varied sizes, or a rate that will build one, gets SJF,
+//   which minimizes mean response time when sizes are known;
+// - SJF that has kept a request waiting for its first turn for
+//   STARVATION_NS gets RR until the large requests have made progress;
+// - any other backlog gets FCFS.
+// A choice must come out of two evaluations in a row before it is applied.
+// A switch keeps every queued request and reorders them for the new policy.
+class AdaptiveScheduler : public Scheduler {
+public:
+    static constexpr long long EVAL_INTERVAL_NS = 100'000'000;
+    static constexpr long long STARVATION_NS = 500'000'000;
+    static const size_t LIGHT_QUEUE = 2;
+
+    explicit AdaptiveScheduler(int q);
+
+    void add_request(shared_ptr<Request> req) override;
+    shared_ptr<Request> get_next_request() override;
+    size_t size() override;
+
+    int quantum_ms() const override;
+    SchedulingPolicy active_policy() const override { return mode.load(memory_order_relaxed); }
+
+    // Workers serving this scheduler, for the utilization.
+    void set_workers(int count) { workers.store(count, memory_order_relaxed); }
+
+    // Time a worker spent on one request or slice taken from here.
+    void record_busy(long long busy_ns) { window_busy_ns.fetch_add(busy_ns, memory_order_relaxed); }
+
+    // Called with each switch, under the queue lock.
+    void set_switch_listener(function<void(const PolicySwitch&)> listener);
+    vector<PolicySwitch> switches();
+
+private:
+    void evaluate(long long now);
+
+    int quantum;
+    atomic<SchedulingPolicy> mode;
+    // FIFO order for FCFS and RR, a min-heap on file_size for SJF; only the
+    // one for the current mode holds requests.
+    deque<shared_ptr<Request>> fifo;
+    vector<shared_ptr<Request>> heap;
+
+    long long last_eval_ns;
+    uint64_t arrivals;
+    uint64_t window_arrivals;
+    // Requests first handed out this window, and the busy time reported.
+    uint64_t window_starts;
+    atomic<long long> window_busy_ns;
+    double service_mean_ns;
+    atomic<int> workers;
+    double size_mean;
+    double size_sq_mean;
+    SchedulingPolicy candidate;
+    vector<PolicySwitch> history;
+    function<void(const PolicySwitch&)> on_switch;
 };
 
 unique_ptr<Scheduler> create_scheduler(SchedulingPolicy policy, int quantum = 0);
@@ -0,0 +1,58 @@
+#include "search.h"
+#include <cstring>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+size_t find_substring(string_view haystack, string_view needle, size_t from) {
+    size_t n = haystack.size();
+    size_t k = needle.size();
+    if (k == 0 || from > n || n - from < k) {
+        return k == 0 && from <= n ? from : string_view::npos;
+    }
+    size_t pos = from;
+#ifdef __SSE2__
+    const char* text = haystack.data();
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[k - 1]);
+    // Tests start positions pos..pos+15; the block of last bytes ends at
+    // pos + k + 14, which must be inside the text.
+    while (pos + k + 15 <= n) {
+        __m128i block_first = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text + pos));
+        __m128i block_last = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text + pos + k - 1));
+        unsigned mask = _mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(first, block_first), _mm_cmpeq_epi8(last, block_last)));
+        while (mask != 0) {
+            size_t candidate = pos + __builtin_ctz(mask);
+            if (k <= 2 || memcmp(text + candidate + 1, needle.data() + 1, k - 2) == 0) {
+                return candidate;
+            }
+            mask &= mask - 1;
+        }
+        pos += 16;
+    }
+#endif
+    return haystack.find(needle, pos);
+}
+
+size_t append_matching_lines(string_view data, string_view pattern, string& out) {
+    size_t matched = 0;
+    size_t pos = 0;
+    while (true) {
+        size_t hit = find_substring(data, pattern, pos);
+        if (hit == string_view::npos) {
+            return matched;
+        }
+        // pos is always the start of a line, so the line holding the match
+        // starts after the last newline between the two.
+        const void* before = memrchr(data.data() + pos, '\n', hit - pos);
+        size_t start = before ? static_cast<const char*>(before) - data.data() + 1 : pos;
+        size_t end = data.find('\n', hit);
+        end = end == string_view::npos ? data.size() : end + 1;
+        out.append(data.substr(start, end - start));
+        ++matched;
+        pos = end;
+    }
+}
@@ -0,0 +1,20 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include <string>
+#include <string_view>
+
+using namespace std;
+
+// Position of the first occurrence of needle in haystack at or after from,
+// or string_view::npos. With SSE2, 16 start positions are tested at once by
+// comparing the needle's first and last bytes; only positions matching both
+// are compared in full, so text without the needle is skipped at memory
+// speed.
+size_t find_substring(string_view haystack, string_view needle, size_t from = 0);
+
+// Appends to out each line of data, newline-terminated lines, that contains
+// pattern. Returns the number of lines that matched.
+size_t append_matching_lines(string_view data, string_view pattern, string& out);
+
+#endif
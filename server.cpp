@@ -1,93 +1,405 @@
+#include "compression.h"
 #include "config.h"
+#include "hash.h"
+#include "io_waiter.h"
+#include "logger.h"
+#include "mpsc_queue.h"
 #include "protocol.h"
+#include "prometheus.h"
+#include "request_pool.h"
 #include "scheduler.h"
+#include "search.h"
+#include "stats.h"
+#include "storage.h"
+#include "task.h"
+#include "trace.h"
 #include "utils.h"
+#include "watch.h"
+#include "worker_pool.h"
 #include <iostream>
 #include <thread>
 #include <vector>
 #include <map>
 #include <mutex>
 #include <atomic>
+#include <condition_variable>
 #include <csignal>
+#include <poll.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <unistd.h>
+#include <cerrno>
+#include <climits>
 #include <cstring>
 #include <fstream>
 #include <getopt.h>
+#include <sys/stat.h>
 
 using namespace std;
 
-map<string, vector<string>> file_storage;
-mutex storage_mutex;
+// What save_metrics() needs from a finished request, so the request itself
+// can go back to the pool.
+struct RequestRecord {
+    RequestType type;
+    string filename;
+    size_t file_size;
+    long long arrival_time;
+    long long start_time;
+    long long finish_time;
+};
+
+// An independent slice of the server. Unsharded there is a single shard that
+// every acceptor feeds. With "shards" in config.json each shard has its own
+// listener, acceptor, scheduler, workers and the files whose names hash to
+// it, and nothing on the request path is locked across shards: a request for
+// another shard's file is pushed onto that shard's inbox and its acceptor,
+// woken through wake_fd, queues it there.
+struct Shard {
+    int id = 0;
+    FileStore store;
+    unique_ptr<Scheduler> scheduler;
+    RequestPool pool;
+    MpscQueue<shared_ptr<Request>> inbox;
+    // Requests this shard accepted and another shard finished, already
+    // reset; the acceptor puts them back in pool.
+    MpscQueue<shared_ptr<Request>> returned;
+    int wake_fd = -1;
+    // Coroutine mode: requests waiting on their sockets.
+    unique_ptr<IoWaiter> waiter;
+    unique_ptr<WorkerPool> workers;
+    // WATCH connections on this shard's files.
+    unique_ptr<WatchHub> watch_hub;
+
+    mutex metrics_mutex;
+    vector<RequestRecord> completed;
+};
+
+vector<unique_ptr<Shard>> shards;
+
+Shard& owner_shard(const string& filename) {
+    if (shards.size() == 1) {
+        return *shards[0];
+    }
+    return *shards[content_hash(filename) % shards.size()];
+}
 
-vector<Request> completed_requests;
-mutex metrics_mutex;
+Shard& shard_of(const Request& request) {
+    return *shards[request.shard];
+}
+
+// Puts a finished request back in the pool of the shard that accepted it,
+// so forwarded requests are reused instead of piling up in the owner's pool.
+// Another shard's request is reset here and handed over without a lock.
+void release_request(Shard& shard, shared_ptr<Request> request) {
+    Shard& home = *shards[request->pool_shard];
+    if (&home == &shard) {
+        shard.pool.release(move(request));
+    } else if (request.use_count() == 1) {
+        request->reset();
+        home.returned.push(move(request));
+    }
+}
+
+void wake_shard(Shard& shard) {
+    uint64_t one = 1;
+    ssize_t ignored = write(shard.wake_fd, &one, sizeof(one));
+    (void)ignored;
+}
+
+void record_finished(const Request& request) {
+    Shard& shard = shard_of(request);
+    lock_guard<mutex> lock(shard.metrics_mutex);
+    shard.completed.push_back({request.type, request.filename, request.file_size,
+                               request.arrival_time, request.start_time, request.finish_time});
+}
 
 int packet_size = 10;
-unique_ptr<Scheduler> scheduler;
+const int DEFAULT_ADAPTIVE_QUANTUM = 10;
+bool coroutine_mode = false;
+
+ServerStats server_stats;
+int stats_interval_s = 5;
+mutex stats_thread_mutex;
+condition_variable stats_thread_cv;
+const chrono::milliseconds POOL_TICK(100);
+mutex pool_log_mutex;
+vector<pair<int, PoolDecision>> pool_log;
 
 atomic<bool> shutdown_requested(false);
-int global_server_sock = -1;
+vector<int> global_server_socks;
+int global_metrics_sock = -1;
 
 void signal_handler(int signum) {
     cout << "\n[Server] Received signal " << signum << ", shutting down..." << endl;
     shutdown_requested = true;
 
-    if (global_server_sock >= 0)
-    {
-        shutdown(global_server_sock, SHUT_RDWR);
-        close(global_server_sock);
+    for (int server_sock : global_server_socks) {
+        shutdown(server_sock, SHUT_RDWR);
+        close(server_sock);
+    }
+
+    if (global_metrics_sock >= 0) {
+        shutdown(global_metrics_sock, SHUT_RDWR);
+    }
+
+    for (auto& shard : shards) {
+        shard->scheduler->signal_shutdown();
+        if (shard->wake_fd >= 0) {
+            wake_shard(*shard);
+        }
     }
+}
 
-    if (scheduler) {
-        scheduler->signal_shutdown();
+void store_file(const string& filename, FileData data, uint64_t hash) {
+    size_t size = data->size();
+    owner_shard(filename).store.publish(filename, move(data), hash);
+    LOG(INFO) << "[Server] Stored file: " << filename
+              << " (" << size << " bytes)";
+}
+
+// How a PUT goes on after its header: already answered (a dedup link, or
+// an error), or with a body to receive under a reserved ingest budget.
+enum class PutStart {
+    ANSWERED_OK,
+    ANSWERED_ERROR,
+    RECEIVE
+};
+
+// Links a PUT that offered a HASH to bytes already stored and answers OK.
+// Otherwise asks for the body with SEND and returns RECEIVE; the header that
+// follows has yet to be read.
+PutStart link_put(int client_sock, Request& request) {
+    size_t declared_size = request.file_size;
+    if (shard_of(request).store.link(request.filename, request.content_hash, declared_size)) {
+        server_stats.record_dedup(declared_size);
+        LOG(INFO) << "[Server] Linked file: " << request.filename
+                  << " (" << declared_size << " bytes already stored)";
+        bool sent = send_line(client_sock, PROTOCOL_OK);
+        trace_event(request, TracePhase::FIRST_BYTE_OUT);
+        trace_event(request, TracePhase::LAST_BYTE_OUT);
+        return sent ? PutStart::ANSWERED_OK : PutStart::ANSWERED_ERROR;
     }
+    return send_line(client_sock, PROTOCOL_SEND) ? PutStart::RECEIVE : PutStart::ANSWERED_ERROR;
 }
 
-void store_file(const string& filename, const vector<string>& lines) {
-    lock_guard<mutex> lock(storage_mutex);
-    file_storage[filename] = lines;
-    cout << "[Server] Stored file: " << filename
-              << " (" << lines.size() << " lines)" << endl;
+// Ingest budget a PUT's body needs. A compressed body is held alongside its
+// decoded form while inflating.
+size_t put_reservation(const Request& request) {
+    bool compressed = request.encoding == ENCODING_ZLIB;
+    return request.file_size + (compressed ? request.decoded_size : 0);
 }
 
-bool retrieve_file(const string& filename, vector<string>& lines) {
-    lock_guard<mutex> lock(storage_mutex);
-    auto it = file_storage.find(filename);
-    if (it == file_storage.end()) {
+void reject_too_large(int client_sock, const Request& request, size_t reserved) {
+    LOG(WARN) << "[Server] Rejected PUT " << request.filename << " of "
+              << reserved << " bytes (upload limit "
+              << shard_of(request).store.ingest().max_upload_bytes() << ")";
+    send_line(client_sock, PROTOCOL_ERROR + " File too large");
+}
+
+PutStart start_put(int client_sock, Request& request, size_t& reserved) {
+    if (request.has_hash) {
+        PutStart start = link_put(client_sock, request);
+        if (start != PutStart::RECEIVE) {
+            return start;
+        }
+        if (!recv_put_header(client_sock, request)) {
+            LOG(WARN) << "[Server] Incomplete PUT " << request.filename;
+            return PutStart::ANSWERED_ERROR;
+        }
+    }
+
+    reserved = put_reservation(request);
+    if (!shard_of(request).store.ingest().reserve(reserved)) {
+        reject_too_large(client_sock, request, reserved);
+        return PutStart::ANSWERED_ERROR;
+    }
+    return PutStart::RECEIVE;
+}
+
+// Decodes and stores a received body, releases the budget start_put()
+// reserved, and answers the client. declared_size is the size a HASH line
+// announced.
+bool finish_put(int client_sock, Request& request, size_t declared_size, size_t reserved,
+                bool received, string& body) {
+    FileStore& store = shard_of(request).store;
+    bool matches = true;
+    bool stored = true;
+    if (received) {
+        string data;
+        if (request.encoding == ENCODING_ZLIB) {
+            received = decompress_data(body, request.decoded_size, data);
+        } else {
+            data.swap(body);
+        }
+        received = received && (data.empty() || data.back() == '\n');
+        if (received && request.append) {
+            server_stats.record_bytes_in(request.file_size);
+            stored = store.append(request.filename, data);
+            if (stored) {
+                LOG(INFO) << "[Server] Appended to file: " << request.filename
+                          << " (" << data.size() << " bytes)";
+            }
+        } else if (received) {
+            server_stats.record_bytes_in(request.file_size);
+            uint64_t hash = content_hash(data);
+            matches = !request.has_hash ||
+                      (hash == request.content_hash && data.size() == declared_size);
+            if (matches) {
+                store_file(request.filename, make_file_data(move(data)), hash);
+            }
+        }
+    }
+    store.ingest().release(reserved);
+
+    if (!matches) {
+        LOG(WARN) << "[Server] PUT " << request.filename << " does not match its HASH";
+        send_line(client_sock, PROTOCOL_ERROR + " Hash mismatch");
+        return false;
+    }
+    if (!received) {
+        LOG(WARN) << "[Server] Incomplete PUT " << request.filename;
+        send_line(client_sock, PROTOCOL_ERROR + " Incomplete upload");
         return false;
     }
-    lines = it->second;
-    return true;
+    if (!stored) {
+        LOG(WARN) << "[Server] Cannot append to " << request.filename;
+        send_line(client_sock, PROTOCOL_ERROR + " Append failed");
+        return false;
+    }
+    bool sent = send_line(client_sock, PROTOCOL_OK);
+    trace_event(request, TracePhase::FIRST_BYTE_OUT);
+    trace_event(request, TracePhase::LAST_BYTE_OUT);
+    return sent;
 }
 
 bool handle_put(int client_sock, Request& request) {
-    store_file(request.filename, request.file_lines);
-    return send_line(client_sock, PROTOCOL_OK);
+    size_t declared_size = request.file_size;
+    size_t reserved = 0;
+    PutStart start = start_put(client_sock, request, reserved);
+    if (start != PutStart::RECEIVE) {
+        return start == PutStart::ANSWERED_OK;
+    }
+    string body;
+    bool received = recv_body(client_sock, request.file_size, body);
+    return finish_put(client_sock, request, declared_size, reserved, received, body);
+}
+
+// Picks the reply for a GET: the cached zlib one when the client accepts it
+// and it is smaller, otherwise the plain one prepared with the file. A GREP
+// reply depends on the pattern, so it is built here and not kept.
+shared_ptr<const WireResponse> prepare_response(const Request& request) {
+    if (!request.pattern.empty()) {
+        string lines;
+        append_matching_lines(*request.file_data, request.pattern, lines);
+        server_stats.record_filtered(request.file_data->size(), lines.size());
+        return build_response(request.version, make_file_data(move(lines)));
+    }
+    FileStore& store = shard_of(request).store;
+    if (request.encoding == ENCODING_ZLIB) {
+        auto encoded = store.compressed(request.filename, request.file_data, request.version);
+        if (encoded) {
+            return encoded;
+        }
+    }
+    if (request.response && request.response->body == request.file_data) {
+        return request.response;
+    }
+    return store.response(request.filename, request.file_data, request.version);
+}
+
+// A conditional GET whose client already holds these contents; the body is
+// not sent. Version numbers restart with the server, so only the hash counts.
+bool not_modified(const Request& request) {
+    return request.has_client_version && request.client_version.hash == request.version.hash;
+}
+
+bool send_not_modified(int client_sock, Request& request) {
+    server_stats.record_not_modified(request.file_size);
+    bool sent = send_line(client_sock, PROTOCOL_NOT_MODIFIED + " " + format_version(request.version));
+    trace_event(request, TracePhase::FIRST_BYTE_OUT);
+    trace_event(request, TracePhase::LAST_BYTE_OUT);
+    return sent;
+}
+
+// A file spilled to disk was only opened at accept; read it back here on the
+// worker so the acceptor never waits on the disk.
+bool load_file_data(Request& request) {
+    if (!request.file_data && request.spill_fd >= 0) {
+        request.file_data = shard_of(request).store.load_spilled(request.filename, request.version,
+                                                                 request.spill_fd, request.file_size);
+        request.spill_fd = -1;
+        if (!request.file_data) {
+            LOG(WARN) << "[Server] Cannot read spilled copy of " << request.filename;
+        }
+    }
+    return request.file_data != nullptr;
+}
+
+void release_file_data(Request& request) {
+    request.file_data.reset();
+    request.response.reset();
+    if (request.spill_fd >= 0) {
+        close(request.spill_fd);
+        request.spill_fd = -1;
+    }
 }
 
 bool handle_get(int client_sock, Request& request) {
-    vector<string> lines;
-    if (!retrieve_file(request.filename, lines)) {
+    if (!request.file_data && request.spill_fd < 0) {
         send_line(client_sock, PROTOCOL_ERROR + " File not found");
         return false;
     }
 
+    if (not_modified(request)) {
+        return send_not_modified(client_sock, request);
+    }
+    if (!load_file_data(request)) {
+        send_line(client_sock, PROTOCOL_ERROR + " Read failed");
+        return false;
+    }
+    request.response = prepare_response(request);
+    server_stats.record_bytes_out(request.response->body->size());
+    trace_event(request, TracePhase::FIRST_BYTE_OUT);
+    bool sent = send_response(client_sock, *request.response, request.conditional, packet_size);
+    trace_event(request, TracePhase::LAST_BYTE_OUT);
+    return sent;
+}
+
+uint64_t sum_over_shards(uint64_t (FileStore::*counter)() const) {
+    uint64_t total = 0;
+    for (const auto& shard : shards) {
+        total += (shard->store.*counter)();
+    }
+    return total;
+}
+
+bool handle_stats(int client_sock) {
+    vector<string> lines = server_stats.report_lines();
+    uint64_t hits = sum_over_shards(&FileStore::memory_hit_count);
+    uint64_t misses = sum_over_shards(&FileStore::memory_miss_count);
+    lines.push_back("store_resident_bytes " + to_string(sum_over_shards(&FileStore::resident_bytes)));
+    lines.push_back("store_spilled_bytes " + to_string(sum_over_shards(&FileStore::spilled_bytes)));
+    lines.push_back("store_memory_hits " + to_string(hits));
+    lines.push_back("store_memory_misses " + to_string(misses));
+    lines.push_back("store_hit_rate " + to_string(hits + misses ? static_cast<double>(hits) / (hits + misses) : 1.0));
+    lines.push_back("store_evictions " + to_string(sum_over_shards(&FileStore::eviction_count)));
+    lines.push_back("store_admissions_rejected " + to_string(sum_over_shards(&FileStore::admission_reject_count)));
+    lines.push_back("store_coalesced_reads " + to_string(sum_over_shards(&FileStore::coalesced_read_count)));
+    server_stats.record_bytes_out(get_file_size(lines));
     if (!send_line(client_sock, PROTOCOL_OK)) {
         return false;
     }
-    size_t file_size = get_file_size(lines);
-    if (!send_line(client_sock, PROTOCOL_SIZE + " " + to_string(file_size))) {
+    if (!send_line(client_sock, PROTOCOL_SIZE + " " + to_string(get_file_size(lines)))) {
         return false;
     }
-
     return send_file(client_sock, lines, packet_size);
 }
 
 void process_request(shared_ptr<Request> request, int client_sock) {
     request->start_time = get_current_time_ns();
+    trace_event(*request, TracePhase::SLICE_START);
 
     bool success = false;
     if (request->type == RequestType::PUT) {
@@ -97,210 +409,663 @@ void process_request(shared_ptr<Request> request, int client_sock) {
     }
 
     request->finish_time = get_current_time_ns();
+    release_file_data(*request);
+    trace_event(*request, TracePhase::SLICE_END);
+    server_stats.record_completion(*request, success);
+    finish_trace(*request);
 
-    {
-        lock_guard<mutex> lock(metrics_mutex);
-        completed_requests.push_back(*request);
-    }
+    record_finished(*request);
 
     if (success) {
-        cout << "[Worker] Completed "
+        LOG(INFO) << "[Worker] Completed "
                   << (request->type == RequestType::PUT ? "PUT" : "GET")
                   << " " << request->filename
                   << " (Response time: " << ns_to_ms(request->finish_time - request->arrival_time)
-                  << " ms)" << endl;
+                  << " ms)";
     }
 
     close(client_sock);
 }
 
 
-bool process_request_chunk_timed(shared_ptr<Request> request) {
+enum class SliceResult {
+    MORE,
+    DONE,
+    FAILED
+};
+
+// Serves one slice of at most quantum_ms, or the rest of the request when
+// quantum_ms is 0.
+SliceResult process_request_chunk_timed(shared_ptr<Request> request, int quantum_ms) {
     if (request->type == RequestType::PUT) {
-        store_file(request->filename, request->file_lines);
-        send_line(request->client_id, PROTOCOL_OK);
-        return true; 
+        return handle_put(request->client_id, *request) ? SliceResult::DONE : SliceResult::FAILED;
 
     } else if (request->type == RequestType::GET) {
 
-        if (request->lines_processed == 0) {
-            if (!send_line(request->client_id, PROTOCOL_OK)) {
-                return true; 
+        if (request->bytes_sent == 0) {
+            if (!request->file_data && request->spill_fd < 0) {
+                send_line(request->client_id, PROTOCOL_ERROR + " File not found");
+                return SliceResult::FAILED;
             }
-            if (!send_line(request->client_id, PROTOCOL_SIZE + " " + to_string(request->file_size))) {
-                return true; 
+            if (not_modified(*request)) {
+                return send_not_modified(request->client_id, *request) ? SliceResult::DONE : SliceResult::FAILED;
             }
+            if (!load_file_data(*request)) {
+                send_line(request->client_id, PROTOCOL_ERROR + " Read failed");
+                return SliceResult::FAILED;
+            }
+            request->response = prepare_response(*request);
+            server_stats.record_bytes_out(request->response->body->size());
+            trace_event(*request, TracePhase::FIRST_BYTE_OUT);
         }
 
-        RRScheduler* rr_sched = dynamic_cast<RRScheduler*>(scheduler.get());
-        long long quantum_ms = rr_sched ? rr_sched->get_quantum() : 10;
-        long long quantum_ns = quantum_ms * 1'000'000LL;
+        long long quantum_ns = quantum_ms > 0 ? quantum_ms * 1'000'000LL : LLONG_MAX;
         auto chunk_start_time = chrono::steady_clock::now();
-
-        while (true) {
-            if (request->lines_processed >= request->file_lines.size()) {
-                send_line(request->client_id, PROTOCOL_END);
-                return true; 
+        const WireResponse& response = *request->response;
+        size_t total = response_size(response, request->conditional);
+
+        // One packet per send, so the quantum is checked between packets.
+        while (request->bytes_sent < total) {
+            ssize_t sent = send_response_packet(request->client_id, response, request->conditional,
+                                                request->bytes_sent, packet_size, 0);
+            if (sent < 0 && errno == EINTR) {
+                continue;
             }
-
-            const string& line_to_send = request->file_lines[request->lines_processed];
-            if (!send_line(request->client_id, line_to_send)) {
-                return true;
+            if (sent <= 0) {
+                return SliceResult::FAILED;
             }
-            request->lines_processed++;
+            request->bytes_sent += sent;
 
             auto elapsed_ns = chrono::duration_cast<chrono::nanoseconds>(
                 chrono::steady_clock::now() - chunk_start_time
             ).count();
             
-            if (elapsed_ns >= quantum_ns) {
-                break;
+            if (elapsed_ns >= quantum_ns && request->bytes_sent < total) {
+                return SliceResult::MORE;
             }
         }
-        return false;
+        trace_event(*request, TracePhase::LAST_BYTE_OUT);
+        return SliceResult::DONE;
     }
     
-    return true;
+    return SliceResult::FAILED;
 }
 
-void worker_thread() {
-    while (true) {
-        auto request = scheduler->get_next_request();
-        if (!request) {
+// Coroutine mode GET: the replies of handle_get(), with the body sent
+// without blocking, yielding when the socket is full or the slice is over.
+RequestTask get_task(Request& request) {
+    int client_sock = request.client_id;
+    if (!request.file_data && request.spill_fd < 0) {
+        send_line(client_sock, PROTOCOL_ERROR + " File not found");
+        co_return false;
+    }
+    if (not_modified(request)) {
+        co_return send_not_modified(client_sock, request);
+    }
+    if (!load_file_data(request)) {
+        send_line(client_sock, PROTOCOL_ERROR + " Read failed");
+        co_return false;
+    }
+    request.response = prepare_response(request);
+    server_stats.record_bytes_out(request.response->body->size());
+    trace_event(request, TracePhase::FIRST_BYTE_OUT);
+
+    const WireResponse& response = *request.response;
+    size_t total = response_size(response, request.conditional);
+    size_t pos = 0;
+    while (pos < total) {
+        ssize_t sent = send_response_packet(client_sock, response, request.conditional, pos,
+                                            packet_size, MSG_DONTWAIT);
+        if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            co_await wait_for(TaskWait::WRITABLE);
+            continue;
+        }
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            co_return false;
+        }
+        pos += sent;
+        if (pos < total) {
+            co_await end_of_slice();
+        }
+    }
+    trace_event(request, TracePhase::LAST_BYTE_OUT);
+    co_return true;
+}
+
+// Coroutine mode PUT: handle_put() without blocking its worker. The header
+// after SEND, the body and END are read as they arrive, and a PUT that finds
+// the ingest budget full gives its thread back until release() frees room.
+RequestTask put_task(Request& request) {
+    int client_sock = request.client_id;
+    size_t declared_size = request.file_size;
+    if (request.has_hash) {
+        PutStart start = link_put(client_sock, request);
+        if (start != PutStart::RECEIVE) {
+            co_return start == PutStart::ANSWERED_OK;
+        }
+        bool more = true;
+        while (more) {
+            request.header_line.clear();
+            int got;
+            while ((got = recv_line_nonblocking(client_sock, request.header_line)) == 0) {
+                co_await wait_for(TaskWait::READABLE);
+            }
+            if (got < 0 || !parse_put_header_line(request.header_line, request, more)) {
+                LOG(WARN) << "[Server] Incomplete PUT " << request.filename;
+                co_return false;
+            }
+        }
+    }
+
+    size_t reserved = put_reservation(request);
+    IngestBudget& budget = shard_of(request).store.ingest();
+    Reservation reservation;
+    while ((reservation = budget.try_reserve(reserved)) == Reservation::FULL) {
+        co_await wait_for(TaskWait::BUDGET);
+    }
+    if (reservation == Reservation::TOO_LARGE) {
+        reject_too_large(client_sock, request, reserved);
+        co_return false;
+    }
+
+    string body(request.file_size, '\0');
+    size_t received = 0;
+    bool complete = true;
+    while (received < body.size()) {
+        ssize_t got = recv(client_sock, &body[received], body.size() - received, MSG_DONTWAIT);
+        if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            co_await wait_for(TaskWait::READABLE);
+            continue;
+        }
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            complete = false;
             break;
         }
+        received += got;
+        co_await end_of_slice();
+    }
+    string end_line;
+    if (complete) {
+        int got;
+        while ((got = recv_line_nonblocking(client_sock, end_line)) == 0) {
+            co_await wait_for(TaskWait::READABLE);
+        }
+        complete = got > 0 && end_line == PROTOCOL_END;
+    }
+    co_return finish_put(client_sock, request, declared_size, reserved, complete, body);
+}
 
-        RRScheduler* rr_sched = dynamic_cast<RRScheduler*>(scheduler.get());
+// Coroutine mode: runs one slice of the request's task. slice_ns is 0 for
+// policies that never preempt. A task that used up its slice goes back to
+// the scheduler; one waiting on its socket is parked with the shard's
+// IoWaiter, which requeues it once the socket is ready.
+void run_task_slice(Shard& shard, shared_ptr<Request> request, long long slice_ns) {
+    if (!request->task) {
+        request->start_time = get_current_time_ns();
+        request->task = make_shared<RequestTask>(request->type == RequestType::PUT
+                                                     ? put_task(*request)
+                                                     : get_task(*request));
+    }
+    trace_event(*request, TracePhase::SLICE_START);
+    request->task->resume(slice_ns > 0 ? get_current_time_ns() + slice_ns : 0);
+    trace_event(*request, TracePhase::SLICE_END);
+
+    if (request->task->done()) {
+        bool success = request->task->result();
+        request->task.reset();
+        request->finish_time = get_current_time_ns();
+        release_file_data(*request);
+        server_stats.record_completion(*request, success);
+        finish_trace(*request);
+        record_finished(*request);
+        if (success) {
+            LOG(INFO) << "[Worker] Completed "
+                      << (request->type == RequestType::PUT ? "PUT" : "GET")
+                      << " " << request->filename
+                      << " (Response time: " << ns_to_ms(request->finish_time - request->arrival_time)
+                      << " ms)";
+        }
+        close(request->client_id);
+        release_request(shard, move(request));
+    } else if (request->task->wait() == TaskWait::SLICE) {
+        server_stats.record_enqueue();
+        trace_event(*request, TracePhase::ENQUEUE);
+        shard.scheduler->add_request(move(request));
+    } else if (request->task->wait() == TaskWait::BUDGET) {
+        Shard* owner = &shard;
+        size_t size = put_reservation(*request);
+        shard.store.ingest().wait_for_room(size, [owner, request]() {
+            server_stats.record_enqueue();
+            trace_event(*request, TracePhase::ENQUEUE);
+            owner->scheduler->add_request(request);
+        });
+    } else {
+        bool writable = request->task->wait() == TaskWait::WRITABLE;
+        shard.waiter->park(move(request), writable);
+    }
+}
+
+// Drops a request whose client has disconnected, without doing its work.
+void cancel_request(Shard& shard, shared_ptr<Request> request) {
+    server_stats.record_cancelled(request->start_time != 0);
+    LOG(DEBUG) << "[Worker] Cancelled " << request->filename << ": client disconnected";
+    release_file_data(*request);
+    finish_trace(*request);
+    close(request->client_id);
+    release_request(shard, move(request));
+}
 
-        if (rr_sched) {
+void worker_thread(Shard& shard, int worker_id) {
+    set_trace_thread_name("worker-" + to_string(worker_id));
+    auto* adaptive = dynamic_cast<AdaptiveScheduler*>(shard.scheduler.get());
+    while (true) {
+        auto request = shard.scheduler->get_next_request();
+        if (!request) {
+            break;
+        }
+        server_stats.record_dequeue();
+        long long busy_start = get_current_time_ns();
+        shard.workers->begin_request(request->start_time == 0 ? busy_start - request->arrival_time : 0);
+
+        int quantum_ms = shard.scheduler->quantum_ms();
+
+        // A coroutine PUT already receiving holds ingest budget in its frame;
+        // it is resumed to fail on the closed socket and release it.
+        bool receiving = request->task && request->type == RequestType::PUT;
+        if (!receiving && peer_closed(request->client_id)) {
+            cancel_request(shard, move(request));
+        } else if (coroutine_mode) {
+            run_task_slice(shard, move(request), quantum_ms * 1'000'000LL);
+        } else if (quantum_ms > 0 || request->start_time != 0) {
+            // A request already started in slices finishes that way, even
+            // if an adaptive scheduler has since stopped preempting.
             if (request->start_time == 0) {
                 request->start_time = get_current_time_ns();
             }
 
-            bool is_complete = process_request_chunk_timed(request);
+            trace_event(*request, TracePhase::SLICE_START);
+            SliceResult result = process_request_chunk_timed(request, quantum_ms);
+            trace_event(*request, TracePhase::SLICE_END);
 
-            if (is_complete) {
+            if (result != SliceResult::MORE) {
                 request->finish_time = get_current_time_ns();
-                {
-                    lock_guard<mutex> lock(metrics_mutex);
-                    completed_requests.push_back(*request);
+                release_file_data(*request);
+                server_stats.record_completion(*request, result == SliceResult::DONE);
+                finish_trace(*request);
+                record_finished(*request);
+                if (result == SliceResult::DONE) {
+                    LOG(INFO) << "[Worker] Completed (RR) " << request->filename;
                 }
-                cout << "[Worker] Completed (RR) " << request->filename << endl;
                 close(request->client_id);
+                release_request(shard, move(request));
             } else {
-                rr_sched->requeue_request(request);
+                server_stats.record_enqueue();
+                trace_event(*request, TracePhase::ENQUEUE);
+                shard.scheduler->add_request(move(request));
             }
 
         } else {
             int client_sock = request->client_id;
             process_request(request, client_sock);
+            release_request(shard, move(request));
         }
+        long long busy_ns = get_current_time_ns() - busy_start;
+        server_stats.record_worker_busy(worker_id, busy_ns);
+        if (adaptive) {
+            adaptive->record_busy(busy_ns);
+        }
+        shard.workers->end_request();
+    }
+
+}
+
+// Accepts one connection and reads its request. Returns null when there is
+// nothing to queue: the accept failed, the request was malformed, or it was
+// STATS, which is answered right here.
+shared_ptr<Request> accept_request(int server_sock, Shard& home) {
+    struct sockaddr_in client_addr;
+    socklen_t client_len = sizeof(client_addr);
+
+    int client_sock = accept(server_sock, (struct sockaddr*)&client_addr, &client_len);
+    if (client_sock < 0 || shutdown_requested) {
+        return nullptr;
+    }
+
+    LOG(DEBUG) << "[Server] Accepted connection from "
+               << inet_ntoa(client_addr.sin_addr);
+
+    auto request = home.pool.acquire();
+    request->arrival_time = get_current_time_ns();
+    request->shard = home.id;
+    request->pool_shard = home.id;
+    server_stats.record_accept();
+    maybe_start_trace(*request);
+    trace_event(*request, TracePhase::ACCEPT);
+
+    if (!parse_request(client_sock, *request)) {
+        LOG(WARN) << "[Server] Failed to parse request";
+        send_line(client_sock, PROTOCOL_ERROR + " Malformed request");
+        close(client_sock);
+        server_stats.record_rejected();
+        home.pool.release(move(request));
+        return nullptr;
+    }
+    trace_event(*request, TracePhase::PARSE_END);
+
+    if (request->type == RequestType::STATS) {
+        handle_stats(client_sock);
+        close(client_sock);
+        server_stats.record_control();
+        home.pool.release(move(request));
+        return nullptr;
     }
 
+    request->client_id = client_sock;
+    request->shard = owner_shard(request->filename).id;
+    return request;
 }
 
-void acceptor_thread(int server_sock) {
+// Runs on the owning shard's acceptor, so only that shard's threads ever
+// touch its store and scheduler.
+void enqueue_request(Shard& shard, shared_ptr<Request> request) {
+    if (request->watch) {
+        // Not a job: the hub keeps the connection and the request is done.
+        shard.watch_hub->add(request->client_id, *request);
+        server_stats.record_watch_accepted();
+        release_request(shard, move(request));
+        return;
+    }
+    if (request->type == RequestType::GET) {
+        size_t size = 0;
+        request->file_data = shard.store.lookup(request->filename, request->version,
+                                                size, request->spill_fd, request->response);
+        request->file_size = request->file_data || request->spill_fd >= 0 ? size : 0;
+    }
+    server_stats.record_enqueue();
+    trace_event(*request, TracePhase::ENQUEUE);
+    shard.scheduler->add_request(move(request));
+}
+
+void acceptor_thread(int server_sock, int acceptor_id) {
+    set_trace_thread_name("acceptor-" + to_string(acceptor_id));
+    Shard& shard = *shards[0];
     while (!shutdown_requested) {
-        struct sockaddr_in client_addr;
-        socklen_t client_len = sizeof(client_addr);
+        auto request = accept_request(server_sock, shard);
+        if (request) {
+            enqueue_request(shard, move(request));
+        }
+    }
 
-        int client_sock = accept(server_sock, (struct sockaddr*)&client_addr, &client_len);
+    LOG(INFO) << "[Server] Acceptor thread " << acceptor_id << " exiting";
+}
 
-    if (shutdown_requested) {
-            break;
+// Sharded mode: serves the shard's own listener and the requests other
+// shards forwarded to its inbox.
+void shard_acceptor_thread(int server_sock, Shard& shard) {
+    set_trace_thread_name("acceptor-" + to_string(shard.id));
+    struct pollfd fds[2] = {{server_sock, POLLIN, 0}, {shard.wake_fd, POLLIN, 0}};
+    shared_ptr<Request> forwarded;
+    while (!shutdown_requested) {
+        if (poll(fds, 2, -1) < 0) {
+            continue;
+        }
+        if (fds[1].revents & POLLIN) {
+            uint64_t count;
+            ssize_t ignored = read(shard.wake_fd, &count, sizeof(count));
+            (void)ignored;
+        }
+        while (shard.inbox.pop(forwarded)) {
+            enqueue_request(shard, move(forwarded));
+        }
+        if (!(fds[0].revents & POLLIN) || shutdown_requested) {
+            continue;
         }
 
-        if (client_sock < 0) {
+        shared_ptr<Request> recycled;
+        while (shard.returned.pop(recycled)) {
+            shard.pool.release(move(recycled));
+        }
+        auto request = accept_request(server_sock, shard);
+        if (!request) {
             continue;
         }
+        Shard& owner = shard_of(*request);
+        if (&owner == &shard) {
+            enqueue_request(shard, move(request));
+        } else {
+            owner.inbox.push(move(request));
+            wake_shard(owner);
+        }
+    }
 
-        cout << "[Server] Accepted connection from "
-                  << inet_ntoa(client_addr.sin_addr) << endl;
+    while (shard.inbox.pop(forwarded)) {
+        close(forwarded->client_id);
+    }
+    LOG(INFO) << "[Server] Acceptor thread " << shard.id << " exiting";
+}
 
-        auto request = make_shared<Request>();
-        request->arrival_time = get_current_time_ns();
+// With more than one acceptor every socket sets SO_REUSEPORT, and the kernel
+// spreads incoming connections across them.
+int open_listen_socket(const Config& config, bool reuse_port) {
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0) {
+        return -1;
+    }
 
-        if (!parse_request(client_sock, *request)) {
-            cerr << "[Server] Failed to parse request" << endl;
-            send_line(client_sock, PROTOCOL_ERROR + " Malformed request");
-            close(client_sock);
-            continue;
-        }
+    int opt_val = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &opt_val, sizeof(opt_val));
+    if (reuse_port && setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &opt_val, sizeof(opt_val)) < 0) {
+        close(sock);
+        return -1;
+    }
 
-        request->client_id = client_sock;
+    struct sockaddr_in server_addr;
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(config.server_port);
+    inet_pton(AF_INET, config.server_ip.c_str(), &server_addr.sin_addr);
 
-        if (request->type == RequestType::GET) {
-            vector<string> lines;
-            if (retrieve_file(request->filename, lines)) {
-                request->file_size = get_file_size(lines);
-                request->file_lines = lines;
-            } else {
-                request->file_size = 0;
+    if (::bind(sock, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0 ||
+        listen(sock, 100) < 0) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+void pin_thread(pthread_t t, const vector<int>& cpus, int index, const char* role) {
+    if (cpus.empty()) {
+        return;
+    }
+    int cpu = cpus[index % cpus.size()];
+    if (!pin_thread_to_cpu(t, cpu)) {
+        LOG(WARN) << "[Server] Cannot pin " << role << " " << index << " to CPU " << cpu;
+    }
+}
+
+void stats_thread() {
+    uint64_t prev_completed = server_stats.completed();
+    long long prev_time = get_current_time_ns();
+
+    unique_lock<mutex> lock(stats_thread_mutex);
+    while (!shutdown_requested) {
+        stats_thread_cv.wait_for(lock, chrono::seconds(stats_interval_s));
+        if (shutdown_requested) {
+            break;
+        }
+        long long now = get_current_time_ns();
+        LOG(INFO) << server_stats.summary_line(prev_completed, now - prev_time);
+        prev_completed = server_stats.completed();
+        prev_time = now;
+    }
+}
+
+// Resizes every shard's pool as its load asks, keeping the decisions for
+// pool.csv.
+void pool_thread() {
+    unique_lock<mutex> lock(stats_thread_mutex);
+    while (!shutdown_requested) {
+        stats_thread_cv.wait_for(lock, POOL_TICK);
+        if (shutdown_requested) {
+            break;
+        }
+        lock.unlock();
+        int active = 0;
+        for (const auto& shard : shards) {
+            PoolDecision decision;
+            if (shard->workers->adjust(decision)) {
+                server_stats.record_pool_resize(decision.to > decision.from);
+                LOG(INFO) << "[Pool] Shard " << shard->id << ": " << decision.from << " -> "
+                          << decision.to << " workers (" << decision.reason << ", peak wait "
+                          << decision.peak_wait_ms << " ms, peak busy " << decision.peak_busy
+                          << ", queued " << decision.queued << ")";
+                if (auto* adaptive = dynamic_cast<AdaptiveScheduler*>(shard->scheduler.get())) {
+                    adaptive->set_workers(decision.to);
+                }
+                lock_guard<mutex> log_lock(pool_log_mutex);
+                pool_log.emplace_back(shard->id, decision);
             }
+            active += shard->workers->size();
         }
-        scheduler->add_request(request);
+        server_stats.set_active_workers(active);
+        lock.lock();
+    }
+}
+
+void save_pool_log(const string& filename) {
+    ofstream file(filename);
+    if (!file.is_open()) {
+        LOG(ERROR) << "Error: Cannot create pool log";
+        return;
+    }
+    file << "time_ns,shard,from_workers,to_workers,reason,peak_wait_ms,peak_busy,queued\n";
+    lock_guard<mutex> lock(pool_log_mutex);
+    for (const auto& [shard_id, decision] : pool_log) {
+        file << decision.time_ns << "," << shard_id << "," << decision.from << ","
+             << decision.to << "," << decision.reason << "," << decision.peak_wait_ms << ","
+             << decision.peak_busy << "," << decision.queued << "\n";
     }
+    LOG(INFO) << "[Server] Saved pool decisions to " << filename;
+}
 
-    cout << "[Server] Acceptor thread exiting" << endl;
+void save_policy_log(const string& filename) {
+    ofstream file(filename);
+    if (!file.is_open()) {
+        LOG(ERROR) << "Error: Cannot create policy log";
+        return;
+    }
+    file << "time_ns,shard,from,to,reason,queued,arrival_rate,size_cv,utilization,predicted_queue\n";
+    for (const auto& shard : shards) {
+        auto* adaptive = dynamic_cast<AdaptiveScheduler*>(shard->scheduler.get());
+        if (!adaptive) {
+            continue;
+        }
+        for (const PolicySwitch& change : adaptive->switches()) {
+            file << change.time_ns << "," << shard->id << "," << policy_name(change.from) << ","
+                 << policy_name(change.to) << "," << change.reason << "," << change.queued << ","
+                 << change.arrival_rate << "," << change.size_cv << "," << change.utilization << ","
+                 << change.predicted_queue << "\n";
+        }
+    }
+    LOG(INFO) << "[Server] Saved policy switches to " << filename;
 }
 
 void save_metrics(const string& filename) {
     ofstream file(filename);
     if (!file.is_open()) {
-        cerr << "Error: Cannot create metrics file" << endl;
+        LOG(ERROR) << "Error: Cannot create metrics file";
         return;
     }
 
     file << "request_type,filename,file_size,arrival_time_ns,start_time_ns,finish_time_ns,"
          << "response_time_ms,waiting_time_ms\n";
 
-    lock_guard<mutex> lock(metrics_mutex);
-    for (const auto& req : completed_requests) {
-        double response_time = ns_to_ms(req.finish_time - req.arrival_time);
-        double waiting_time = ns_to_ms(req.start_time - req.arrival_time);
-        file << (req.type == RequestType::PUT ? "PUT" : "GET") << ","
-             << req.filename << ","
-             << req.file_size << ","
-             << req.arrival_time << ","
-             << req.start_time << ","
-             << req.finish_time << ","
-             << response_time << ","
-             << waiting_time << "\n";
+    for (const auto& shard : shards) {
+        lock_guard<mutex> lock(shard->metrics_mutex);
+        for (const auto& req : shard->completed) {
+            double response_time = ns_to_ms(req.finish_time - req.arrival_time);
+            double waiting_time = ns_to_ms(req.start_time - req.arrival_time);
+            file << (req.type == RequestType::PUT ? "PUT" : "GET") << ","
+                 << req.filename << ","
+                 << req.file_size << ","
+                 << req.arrival_time << ","
+                 << req.start_time << ","
+                 << req.finish_time << ","
+                 << response_time << ","
+                 << waiting_time << "\n";
+        }
     }
 
     file.close();
-    cout << "[Server] Saved metrics to " << filename << endl;
+    LOG(INFO) << "[Server] Saved metrics to " << filename;
 }
 
 void print_usage(const char* prog_name) {
     cout << "Usage: " << prog_name << " [options]\n"
               << "Options:\n"
-              << "  --sched <policy>    Scheduling policy (fcfs, sjf, rr) [required]\n"
-              << "  --quantum <Q>       Time quantum for RR (required if --sched rr)\n"
+              << "  --sched <policy>    Scheduling policy (fcfs, sjf, rr, adaptive) [required]\n"
+              << "  --quantum <Q>       Time quantum for RR (required if --sched rr, default 10 for adaptive)\n"
               << "  --file <path>       Input file or directory [required]\n"
               << "  --p <N>             Packetization parameter (lines per packet) [required]\n"
+              << "  --stats-interval <S> Seconds between stats summary lines, 0 disables (default: 5)\n"
+              << "  --log-level <L>     debug, info, warn, error or off (default: info)\n"
+              << "  --trace <path>      Write a Chrome/Perfetto trace of sampled requests on shutdown\n"
+              << "  --trace-sample <N>  Trace one in every N requests (default: 1)\n"
+              << "  --max-upload-mb <N> Largest PUT accepted, in MiB (default: 256)\n"
+              << "  --ingest-budget-mb <N> MiB of PUT bodies received at once before uploads wait (default: 1024)\n"
+              << "  --compress-level <N> zlib level for GETs that accept it, 0 disables (default: 6)\n"
+              << "  --memory-budget-mb <N> MiB of file data kept in memory, 0 for no limit (default: 0)\n"
+              << "  --spill-dir <path>  Where files over the memory budget are kept (default: spill);\n"
+              << "                      must be empty or an earlier spill directory\n"
+              << "  --coroutines        Run GET/PUT handlers as coroutines that yield between slices\n"
               << "  --help              Show this help message\n";
 }
 
 int main(int argc, char* argv[]) {
     signal(SIGINT, signal_handler);
     signal(SIGTERM, signal_handler);
+    // A client that disconnects mid-response must fail the send, not kill
+    // the server.
+    signal(SIGPIPE, SIG_IGN);
 
     string sched_policy_str;
     int quantum = 0;
     string file_path;
+    string trace_path;
+    int trace_sample = 1;
+    long max_upload_mb = 256;
+    long ingest_budget_mb = 1024;
+    int compress_level = DEFAULT_COMPRESSION_LEVEL;
+    long memory_budget_mb = 0;
+    string spill_dir = "spill";
 
     static struct option long_options[] = {
         {"sched", required_argument, 0, 's'},
         {"quantum", required_argument, 0, 'q'},
         {"file", required_argument, 0, 'f'},
         {"p", required_argument, 0, 'p'},
+        {"stats-interval", required_argument, 0, 'i'},
+        {"log-level", required_argument, 0, 'l'},
+        {"trace", required_argument, 0, 't'},
+        {"trace-sample", required_argument, 0, 'T'},
+        {"max-upload-mb", required_argument, 0, 'u'},
+        {"ingest-budget-mb", required_argument, 0, 'b'},
+        {"compress-level", required_argument, 0, 'z'},
+        {"memory-budget-mb", required_argument, 0, 'm'},
+        {"spill-dir", required_argument, 0, 'd'},
+        {"coroutines", no_argument, 0, 'C'},
         {"help", no_argument, 0, 'h'},
         {0, 0, 0, 0}
     };
 
     int opt;
-    while ((opt = getopt_long(argc, argv, "s:q:f:p:h", long_options, nullptr)) != -1) {
+    while ((opt = getopt_long(argc, argv, "s:q:f:p:i:l:t:T:u:b:z:m:d:Ch", long_options, nullptr)) != -1) {
         switch (opt) {
             case 's':
                 sched_policy_str = optarg;
@@ -314,6 +1079,41 @@ int main(int argc, char* argv[]) {
             case 'p':
                 packet_size = atoi(optarg);
                 break;
+            case 'i':
+                stats_interval_s = atoi(optarg);
+                break;
+            case 't':
+                trace_path = optarg;
+                break;
+            case 'T':
+                trace_sample = atoi(optarg);
+                break;
+            case 'u':
+                max_upload_mb = atol(optarg);
+                break;
+            case 'b':
+                ingest_budget_mb = atol(optarg);
+                break;
+            case 'z':
+                compress_level = atoi(optarg);
+                break;
+            case 'm':
+                memory_budget_mb = atol(optarg);
+                break;
+            case 'd':
+                spill_dir = optarg;
+                break;
+            case 'C':
+                coroutine_mode = true;
+                break;
+            case 'l':
+                try {
+                    set_log_level(parse_log_level(optarg));
+                } catch (const exception& e) {
+                    cerr << "Error: " << e.what() << endl;
+                    return 1;
+                }
+                break;
             case 'h':
                 print_usage(argv[0]);
                 return 0;
@@ -329,6 +1129,18 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
+    if (max_upload_mb <= 0 || ingest_budget_mb < max_upload_mb) {
+        cerr << "Error: --max-upload-mb must be positive and no larger than --ingest-budget-mb\n";
+        return 1;
+    }
+    if (compress_level < 0 || compress_level > 9) {
+        cerr << "Error: --compress-level must be between 0 (off) and 9\n";
+        return 1;
+    }
+    if (memory_budget_mb < 0) {
+        cerr << "Error: --memory-budget-mb must not be negative\n";
+        return 1;
+    }
     SchedulingPolicy policy;
     try {
         policy = parse_policy(sched_policy_str);
@@ -341,6 +1153,9 @@ int main(int argc, char* argv[]) {
         cerr << "Error: --quantum required for Round Robin scheduling\n";
         return 1;
     }
+    if (policy == SchedulingPolicy::ADAPTIVE && quantum <= 0) {
+        quantum = DEFAULT_ADAPTIVE_QUANTUM;
+    }
 
     Config config;
     try {
@@ -354,82 +1169,243 @@ int main(int argc, char* argv[]) {
               << "IP: " << config.server_ip << "\n"
               << "Port: " << config.server_port << "\n"
               << "Worker threads: " << config.server_threads << "\n"
+              << "Acceptor threads: " << (config.shards > 1 ? config.shards : config.acceptor_threads) << "\n"
+              << "Shards: " << config.shards << "\n"
               << "Scheduling policy: " << sched_policy_str << "\n";
 
-    if (policy == SchedulingPolicy::RR) {
+    if (policy == SchedulingPolicy::RR || policy == SchedulingPolicy::ADAPTIVE) {
         cout << "Quantum: " << quantum << "\n";
     }
+    if (coroutine_mode) {
+        cout << "Execution: coroutines\n";
+    }
 
-    cout << "Packetization: " << packet_size << " lines/packet\n"<<"===========================\n"<< endl;
-    if (is_directory(file_path)) {
-        vector<string> files;
-        if (list_files(file_path, files)) {
-            for (const auto& file : files) {
-                vector<string> lines;
-                if (read_file_lines(file, lines)) {
-                    store_file(get_filename(file), lines);
-                }
+    cout << "Packetization: " << packet_size << " lines/packet\n"
+         << "Upload limit: " << max_upload_mb << " MiB, ingest budget: " << ingest_budget_mb << " MiB\n"
+         << "Compression level: " << compress_level << "\n"<<"===========================\n"<< endl;
+
+    // Shards split the memory and ingest budgets evenly and spill into their
+    // own subdirectories.
+    int shard_count = config.shards;
+    size_t memory_budget = static_cast<size_t>(memory_budget_mb) << 20;
+    size_t max_upload = static_cast<size_t>(max_upload_mb) << 20;
+    size_t ingest_budget = static_cast<size_t>(ingest_budget_mb) << 20;
+    if (shard_count > 1 && memory_budget > 0 && mkdir(spill_dir.c_str(), 0700) != 0 && errno != EEXIST) {
+        cerr << "Error: Cannot use spill directory " << spill_dir << "\n";
+        return 1;
+    }
+    shards.reserve(shard_count);
+    for (int i = 0; i < shard_count; ++i) {
+        auto shard = make_unique<Shard>();
+        shard->id = i;
+        string shard_spill_dir = shard_count > 1 ? spill_dir + "/shard-" + to_string(i) : spill_dir;
+        if (!shard->store.set_memory_budget(memory_budget / shard_count, shard_spill_dir)) {
+            cerr << "Error: Cannot use spill directory " << shard_spill_dir
+                 << " (it must be empty or an earlier spill directory)\n";
+            return 1;
+        }
+        shard->store.set_compression_level(compress_level);
+        shard->store.ingest().set_limits(max_upload, max(ingest_budget / shard_count, max_upload));
+        shard->scheduler = create_scheduler(policy, quantum);
+        if (auto* adaptive = dynamic_cast<AdaptiveScheduler*>(shard->scheduler.get())) {
+            adaptive->set_switch_listener([i](const PolicySwitch& change) {
+                LOG(INFO) << "[Scheduler] Shard " << i << ": " << policy_name(change.from) << " -> "
+                          << policy_name(change.to) << " (" << change.reason << ", queued "
+                          << change.queued << ", " << change.arrival_rate << " req/s, size cv "
+                          << change.size_cv << ", utilization " << change.utilization
+                          << ", predicted queue " << change.predicted_queue << ")";
+            });
+        }
+        if (coroutine_mode) {
+            Shard* owner = shard.get();
+            shard->waiter = make_unique<IoWaiter>([owner](shared_ptr<Request> request) {
+                server_stats.record_enqueue();
+                trace_event(*request, TracePhase::ENQUEUE);
+                owner->scheduler->add_request(move(request));
+            });
+            if (!shard->waiter->start()) {
+                cerr << "Error: Cannot start the socket waiter" << endl;
+                return 1;
             }
         }
-    } else {
-        vector<string> lines;
-        if (read_file_lines(file_path, lines)) {
-            store_file(get_filename(file_path), lines);
+        shard->watch_hub = make_unique<WatchHub>(shard->store, server_stats);
+        if (!shard->watch_hub->start()) {
+            cerr << "Error: Cannot start the watch hub" << endl;
+            return 1;
         }
+        WatchHub* hub = shard->watch_hub.get();
+        shard->store.set_change_listener(
+            [hub](const string& filename, const FileVersion& version, const FileData& data,
+                  uint64_t extended) { hub->notify(filename, version, data, extended); });
+        if (shard_count > 1) {
+            shard->wake_fd = eventfd(0, EFD_CLOEXEC);
+            if (shard->wake_fd < 0) {
+                cerr << "Error: Cannot create shard eventfd" << endl;
+                return 1;
+            }
+        }
+        shards.push_back(move(shard));
     }
 
-    scheduler = create_scheduler(policy, quantum);
-    int server_sock = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_sock < 0) {
-        cerr << "Error: Cannot create socket" << endl;
-        return 1;
+    vector<string> files;
+    if (is_directory(file_path)) {
+        list_files(file_path, files);
+    } else {
+        files.push_back(file_path);
+    }
+    for (const auto& file : files) {
+        string data;
+        if (read_file_data(file, data)) {
+            uint64_t hash = content_hash(data);
+            store_file(get_filename(file), make_file_data(move(data)), hash);
+        }
     }
-    global_server_sock = server_sock;
 
-    int opt_val = 1;
-    setsockopt(server_sock, SOL_SOCKET, SO_REUSEADDR, &opt_val, sizeof(opt_val));
+    if (!trace_path.empty()) {
+        if (trace_sample <= 0) {
+            cerr << "Error: --trace-sample must be positive\n";
+            return 1;
+        }
+        configure_tracing(trace_sample);
+    }
 
-    struct sockaddr_in server_addr;
-    memset(&server_addr, 0, sizeof(server_addr));
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(config.server_port);
-    inet_pton(AF_INET, config.server_ip.c_str(), &server_addr.sin_addr);
+    int listeners = shard_count > 1 ? shard_count : config.acceptor_threads;
+    global_server_socks.reserve(listeners);
+    for (int i = 0; i < listeners; ++i) {
+        int server_sock = open_listen_socket(config, listeners > 1);
+        if (server_sock < 0) {
+            cerr << "Error: Cannot listen on " << config.server_ip << ":" << config.server_port << endl;
+            for (int sock : global_server_socks) {
+                close(sock);
+            }
+            return 1;
+        }
+        global_server_socks.push_back(server_sock);
+    }
 
-    if (::bind(server_sock, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
-        cerr << "Error: Cannot bind socket" << endl;
-        close(server_sock);
-        return 1;
+    start_logger();
+    LOG(INFO) << "[Server] Listening on " << config.server_ip
+              << ":" << config.server_port << " with " << listeners << " acceptor(s), "
+              << shard_count << " shard(s)";
+    // Worker i belongs to shard i % shard_count, and each shard's pool gets
+    // an even share of the thread counts. Without pool_max_threads the pools
+    // stay at their starting size.
+    bool elastic = config.pool_max_threads > 0;
+    int max_workers = elastic ? config.pool_max_threads : config.server_threads;
+    int min_workers = elastic ? config.pool_min_threads : config.server_threads;
+    auto share = [shard_count](int total, int shard) {
+        return total / shard_count + (shard < total % shard_count ? 1 : 0);
+    };
+    server_stats.set_worker_count(max_workers);
+    for (int s = 0; s < shard_count; ++s) {
+        Shard& shard = *shards[s];
+        PoolLimits limits;
+        limits.min_workers = share(min_workers, s);
+        limits.max_workers = share(max_workers, s);
+        limits.target_wait_ns = config.pool_target_wait_ms * 1'000'000LL;
+        limits.idle_ns = config.pool_idle_ms * 1'000'000LL;
+        vector<int> ids;
+        for (int k = 0; k < limits.max_workers; ++k) {
+            ids.push_back(s + k * shard_count);
+        }
+        shard.workers = make_unique<WorkerPool>(*shard.scheduler, limits, ids, [&shard, &config](int id) {
+            pin_thread(pthread_self(), config.worker_cpus, id, "worker");
+            worker_thread(shard, id);
+        });
+        shard.workers->start(share(config.server_threads, s));
+        if (auto* adaptive = dynamic_cast<AdaptiveScheduler*>(shard.scheduler.get())) {
+            adaptive->set_workers(shard.workers->size());
+        }
+    }
+    server_stats.set_active_workers(config.server_threads);
+    thread pool;
+    if (elastic) {
+        pool = thread(pool_thread);
+    }
+    vector<thread> acceptors;
+    for (int i = 0; i < listeners; ++i) {
+        if (shard_count > 1) {
+            acceptors.emplace_back(shard_acceptor_thread, global_server_socks[i], ref(*shards[i]));
+        } else {
+            acceptors.emplace_back(acceptor_thread, global_server_socks[i], i);
+        }
+        pin_thread(acceptors.back().native_handle(), config.acceptor_cpus, i, "acceptor");
     }
 
-    if (listen(server_sock, 100) < 0) {
-        cerr << "Error: Cannot listen on socket" << endl;
-        close(server_sock);
-        return 1;
+    thread metrics_listener;
+    if (config.metrics_port > 0) {
+        global_metrics_sock = open_metrics_socket(config.server_ip, config.metrics_port);
+        if (global_metrics_sock < 0) {
+            LOG(ERROR) << "[Server] Cannot open metrics port " << config.metrics_port;
+        } else {
+            LOG(INFO) << "[Server] Metrics on http://" << config.server_ip << ":"
+                      << config.metrics_port << "/metrics";
+            vector<const Scheduler*> schedulers;
+            vector<const FileStore*> stores;
+            for (const auto& shard : shards) {
+                schedulers.push_back(shard->scheduler.get());
+                stores.push_back(&shard->store);
+            }
+            metrics_listener = thread(metrics_listener_thread, global_metrics_sock,
+                                      cref(server_stats), schedulers, stores);
+        }
+    }
+    thread stats;
+    if (stats_interval_s > 0) {
+        stats = thread(stats_thread);
     }
 
-    cout << "[Server] Listening on " << config.server_ip
-              << ":" << config.server_port << endl;
-    vector<thread> workers;
-    for (int i = 0; i < config.server_threads; ++i) {
-        workers.emplace_back(worker_thread);
+    LOG(INFO) << "[Server] Press Ctrl+C to stop...";
+    for (auto& acceptor : acceptors) {
+        acceptor.join();
     }
-    thread acceptor(acceptor_thread, server_sock);
 
-    cout << "[Server] Press Ctrl+C to stop...\n" << endl;
-    acceptor.join();
+    {
+        lock_guard<mutex> lock(stats_thread_mutex);
+        stats_thread_cv.notify_all();
+    }
+    if (stats.joinable()) {
+        stats.join();
+    }
+    if (pool.joinable()) {
+        pool.join();
+    }
+    if (metrics_listener.joinable()) {
+        metrics_listener.join();
+    }
+    if (global_metrics_sock >= 0) {
+        close(global_metrics_sock);
+    }
 
-    cout << "[Server] Waiting for workers to finish..." << endl;
-    for (auto& worker : workers) {
-        if (worker.joinable()) {
-            worker.join();
-        }
+    LOG(INFO) << "[Server] Waiting for workers to finish...";
+    for (const auto& shard : shards) {
+        shard->workers->join();
+    }
+    for (int server_sock : global_server_socks) {
+        close(server_sock);
     }
-    if (global_server_sock >= 0) {
-        close(global_server_sock);
+    for (const auto& shard : shards) {
+        shard->watch_hub->stop();
+        if (shard->waiter) {
+            shard->waiter->stop();
+        }
+        if (shard->wake_fd >= 0) {
+            close(shard->wake_fd);
+        }
     }
 
-    cout << "[Server] Saving metrics..." << endl;
+    LOG(INFO) << "[Server] Saving metrics...";
     save_metrics("metrics.csv");
-    cout << "[Server] Shutdown complete" << endl;
+    if (elastic) {
+        save_pool_log("pool.csv");
+    }
+    if (policy == SchedulingPolicy::ADAPTIVE) {
+        save_policy_log("policy.csv");
+    }
+    if (!trace_path.empty() && write_chrome_trace(trace_path)) {
+        LOG(INFO) << "[Server] Saved trace to " << trace_path;
+    }
+    LOG(INFO) << "[Server] Shutdown complete";
+    stop_logger();
     return 0;
 }
\ No newline at end of file
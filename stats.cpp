@@ -0,0 +1,372 @@
+#include "stats.h"
+#include "utils.h"
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+
+using namespace std;
+
+SizeClass size_class_of(size_t file_size) {
+    if (file_size < 4 * 1024) return SizeClass::SMALL;
+    if (file_size < 64 * 1024) return SizeClass::MEDIUM;
+    if (file_size < 512 * 1024) return SizeClass::LARGE;
+    return SizeClass::XLARGE;
+}
+
+const char* size_class_name(SizeClass cls) {
+    switch (cls) {
+        case SizeClass::SMALL: return "small";
+        case SizeClass::MEDIUM: return "medium";
+        case SizeClass::LARGE: return "large";
+        case SizeClass::XLARGE: return "xlarge";
+    }
+    return "unknown";
+}
+
+void HistogramSnapshot::merge(const HistogramSnapshot& other) {
+    if (counts.size() < other.counts.size()) {
+        counts.resize(other.counts.size(), 0);
+    }
+    for (size_t i = 0; i < other.counts.size(); ++i) {
+        counts[i] += other.counts[i];
+    }
+    total_count += other.total_count;
+    sum += other.sum;
+    if (other.max > max) {
+        max = other.max;
+    }
+}
+
+uint64_t HistogramSnapshot::percentile(double p) const {
+    if (total_count == 0) {
+        return 0;
+    }
+    uint64_t target = static_cast<uint64_t>(ceil(p / 100.0 * total_count));
+    if (target == 0) {
+        target = 1;
+    }
+    uint64_t seen = 0;
+    for (size_t i = 0; i < counts.size(); ++i) {
+        seen += counts[i];
+        if (seen >= target) {
+            return min(LatencyHistogram::bucket_upper_bound(static_cast<int>(i)), max);
+        }
+    }
+    return max;
+}
+
+double HistogramSnapshot::mean() const {
+    return total_count == 0 ? 0.0 : static_cast<double>(sum) / total_count;
+}
+
+LatencyHistogram::LatencyHistogram() : total_count(0), sum(0), max(0) {
+    for (auto& c : counts) {
+        c.store(0, memory_order_relaxed);
+    }
+}
+
+int LatencyHistogram::bucket_index(uint64_t value) {
+    if (value < static_cast<uint64_t>(SUB_BUCKET_COUNT)) {
+        return static_cast<int>(value);
+    }
+    int msb = 63 - __builtin_clzll(value);
+    if (msb >= MAX_VALUE_BITS) {
+        return BUCKET_COUNT - 1;
+    }
+    int shift = msb - SUB_BUCKET_BITS;
+    int sub = static_cast<int>(value >> shift) - SUB_BUCKET_COUNT;
+    return (shift + 1) * SUB_BUCKET_COUNT + sub;
+}
+
+uint64_t LatencyHistogram::bucket_upper_bound(int index) {
+    if (index < SUB_BUCKET_COUNT) {
+        return static_cast<uint64_t>(index);
+    }
+    int shift = index / SUB_BUCKET_COUNT - 1;
+    uint64_t sub = static_cast<uint64_t>(index % SUB_BUCKET_COUNT) + SUB_BUCKET_COUNT;
+    return (sub << shift) + (1ULL << shift) - 1;
+}
+
+void LatencyHistogram::record(uint64_t value) {
+    counts[bucket_index(value)].fetch_add(1, memory_order_relaxed);
+    total_count.fetch_add(1, memory_order_relaxed);
+    sum.fetch_add(value, memory_order_relaxed);
+
+    uint64_t current = max.load(memory_order_relaxed);
+    while (value > current &&
+           !max.compare_exchange_weak(current, value, memory_order_relaxed)) {
+    }
+}
+
+HistogramSnapshot LatencyHistogram::snapshot() const {
+    HistogramSnapshot snap;
+    snap.counts.resize(BUCKET_COUNT);
+    for (int i = 0; i < BUCKET_COUNT; ++i) {
+        snap.counts[i] = counts[i].load(memory_order_relaxed);
+    }
+    snap.total_count = total_count.load(memory_order_relaxed);
+    snap.sum = sum.load(memory_order_relaxed);
+    snap.max = max.load(memory_order_relaxed);
+    return snap;
+}
+
+unique_lock<mutex> timed_lock(mutex& m, LockStats& stats) {
+    unique_lock<mutex> lock(m, try_to_lock);
+    if (!lock.owns_lock()) {
+        long long wait_start = get_current_time_ns();
+        lock.lock();
+        stats.contended.fetch_add(1, memory_order_relaxed);
+        stats.wait_ns.fetch_add(get_current_time_ns() - wait_start, memory_order_relaxed);
+    }
+    stats.acquisitions.fetch_add(1, memory_order_relaxed);
+    return lock;
+}
+
+ServerStats::ServerStats()
+    : queue_depth_gauge(0), in_flight_gauge(0), accepted_count(0),
+      completed_count(0), failed_count(0), rejected_count(0), control_count(0),
+      bytes_in_count(0), bytes_out_count(0), dedup_hit_count(0), dedup_saved_count(0),
+      not_modified_count(0), not_modified_saved_count(0), filtered_count(0), filtered_saved_count(0),
+      watchers_gauge(0), watch_push_count(0), watch_count(0),
+      worker_count_gauge(0), active_workers_gauge(0), pool_grow_count(0), pool_shrink_count(0),
+      start_time_ns(get_current_time_ns()) {
+    for (auto& per_type : outcome_count) {
+        for (auto& c : per_type) {
+            c.store(0, memory_order_relaxed);
+        }
+    }
+    for (auto& busy : worker_busy) {
+        busy.store(0, memory_order_relaxed);
+    }
+    for (auto& c : cancelled_count) {
+        c.store(0, memory_order_relaxed);
+    }
+}
+
+int ServerStats::type_index(RequestType type) {
+    return type == RequestType::PUT ? 0 : 1;
+}
+
+int ServerStats::counted_type_index(RequestType type) {
+    switch (type) {
+        case RequestType::PUT: return 0;
+        case RequestType::GET: return 1;
+        default: return 2;
+    }
+}
+
+void ServerStats::record_bytes_in(uint64_t bytes) {
+    bytes_in_count.fetch_add(bytes, memory_order_relaxed);
+}
+
+void ServerStats::record_bytes_out(uint64_t bytes) {
+    bytes_out_count.fetch_add(bytes, memory_order_relaxed);
+}
+
+void ServerStats::set_worker_count(int count) {
+    worker_count_gauge.store(min(count, MAX_TRACKED_WORKERS), memory_order_relaxed);
+}
+
+void ServerStats::set_active_workers(int count) {
+    active_workers_gauge.store(count, memory_order_relaxed);
+}
+
+void ServerStats::record_pool_resize(bool grew) {
+    (grew ? pool_grow_count : pool_shrink_count).fetch_add(1, memory_order_relaxed);
+}
+
+void ServerStats::record_dedup(uint64_t bytes_saved) {
+    dedup_hit_count.fetch_add(1, memory_order_relaxed);
+    dedup_saved_count.fetch_add(bytes_saved, memory_order_relaxed);
+}
+
+void ServerStats::record_not_modified(uint64_t bytes_saved) {
+    not_modified_count.fetch_add(1, memory_order_relaxed);
+    not_modified_saved_count.fetch_add(bytes_saved, memory_order_relaxed);
+}
+
+void ServerStats::record_filtered(uint64_t bytes_scanned, uint64_t bytes_sent) {
+    filtered_count.fetch_add(1, memory_order_relaxed);
+    filtered_saved_count.fetch_add(bytes_scanned - bytes_sent, memory_order_relaxed);
+}
+
+void ServerStats::record_watch_accepted() {
+    watch_count.fetch_add(1, memory_order_relaxed);
+    in_flight_gauge.fetch_sub(1, memory_order_relaxed);
+}
+
+void ServerStats::record_watch_start() {
+    watchers_gauge.fetch_add(1, memory_order_relaxed);
+}
+
+void ServerStats::record_watch_end() {
+    watchers_gauge.fetch_sub(1, memory_order_relaxed);
+}
+
+void ServerStats::record_watch_push() {
+    watch_push_count.fetch_add(1, memory_order_relaxed);
+}
+
+void ServerStats::record_worker_busy(int worker_id, uint64_t busy_ns) {
+    if (worker_id >= 0 && worker_id < MAX_TRACKED_WORKERS) {
+        worker_busy[worker_id].fetch_add(busy_ns, memory_order_relaxed);
+    }
+}
+
+uint64_t ServerStats::worker_busy_ns(int worker_id) const {
+    if (worker_id < 0 || worker_id >= MAX_TRACKED_WORKERS) {
+        return 0;
+    }
+    return worker_busy[worker_id].load(memory_order_relaxed);
+}
+
+uint64_t ServerStats::requests(RequestType type, bool success) const {
+    return outcome_count[counted_type_index(type)][success ? 0 : 1].load(memory_order_relaxed);
+}
+
+double ServerStats::uptime_seconds() const {
+    return (get_current_time_ns() - start_time_ns) / 1e9;
+}
+
+void ServerStats::record_accept() {
+    accepted_count.fetch_add(1, memory_order_relaxed);
+    in_flight_gauge.fetch_add(1, memory_order_relaxed);
+}
+
+void ServerStats::record_enqueue() {
+    queue_depth_gauge.fetch_add(1, memory_order_relaxed);
+}
+
+void ServerStats::record_dequeue() {
+    queue_depth_gauge.fetch_sub(1, memory_order_relaxed);
+}
+
+void ServerStats::record_rejected() {
+    rejected_count.fetch_add(1, memory_order_relaxed);
+    in_flight_gauge.fetch_sub(1, memory_order_relaxed);
+}
+
+void ServerStats::record_cancelled(bool started) {
+    cancelled_count[started ? 1 : 0].fetch_add(1, memory_order_relaxed);
+    in_flight_gauge.fetch_sub(1, memory_order_relaxed);
+}
+
+void ServerStats::record_control() {
+    control_count.fetch_add(1, memory_order_relaxed);
+    outcome_count[counted_type_index(RequestType::STATS)][0].fetch_add(1, memory_order_relaxed);
+    in_flight_gauge.fetch_sub(1, memory_order_relaxed);
+}
+
+void ServerStats::record_completion(const Request& request, bool success) {
+    in_flight_gauge.fetch_sub(1, memory_order_relaxed);
+    outcome_count[counted_type_index(request.type)][success ? 0 : 1].fetch_add(1, memory_order_relaxed);
+    if (!success) {
+        failed_count.fetch_add(1, memory_order_relaxed);
+        return;
+    }
+    completed_count.fetch_add(1, memory_order_relaxed);
+
+    int t = type_index(request.type);
+    int c = static_cast<int>(size_class_of(request.file_size));
+    response_hist[t][c].record(request.finish_time - request.arrival_time);
+    waiting_hist[t][c].record(request.start_time - request.arrival_time);
+}
+
+HistogramSnapshot ServerStats::response_histogram(RequestType type, SizeClass cls) const {
+    return response_hist[type_index(type)][static_cast<int>(cls)].snapshot();
+}
+
+HistogramSnapshot ServerStats::waiting_histogram(RequestType type, SizeClass cls) const {
+    return waiting_hist[type_index(type)][static_cast<int>(cls)].snapshot();
+}
+
+static string format_histogram(const string& label, const HistogramSnapshot& snap) {
+    ostringstream oss;
+    oss << fixed << setprecision(3)
+        << label
+        << " count=" << snap.total_count
+        << " mean=" << ns_to_ms(static_cast<long long>(snap.mean()))
+        << " p50=" << ns_to_ms(snap.percentile(50))
+        << " p90=" << ns_to_ms(snap.percentile(90))
+        << " p99=" << ns_to_ms(snap.percentile(99))
+        << " p999=" << ns_to_ms(snap.percentile(99.9))
+        << " max=" << ns_to_ms(snap.max);
+    return oss.str();
+}
+
+vector<string> ServerStats::report_lines() const {
+    vector<string> lines;
+    long long uptime_ns = get_current_time_ns() - start_time_ns;
+    uint64_t done = completed();
+
+    ostringstream oss;
+    oss << fixed << setprecision(3) << "uptime_s " << uptime_ns / 1e9;
+    lines.push_back(oss.str());
+    lines.push_back("accepted " + to_string(accepted_count.load(memory_order_relaxed)));
+    lines.push_back("completed " + to_string(done));
+    lines.push_back("failed " + to_string(failed()));
+    lines.push_back("rejected " + to_string(rejected_count.load(memory_order_relaxed)));
+    lines.push_back("cancelled_queued " + to_string(cancelled(false)));
+    lines.push_back("cancelled_started " + to_string(cancelled(true)));
+    lines.push_back("control " + to_string(control_count.load(memory_order_relaxed)));
+    lines.push_back("in_flight " + to_string(in_flight()));
+    lines.push_back("queue_depth " + to_string(queue_depth()));
+    lines.push_back("workers " + to_string(active_workers()));
+    lines.push_back("pool_grows " + to_string(pool_grows()));
+    lines.push_back("pool_shrinks " + to_string(pool_shrinks()));
+    lines.push_back("bytes_in " + to_string(bytes_in()));
+    lines.push_back("bytes_out " + to_string(bytes_out()));
+    lines.push_back("dedup_hits " + to_string(dedup_hits()));
+    lines.push_back("dedup_bytes_saved " + to_string(dedup_bytes_saved()));
+    lines.push_back("not_modified " + to_string(not_modified()));
+    lines.push_back("not_modified_bytes_saved " + to_string(not_modified_bytes_saved()));
+    lines.push_back("filtered_gets " + to_string(filtered()));
+    lines.push_back("filtered_bytes_saved " + to_string(filtered_bytes_saved()));
+    lines.push_back("watches " + to_string(watches()));
+    lines.push_back("watchers " + to_string(watchers()));
+    lines.push_back("watch_pushes " + to_string(watch_pushes()));
+
+    oss.str("");
+    oss << "throughput_rps " << (uptime_ns > 0 ? done / (uptime_ns / 1e9) : 0.0);
+    lines.push_back(oss.str());
+
+    const RequestType types[] = {RequestType::PUT, RequestType::GET};
+    for (RequestType type : types) {
+        const string type_name = type == RequestType::PUT ? "PUT" : "GET";
+        for (int c = 0; c < NUM_SIZE_CLASSES; ++c) {
+            SizeClass cls = static_cast<SizeClass>(c);
+            string suffix = type_name + " " + size_class_name(cls);
+            lines.push_back(format_histogram("response_ms " + suffix, response_histogram(type, cls)));
+            lines.push_back(format_histogram("waiting_ms " + suffix, waiting_histogram(type, cls)));
+        }
+    }
+    return lines;
+}
+
+string ServerStats::summary_line(uint64_t prev_completed, long long interval_ns) const {
+    uint64_t done = completed();
+    double rps = interval_ns > 0 ? (done - prev_completed) / (interval_ns / 1e9) : 0.0;
+
+    ostringstream oss;
+    oss << fixed << setprecision(1)
+        << "[Stats] rps=" << rps
+        << " completed=" << done
+        << " failed=" << failed()
+        << " cancelled=" << cancelled(false) + cancelled(true)
+        << " in_flight=" << in_flight()
+        << " queue=" << queue_depth()
+        << " workers=" << active_workers();
+
+    const RequestType types[] = {RequestType::PUT, RequestType::GET};
+    oss << setprecision(3);
+    for (RequestType type : types) {
+        HistogramSnapshot merged;
+        for (int c = 0; c < NUM_SIZE_CLASSES; ++c) {
+            merged.merge(response_histogram(type, static_cast<SizeClass>(c)));
+        }
+        oss << " " << (type == RequestType::PUT ? "PUT" : "GET")
+            << " p50=" << ns_to_ms(merged.percentile(50))
+            << "ms p99=" << ns_to_ms(merged.percentile(99)) << "ms";
+    }
+    return oss.str();
+}
@@ -0,0 +1,174 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "protocol.h"
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+enum class SizeClass {
+    SMALL,
+    MEDIUM,
+    LARGE,
+    XLARGE
+};
+
+const int NUM_SIZE_CLASSES = 4;
+const int NUM_TRACKED_TYPES = 2;
+const int NUM_COUNTED_TYPES = 3;
+const int MAX_TRACKED_WORKERS = 128;
+
+SizeClass size_class_of(size_t file_size);
+
+const char* size_class_name(SizeClass cls);
+
+struct HistogramSnapshot {
+    vector<uint64_t> counts;
+    uint64_t total_count = 0;
+    uint64_t sum = 0;
+    uint64_t max = 0;
+
+    void merge(const HistogramSnapshot& other);
+    uint64_t percentile(double p) const;
+    double mean() const;
+};
+
+// Log-linear (HDR-style) histogram of nanosecond values. Each power of two is
+// split into 2^SUB_BUCKET_BITS linear sub-buckets, giving ~3% relative error.
+// record() only touches relaxed atomics, so it is safe and cheap on any thread.
+class LatencyHistogram {
+public:
+    static const int SUB_BUCKET_BITS = 5;
+    static const int SUB_BUCKET_COUNT = 1 << SUB_BUCKET_BITS;
+    static const int MAX_VALUE_BITS = 40;
+    static const int BUCKET_COUNT = (MAX_VALUE_BITS - SUB_BUCKET_BITS + 1) * SUB_BUCKET_COUNT;
+
+    LatencyHistogram();
+
+    void record(uint64_t value);
+
+    HistogramSnapshot snapshot() const;
+
+    static int bucket_index(uint64_t value);
+    static uint64_t bucket_upper_bound(int index);
+
+private:
+    atomic<uint64_t> counts[BUCKET_COUNT];
+    atomic<uint64_t> total_count;
+    atomic<uint64_t> sum;
+    atomic<uint64_t> max;
+};
+
+struct LockStats {
+    atomic<uint64_t> acquisitions{0};
+    atomic<uint64_t> contended{0};
+    atomic<uint64_t> wait_ns{0};
+};
+
+// Acquires the mutex, charging any time spent blocked to the given stats.
+// The uncontended path is a single try_lock plus one relaxed increment.
+unique_lock<mutex> timed_lock(mutex& m, LockStats& stats);
+
+class ServerStats {
+public:
+    ServerStats();
+
+    void record_accept();
+    void record_enqueue();
+    void record_dequeue();
+    void record_completion(const Request& request, bool success);
+    void record_rejected();
+    // A request dropped because its client disconnected, before any work
+    // (started == false) or between slices.
+    void record_cancelled(bool started);
+    void record_control();
+    void record_bytes_in(uint64_t bytes);
+    void record_bytes_out(uint64_t bytes);
+    void record_dedup(uint64_t bytes_saved);
+    void record_not_modified(uint64_t bytes_saved);
+    // A GREP that scanned bytes_scanned of the file and sent bytes_sent.
+    void record_filtered(uint64_t bytes_scanned, uint64_t bytes_sent);
+    // A WATCH handed to the watch hub. It leaves in_flight without counting
+    // as a completed request of any type.
+    void record_watch_accepted();
+    void record_watch_start();
+    void record_watch_end();
+    void record_watch_push();
+    void record_worker_busy(int worker_id, uint64_t busy_ns);
+    void set_worker_count(int count);
+    void set_active_workers(int count);
+    void record_pool_resize(bool grew);
+
+    HistogramSnapshot response_histogram(RequestType type, SizeClass cls) const;
+    HistogramSnapshot waiting_histogram(RequestType type, SizeClass cls) const;
+
+    long long queue_depth() const { return queue_depth_gauge.load(memory_order_relaxed); }
+    long long in_flight() const { return in_flight_gauge.load(memory_order_relaxed); }
+    uint64_t completed() const { return completed_count.load(memory_order_relaxed); }
+    uint64_t failed() const { return failed_count.load(memory_order_relaxed); }
+    uint64_t accepted() const { return accepted_count.load(memory_order_relaxed); }
+    uint64_t rejected() const { return rejected_count.load(memory_order_relaxed); }
+    uint64_t cancelled(bool started) const { return cancelled_count[started ? 1 : 0].load(memory_order_relaxed); }
+    uint64_t bytes_in() const { return bytes_in_count.load(memory_order_relaxed); }
+    uint64_t bytes_out() const { return bytes_out_count.load(memory_order_relaxed); }
+    uint64_t dedup_hits() const { return dedup_hit_count.load(memory_order_relaxed); }
+    uint64_t dedup_bytes_saved() const { return dedup_saved_count.load(memory_order_relaxed); }
+    uint64_t not_modified() const { return not_modified_count.load(memory_order_relaxed); }
+    uint64_t not_modified_bytes_saved() const { return not_modified_saved_count.load(memory_order_relaxed); }
+    uint64_t filtered() const { return filtered_count.load(memory_order_relaxed); }
+    uint64_t filtered_bytes_saved() const { return filtered_saved_count.load(memory_order_relaxed); }
+    long long watchers() const { return watchers_gauge.load(memory_order_relaxed); }
+    uint64_t watch_pushes() const { return watch_push_count.load(memory_order_relaxed); }
+    uint64_t watches() const { return watch_count.load(memory_order_relaxed); }
+    uint64_t requests(RequestType type, bool success) const;
+    int worker_count() const { return worker_count_gauge.load(memory_order_relaxed); }
+    int active_workers() const { return active_workers_gauge.load(memory_order_relaxed); }
+    uint64_t pool_grows() const { return pool_grow_count.load(memory_order_relaxed); }
+    uint64_t pool_shrinks() const { return pool_shrink_count.load(memory_order_relaxed); }
+    uint64_t worker_busy_ns(int worker_id) const;
+    double uptime_seconds() const;
+
+    vector<string> report_lines() const;
+
+    string summary_line(uint64_t prev_completed, long long interval_ns) const;
+
+private:
+    static int type_index(RequestType type);
+    static int counted_type_index(RequestType type);
+
+    LatencyHistogram response_hist[NUM_TRACKED_TYPES][NUM_SIZE_CLASSES];
+    LatencyHistogram waiting_hist[NUM_TRACKED_TYPES][NUM_SIZE_CLASSES];
+
+    atomic<long long> queue_depth_gauge;
+    atomic<long long> in_flight_gauge;
+    atomic<uint64_t> accepted_count;
+    atomic<uint64_t> completed_count;
+    atomic<uint64_t> failed_count;
+    atomic<uint64_t> rejected_count;
+    atomic<uint64_t> cancelled_count[2];
+    atomic<uint64_t> control_count;
+    atomic<uint64_t> bytes_in_count;
+    atomic<uint64_t> bytes_out_count;
+    atomic<uint64_t> dedup_hit_count;
+    atomic<uint64_t> dedup_saved_count;
+    atomic<uint64_t> not_modified_count;
+    atomic<uint64_t> not_modified_saved_count;
+    atomic<uint64_t> filtered_count;
+    atomic<uint64_t> filtered_saved_count;
+    atomic<long long> watchers_gauge;
+    atomic<uint64_t> watch_push_count;
+    atomic<uint64_t> watch_count;
+    atomic<uint64_t> outcome_count[NUM_COUNTED_TYPES][2];
+    atomic<uint64_t> worker_busy[MAX_TRACKED_WORKERS];
+    atomic<int> worker_count_gauge;
+    atomic<int> active_workers_gauge;
+    atomic<uint64_t> pool_grow_count;
+    atomic<uint64_t> pool_shrink_count;
+    long long start_time_ns;
+};
+
+#endif
@@ -0,0 +1,782 @@
+#include "storage.h"
+#include "compression.h"
+#include "hash.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+IngestBudget::IngestBudget()
+    : max_upload(256ULL << 20), capacity(1ULL << 30), reserved(0),
+      reserved_gauge(0), waits(0), rejected(0) {}
+
+void IngestBudget::set_limits(size_t max_upload_bytes, size_t total_bytes) {
+    lock_guard<mutex> lock(budget_mutex);
+    max_upload = max_upload_bytes;
+    capacity = total_bytes;
+    budget_cv.notify_all();
+}
+
+bool IngestBudget::reserve(size_t size) {
+    unique_lock<mutex> lock(budget_mutex);
+    if (size > max_upload || size > capacity) {
+        rejected.fetch_add(1, memory_order_relaxed);
+        return false;
+    }
+    if (reserved + size > capacity) {
+        waits.fetch_add(1, memory_order_relaxed);
+        budget_cv.wait(lock, [&] { return reserved + size <= capacity; });
+    }
+    reserved += size;
+    reserved_gauge.store(reserved, memory_order_relaxed);
+    return true;
+}
+
+Reservation IngestBudget::try_reserve(size_t size) {
+    lock_guard<mutex> lock(budget_mutex);
+    if (size > max_upload || size > capacity) {
+        rejected.fetch_add(1, memory_order_relaxed);
+        return Reservation::TOO_LARGE;
+    }
+    if (reserved + size > capacity) {
+        waits.fetch_add(1, memory_order_relaxed);
+        return Reservation::FULL;
+    }
+    reserved += size;
+    reserved_gauge.store(reserved, memory_order_relaxed);
+    return Reservation::RESERVED;
+}
+
+void IngestBudget::wait_for_room(size_t size, function<void()> ready) {
+    {
+        lock_guard<mutex> lock(budget_mutex);
+        if (reserved + size > capacity) {
+            room_waiters.push_back(move(ready));
+            return;
+        }
+    }
+    ready();
+}
+
+void IngestBudget::release(size_t size) {
+    vector<function<void()>> ready;
+    {
+        lock_guard<mutex> lock(budget_mutex);
+        reserved -= min(size, reserved);
+        reserved_gauge.store(reserved, memory_order_relaxed);
+        // Every waiter retries; those that still do not fit wait again.
+        ready.swap(room_waiters);
+    }
+    budget_cv.notify_all();
+    for (auto& waiter : ready) {
+        waiter();
+    }
+}
+
+FrequencySketch::FrequencySketch() : increments(0) {
+    memset(counts, 0, sizeof(counts));
+}
+
+size_t FrequencySketch::slot(uint64_t hash, int row) const {
+    // Derive each row's index from a different 16-bit slice of one hash.
+    return ((hash >> (row * 16)) ^ (hash >> 48) * (row + 1)) % WIDTH;
+}
+
+void FrequencySketch::increment(const string& key) {
+    uint64_t hash = content_hash(key);
+    for (int row = 0; row < DEPTH; ++row) {
+        uint8_t& count = counts[row][slot(hash, row)];
+        if (count < MAX_COUNT) {
+            ++count;
+        }
+    }
+    if (++increments >= SAMPLE_FACTOR * WIDTH) {
+        for (auto& row : counts) {
+            for (auto& count : row) {
+                count >>= 1;
+            }
+        }
+        increments /= 2;
+    }
+}
+
+int FrequencySketch::estimate(const string& key) const {
+    uint64_t hash = content_hash(key);
+    int estimate = MAX_COUNT;
+    for (int row = 0; row < DEPTH; ++row) {
+        estimate = min<int>(estimate, counts[row][slot(hash, row)]);
+    }
+    return estimate;
+}
+
+static bool write_spill_file(const string& path, string_view data) {
+    static atomic<uint64_t> temp_counter(0);
+    string tmp = path + ".tmp." + to_string(temp_counter.fetch_add(1, memory_order_relaxed));
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        return false;
+    }
+    size_t written = 0;
+    while (written < data.size()) {
+        ssize_t n = write(fd, data.data() + written, data.size() - written);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        written += n;
+    }
+    bool ok = close(fd) == 0 && written == data.size() && rename(tmp.c_str(), path.c_str()) == 0;
+    if (!ok) {
+        unlink(tmp.c_str());
+    }
+    return ok;
+}
+
+static const size_t MIN_APPEND_CAPACITY = 64 << 10;
+
+// Marks a directory as one the store spills to.
+static const string SPILL_MARKER = ".fileserver-spill";
+
+static bool read_spill_file(int fd, size_t size, string& data) {
+    data.resize(size);
+    size_t got = 0;
+    while (got < size) {
+        ssize_t n = pread(fd, &data[got], size - got, got);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        got += n;
+    }
+    return true;
+}
+
+FileStore::FileStore()
+    : compression_level(DEFAULT_COMPRESSION_LEVEL), compress_builds(0), compress_hits(0),
+      dedup_links(0), dedup_shared(0), last_version(0), memory_budget(0), resident(0),
+      spilled(0), clock_hand(clock_ring.end()), resident_gauge(0), spilled_gauge(0), memory_hits(0),
+      memory_misses(0), evictions(0), admissions_rejected(0), coalesced_reads(0) {}
+
+string FileStore::spill_path(uint64_t hash) const {
+    return spill_dir + "/" + hash_to_hex(hash);
+}
+
+void FileStore::update_gauges() {
+    resident_gauge.store(resident, memory_order_relaxed);
+    spilled_gauge.store(spilled, memory_order_relaxed);
+}
+
+// New entries join the ring just behind the hand, so they are the last the
+// hand reaches. Caller holds storage_mutex.
+void FileStore::make_resident(const string& filename, StoredFile& entry, FileData data) {
+    entry.response = build_response(entry.version, data);
+    entry.data = move(data);
+    entry.referenced = false;
+    entry.ring_pos = clock_ring.insert(clock_hand, filename);
+    entry.charged = entry.size;
+    resident += entry.charged;
+}
+
+// Takes entry off the ring and drops its reply, leaving data to the caller.
+// Caller holds storage_mutex.
+void FileStore::drop_resident(StoredFile& entry) {
+    entry.response.reset();
+    if (clock_hand == entry.ring_pos) {
+        ++clock_hand;
+    }
+    clock_ring.erase(entry.ring_pos);
+    resident -= min(entry.charged, resident);
+    entry.charged = 0;
+}
+
+// Second-chance scan for the next file to evict. With advance the hand moves
+// and clears reference bits on the way; without it this only peeks. Returns
+// null if nothing can be evicted. Caller holds storage_mutex.
+FileStore::StoredFile* FileStore::clock_victim(bool advance) {
+    if (clock_ring.empty()) {
+        return nullptr;
+    }
+    auto it = clock_hand;
+    StoredFile* fallback = nullptr;
+    for (size_t step = 0; step <= 2 * clock_ring.size(); ++step) {
+        if (it == clock_ring.end()) {
+            it = clock_ring.begin();
+        }
+        StoredFile& entry = files[*it];
+        if (!entry.evicting) {
+            if (!entry.referenced) {
+                if (advance) {
+                    clock_hand = it;
+                }
+                return &entry;
+            }
+            if (advance) {
+                entry.referenced = false;
+            } else if (!fallback) {
+                fallback = &entry;
+            }
+        }
+        ++it;
+    }
+    if (advance) {
+        clock_hand = it;
+    }
+    return fallback;
+}
+
+// Swaps data in as the version of filename; on return data holds the version
+// it replaced and the result its compressed copy, both to be freed by the
+// caller after unlocking. A null data links filename to the spilled copy of
+// hash. Spill files no longer used by any name are added to unlinks. Caller
+// holds storage_mutex.
+shared_ptr<FileStore::CompressedEntry> FileStore::install(const string& filename, FileData& data,
+                                                         uint64_t hash, size_t size,
+                                                         vector<string>& unlinks,
+                                                         FileVersion& changed) {
+    shared_ptr<CompressedEntry> stale;
+    StoredFile& slot = files[filename];
+    bool is_new = slot.version.number == 0;
+    if (!is_new && slot.version.hash == hash && slot.size == size) {
+        // Same contents: keep the version, but take the bytes if only the
+        // spilled copy was held.
+        if (!slot.data && data) {
+            make_resident(filename, slot, move(data));
+            update_gauges();
+        }
+        return stale;
+    }
+
+    if (!is_new) {
+        auto ref = content_refs.find(slot.version.hash);
+        if (ref != content_refs.end() && --ref->second == 0) {
+            content_refs.erase(ref);
+            auto spill = spill_files.find(slot.version.hash);
+            if (spill != spill_files.end()) {
+                unlinks.push_back(spill_path(spill->first));
+                spilled -= min(spill->second, spilled);
+                spill_files.erase(spill);
+            }
+        }
+    }
+    if (slot.data) {
+        drop_resident(slot);
+    }
+    slot.appending.reset();
+    FileData incoming = move(data);
+    data = move(slot.data);
+    slot.size = size;
+    slot.version.number = ++last_version;
+    slot.version.hash = hash;
+    changed = slot.version;
+    ++content_refs[hash];
+    if (incoming) {
+        make_resident(filename, slot, move(incoming));
+    }
+    update_gauges();
+
+    auto it = compressed_files.find(filename);
+    if (it != compressed_files.end()) {
+        stale = move(it->second);
+        compressed_files.erase(it);
+    }
+    return stale;
+}
+
+// Evicts files until the resident bytes fit the budget. Runs on the thread
+// that pushed the store over it; spill files are written without holding
+// storage_mutex, so other workers keep running meanwhile.
+void FileStore::enforce_budget() {
+    while (true) {
+        auto lock = timed_lock(storage_mutex, storage_lock_stats);
+        if (memory_budget == 0 || resident <= memory_budget) {
+            return;
+        }
+        StoredFile* victim = clock_victim(true);
+        if (!victim) {
+            return;
+        }
+        string name = *clock_hand;
+        FileData data = victim->data;
+        uint64_t hash = victim->version.hash;
+        bool need_write = spill_files.find(hash) == spill_files.end();
+        victim->evicting = true;
+        lock.unlock();
+
+        bool written = !need_write || write_spill_file(spill_path(hash), *data);
+
+        shared_ptr<CompressedEntry> stale;
+        lock.lock();
+        if (written && need_write) {
+            if (content_refs.count(hash)) {
+                spill_files[hash] = data->size();
+                spilled += data->size();
+            } else {
+                // Every name moved on while the copy was being written.
+                lock.unlock();
+                unlink(spill_path(hash).c_str());
+                lock.lock();
+            }
+        }
+        auto it = files.find(name);
+        if (it != files.end()) {
+            it->second.evicting = false;
+        }
+        if (it != files.end() && it->second.data == data) {
+            StoredFile& entry = it->second;
+            if (written) {
+                drop_resident(entry);
+                entry.data.reset();
+                entry.appending.reset();
+                auto cit = compressed_files.find(name);
+                if (cit != compressed_files.end()) {
+                    stale = move(cit->second);
+                    compressed_files.erase(cit);
+                }
+                evictions.fetch_add(1, memory_order_relaxed);
+            }
+        }
+        update_gauges();
+        lock.unlock();
+        if (!written) {
+            return;
+        }
+        // data and stale are released here, outside the lock.
+    }
+}
+
+bool FileStore::set_memory_budget(size_t bytes, const string& dir) {
+    if (bytes > 0) {
+        if (mkdir(dir.c_str(), 0700) != 0 && errno != EEXIST) {
+            return false;
+        }
+        // Spill files from an earlier run describe a store that is gone. Only
+        // a directory that carries the marker is swept; any other must be
+        // empty, so that no file the store did not write is removed.
+        string marker = dir + "/" + SPILL_MARKER;
+        bool owned = access(marker.c_str(), F_OK) == 0;
+        DIR* d = opendir(dir.c_str());
+        if (!d) {
+            return false;
+        }
+        while (struct dirent* ent = readdir(d)) {
+            uint64_t hash;
+            string name = ent->d_name;
+            if (name == "." || name == ".." || name == SPILL_MARKER) {
+                continue;
+            }
+            if (!owned) {
+                closedir(d);
+                return false;
+            }
+            if (parse_hash_hex(name.substr(0, 16), hash) &&
+                (name.size() == 16 || name.compare(16, 5, ".tmp.") == 0)) {
+                unlink((dir + "/" + name).c_str());
+            }
+        }
+        closedir(d);
+        if (!owned) {
+            int fd = open(marker.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0600);
+            if (fd < 0) {
+                return false;
+            }
+            close(fd);
+        }
+    }
+    {
+        auto lock = timed_lock(storage_mutex, storage_lock_stats);
+        memory_budget = bytes;
+        spill_dir = dir;
+    }
+    enforce_budget();
+    return true;
+}
+
+void FileStore::publish(const string& filename, FileData data, uint64_t hash) {
+    FileData existing;
+    {
+        auto lock = timed_lock(storage_mutex, storage_lock_stats);
+        auto it = blobs.find(hash);
+        if (it != blobs.end()) {
+            existing = it->second.lock();
+        }
+    }
+    // Compare outside the lock; a hash match alone is not proof of equality.
+    if (existing && existing != data && *existing == *data) {
+        data = existing;
+        dedup_shared.fetch_add(1, memory_order_relaxed);
+    }
+
+    vector<string> unlinks;
+    auto lock = timed_lock(storage_mutex, storage_lock_stats);
+    weak_ptr<const string_view>& blob = blobs[hash];
+    if (blob.expired()) {
+        blob = data;
+    }
+    size_t size = data->size();
+    sketch.increment(filename);
+    FileData installed = data;
+    FileVersion changed;
+    shared_ptr<CompressedEntry> stale = install(filename, data, hash, size, unlinks, changed);
+    if (blobs.size() > 2 * files.size() + 16) {
+        for (auto bit = blobs.begin(); bit != blobs.end();) {
+            bit = bit->second.expired() ? blobs.erase(bit) : next(bit);
+        }
+    }
+    lock.unlock();
+    // data and stale now hold the replaced version and its compressed copy,
+    // which may be freed here outside the lock.
+    for (const string& path : unlinks) {
+        unlink(path.c_str());
+    }
+    if (changed.number != 0 && on_change) {
+        on_change(filename, changed, installed, 0);
+    }
+    enforce_budget();
+}
+
+void FileStore::publish(const string& filename, FileData data) {
+    uint64_t hash = content_hash(*data);
+    publish(filename, move(data), hash);
+}
+
+bool FileStore::link(const string& filename, uint64_t hash, size_t size) {
+    vector<string> unlinks;
+    auto lock = timed_lock(storage_mutex, storage_lock_stats);
+    auto it = blobs.find(hash);
+    FileData data = it != blobs.end() ? it->second.lock() : nullptr;
+    if (!data || data->size() != size) {
+        // The bytes may still be held in the spill directory.
+        auto spill = spill_files.find(hash);
+        if (spill == spill_files.end() || spill->second != size) {
+            return false;
+        }
+        data.reset();
+    }
+    sketch.increment(filename);
+    FileData installed = data;
+    FileVersion changed;
+    shared_ptr<CompressedEntry> stale = install(filename, data, hash, size, unlinks, changed);
+    lock.unlock();
+    for (const string& path : unlinks) {
+        unlink(path.c_str());
+    }
+    dedup_links.fetch_add(1, memory_order_relaxed);
+    if (changed.number != 0 && on_change) {
+        on_change(filename, changed, installed, 0);
+    }
+    enforce_budget();
+    return true;
+}
+
+bool FileStore::append(const string& filename, string_view lines) {
+    lock_guard<mutex> serial(append_mutex);
+    // A PUT may replace the file while the bytes are copied; start over on
+    // the new version if so.
+    for (int attempt = 0; attempt < 3; ++attempt) {
+        FileData base;
+        FileVersion seen;
+        shared_ptr<AppendBuffer> buffer;
+        {
+            auto lock = timed_lock(storage_mutex, storage_lock_stats);
+            auto it = files.find(filename);
+            if (it != files.end()) {
+                base = it->second.data;
+                seen = it->second.version;
+                buffer = it->second.appending;
+            }
+        }
+        if (seen.number != 0 && !base) {
+            FileVersion loaded;
+            base = lookup(filename, loaded);
+            if (!base) {
+                return false;
+            }
+            if (loaded.number != seen.number) {
+                continue;
+            }
+        }
+
+        size_t length = base ? base->size() : 0;
+        size_t size = length + lines.size();
+        if (!buffer || buffer->capacity < size) {
+            auto grown = make_shared<AppendBuffer>();
+            grown->capacity = max(2 * size, MIN_APPEND_CAPACITY);
+            grown->bytes = make_unique_for_overwrite<char[]>(grown->capacity);
+            if (length > 0) {
+                memcpy(grown->bytes.get(), base->data(), length);
+            }
+            grown->length = length;
+            if (buffer) {
+                grown->hasher = buffer->hasher;
+            } else if (length > 0) {
+                grown->hasher.update(base->data(), length);
+            }
+            buffer = move(grown);
+        }
+        memcpy(buffer->bytes.get() + length, lines.data(), lines.size());
+        ContentHasher hasher = buffer->hasher;
+        hasher.update(lines.data(), lines.size());
+        uint64_t hash = hasher.digest();
+        FileData data = make_file_data(buffer, string_view(buffer->bytes.get(), size));
+
+        vector<string> unlinks;
+        auto lock = timed_lock(storage_mutex, storage_lock_stats);
+        auto it = files.find(filename);
+        if ((it != files.end() ? it->second.version.number : 0) != seen.number) {
+            continue;
+        }
+        weak_ptr<const string_view>& blob = blobs[hash];
+        if (blob.expired()) {
+            blob = data;
+        }
+        sketch.increment(filename);
+        FileData installed = data;
+        FileVersion changed;
+        shared_ptr<CompressedEntry> stale = install(filename, data, hash, size, unlinks, changed);
+        StoredFile& slot = files[filename];
+        if (slot.data == installed) {
+            buffer->length = size;
+            buffer->hasher = hasher;
+            // The spare capacity is memory held for this file too.
+            resident += buffer->capacity - slot.charged;
+            slot.charged = buffer->capacity;
+            update_gauges();
+            slot.appending = move(buffer);
+        }
+        lock.unlock();
+        for (const string& path : unlinks) {
+            unlink(path.c_str());
+        }
+        if (changed.number != 0 && on_change) {
+            on_change(filename, changed, installed, seen.number);
+        }
+        enforce_budget();
+        return true;
+    }
+    return false;
+}
+
+FileData FileStore::lookup(const string& filename) {
+    FileVersion version;
+    return lookup(filename, version);
+}
+
+FileData FileStore::lookup(const string& filename, FileVersion& version) {
+    size_t size = 0;
+    int spill_fd = -1;
+    shared_ptr<const WireResponse> response;
+    FileData data = lookup(filename, version, size, spill_fd, response);
+    if (!data && spill_fd >= 0) {
+        data = load_spilled(filename, version, spill_fd, size);
+    }
+    return data;
+}
+
+FileData FileStore::lookup(const string& filename, FileVersion& version, size_t& size,
+                           int& spill_fd, shared_ptr<const WireResponse>& response) {
+    spill_fd = -1;
+    // A spill file can disappear between unlocking and open() if the file is
+    // replaced meanwhile; look again in that case.
+    for (int attempt = 0; attempt < 3; ++attempt) {
+        string path;
+        {
+            auto lock = timed_lock(storage_mutex, storage_lock_stats);
+            auto it = files.find(filename);
+            if (it == files.end()) {
+                return nullptr;
+            }
+            StoredFile& entry = it->second;
+            sketch.increment(filename);
+            version = entry.version;
+            size = entry.size;
+            if (entry.data) {
+                entry.referenced = true;
+                memory_hits.fetch_add(1, memory_order_relaxed);
+                response = entry.response;
+                return entry.data;
+            }
+            path = spill_path(entry.version.hash);
+        }
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd >= 0) {
+            memory_misses.fetch_add(1, memory_order_relaxed);
+            spill_fd = fd;
+            return nullptr;
+        }
+        if (errno != ENOENT) {
+            break;
+        }
+    }
+    return nullptr;
+}
+
+FileData FileStore::load_spilled(const string& filename, const FileVersion& version, int fd,
+                                 size_t size) {
+    // Join a read of the same bytes that is in progress, or share a buffer a
+    // GET still holds, so a burst of GETs for one cold file reads it once.
+    FileData data;
+    shared_ptr<SpillLoad> load;
+    {
+        auto lock = timed_lock(storage_mutex, storage_lock_stats);
+        auto blob = blobs.find(version.hash);
+        if (blob != blobs.end()) {
+            data = blob->second.lock();
+        }
+        if (!data || data->size() != size) {
+            data.reset();
+            shared_ptr<SpillLoad>& slot = spill_loads[version.hash];
+            if (!slot) {
+                slot = make_shared<SpillLoad>();
+            }
+            load = slot;
+        }
+    }
+    if (load) {
+        bool read_here = false;
+        call_once(load->done, [&] {
+            string loaded;
+            if (read_spill_file(fd, size, loaded)) {
+                load->data = make_file_data(move(loaded));
+            }
+            read_here = true;
+        });
+        data = load->data;
+        if (!read_here && !data) {
+            // The shared read failed; try this request's own descriptor.
+            string loaded;
+            if (read_spill_file(fd, size, loaded)) {
+                data = make_file_data(move(loaded));
+            }
+        }
+        if (!read_here && data) {
+            coalesced_reads.fetch_add(1, memory_order_relaxed);
+        }
+    } else {
+        coalesced_reads.fetch_add(1, memory_order_relaxed);
+    }
+    close(fd);
+
+    bool admitted = false;
+    {
+        auto lock = timed_lock(storage_mutex, storage_lock_stats);
+        auto pending = spill_loads.find(version.hash);
+        if (load && pending != spill_loads.end() && pending->second == load) {
+            spill_loads.erase(pending);
+        }
+        if (!data) {
+            return nullptr;
+        }
+        weak_ptr<const string_view>& blob = blobs[version.hash];
+        if (blob.expired()) {
+            blob = data;
+        }
+        auto it = files.find(filename);
+        if (it == files.end() || it->second.version.hash != version.hash) {
+            return data;
+        }
+        StoredFile& entry = it->second;
+        if (entry.data) {
+            // Another GET read it back first.
+            return entry.data;
+        }
+        admitted = memory_budget == 0 || resident + size <= memory_budget;
+        if (!admitted) {
+            StoredFile* victim = clock_victim(false);
+            admitted = !victim ||
+                       sketch.estimate(filename) > sketch.estimate(*victim->ring_pos);
+        }
+        if (admitted) {
+            make_resident(filename, entry, data);
+            entry.referenced = true;
+            update_gauges();
+        } else {
+            admissions_rejected.fetch_add(1, memory_order_relaxed);
+        }
+    }
+    if (admitted) {
+        enforce_budget();
+    }
+    return data;
+}
+
+size_t FileStore::file_count() {
+    auto lock = timed_lock(storage_mutex, storage_lock_stats);
+    return files.size();
+}
+
+bool FileStore::peek(const string& filename, FileVersion& version, FileData& data) {
+    auto lock = timed_lock(storage_mutex, storage_lock_stats);
+    auto it = files.find(filename);
+    if (it == files.end()) {
+        return false;
+    }
+    version = it->second.version;
+    data = it->second.data;
+    return true;
+}
+
+void FileStore::set_change_listener(
+    function<void(const string&, const FileVersion&, const FileData&, uint64_t)> listener) {
+    on_change = move(listener);
+}
+
+shared_ptr<const WireResponse> FileStore::response(const string& filename, const FileData& data,
+                                                   const FileVersion& version) {
+    {
+        auto lock = timed_lock(storage_mutex, storage_lock_stats);
+        auto it = files.find(filename);
+        if (it != files.end() && it->second.data == data && it->second.response) {
+            return it->second.response;
+        }
+    }
+    return build_response(version, data);
+}
+
+shared_ptr<const WireResponse> FileStore::compressed(const string& filename, const FileData& data,
+                                                     const FileVersion& version) {
+    if (!data || compression_level <= 0 || data->size() < MIN_COMPRESS_SIZE) {
+        return nullptr;
+    }
+
+    shared_ptr<CompressedEntry> entry;
+    {
+        auto lock = timed_lock(storage_mutex, storage_lock_stats);
+        auto it = files.find(filename);
+        if (it != files.end() && it->second.data == data) {
+            auto& slot = compressed_files[filename];
+            if (!slot) {
+                slot = make_shared<CompressedEntry>();
+            }
+            entry = slot;
+        }
+    }
+    if (!entry) {
+        // The caller holds a version that has since been replaced; encode it
+        // once for this request rather than caching it.
+        entry = make_shared<CompressedEntry>();
+    }
+
+    bool built_here = false;
+    call_once(entry->built, [&] {
+        string out;
+        if (compress_data(*data, out, compression_level) && out.size() < data->size()) {
+            entry->response = build_response(version, make_file_data(move(out)), true, data->size());
+        }
+        built_here = true;
+    });
+    if (built_here) {
+        compress_builds.fetch_add(1, memory_order_relaxed);
+    } else {
+        compress_hits.fetch_add(1, memory_order_relaxed);
+    }
+    return entry->response;
+}
@@ -0,0 +1,284 @@
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include "hash.h"
+#include "stats.h"
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Outcome of IngestBudget::try_reserve().
+enum class Reservation {
+    RESERVED,
+    FULL,
+    TOO_LARGE
+};
+
+// Caps memory held by PUT bodies that are still being received. A PUT
+// reserves its whole size before reading the body; while the budget is
+// exhausted its socket is simply not read, so TCP pushes back on the client
+// instead of the server buffering.
+class IngestBudget {
+private:
+    mutex budget_mutex;
+    condition_variable budget_cv;
+    vector<function<void()>> room_waiters;
+    size_t max_upload;
+    size_t capacity;
+    size_t reserved;
+    atomic<uint64_t> reserved_gauge;
+    atomic<uint64_t> waits;
+    atomic<uint64_t> rejected;
+
+public:
+    IngestBudget();
+
+    void set_limits(size_t max_upload_bytes, size_t total_bytes);
+
+    // Blocks until size bytes are free. Returns false, without waiting, for an
+    // upload larger than the per-connection limit or the whole budget.
+    bool reserve(size_t size);
+
+    // reserve() for a coroutine, which must not wait on the condition
+    // variable: the budget it waits for is held by suspended uploads that
+    // need a worker to finish.
+    Reservation try_reserve(size_t size);
+
+    // Calls ready once size bytes may be free: at once if they are, otherwise
+    // from the release() that frees room. ready must not call back into the
+    // budget while it runs.
+    void wait_for_room(size_t size, function<void()> ready);
+
+    void release(size_t size);
+
+    size_t max_upload_bytes() const { return max_upload; }
+    size_t capacity_bytes() const { return capacity; }
+    uint64_t bytes_in_flight() const { return reserved_gauge.load(memory_order_relaxed); }
+    uint64_t wait_count() const { return waits.load(memory_order_relaxed); }
+    uint64_t rejected_count() const { return rejected.load(memory_order_relaxed); }
+};
+
+// Approximate access counts for TinyLFU admission: a count-min sketch of
+// 4-bit-range counters that are all halved every SAMPLE_FACTOR * WIDTH
+// increments, so old popularity fades. Not thread-safe.
+class FrequencySketch {
+public:
+    static const int DEPTH = 4;
+    static const int WIDTH = 4096;
+    static const int SAMPLE_FACTOR = 10;
+    static const uint8_t MAX_COUNT = 15;
+
+    FrequencySketch();
+
+    void increment(const string& key);
+
+    int estimate(const string& key) const;
+
+private:
+    size_t slot(uint64_t hash, int row) const;
+
+    uint8_t counts[DEPTH][WIDTH];
+    int increments;
+};
+
+class FileStore {
+private:
+    // zlib reply for one stored version, built by whichever GET asks first.
+    struct CompressedEntry {
+        once_flag built;
+        shared_ptr<const WireResponse> response;
+    };
+
+    // One read of a spilled version, shared by every GET that wants it while
+    // it runs.
+    struct SpillLoad {
+        once_flag done;
+        FileData data;
+    };
+
+    // Backing buffer of a file grown by APPEND, with room to spare. Bytes are
+    // only ever written past length, so every FileData viewing a prefix of it
+    // stays valid and unchanged. hasher has seen bytes [0, length).
+    struct AppendBuffer {
+        unique_ptr<char[]> bytes;
+        size_t capacity = 0;
+        size_t length = 0;
+        ContentHasher hasher;
+    };
+
+    // data is null while the file is spilled; its bytes are then in the
+    // spill directory under the version hash. response is the plain GET
+    // reply, built whenever data becomes resident. appending is set while
+    // data is the whole of an append buffer's bytes. charged is what the
+    // file counts against the memory budget: size, or with an append buffer
+    // its whole capacity.
+    struct StoredFile {
+        FileData data;
+        shared_ptr<const WireResponse> response;
+        shared_ptr<AppendBuffer> appending;
+        FileVersion version;
+        size_t size = 0;
+        size_t charged = 0;
+        bool referenced = false;
+        bool evicting = false;
+        list<string>::iterator ring_pos;
+    };
+
+    map<string, StoredFile> files;
+    map<string, shared_ptr<CompressedEntry>> compressed_files;
+    // Content index: hash to the buffer holding those bytes. Entries do not
+    // keep a buffer alive; it lives as long as some file (or GET) uses it.
+    map<uint64_t, weak_ptr<const string_view>> blobs;
+    mutex storage_mutex;
+    LockStats storage_lock_stats;
+    // Serializes append(); held without storage_mutex while bytes are copied.
+    mutex append_mutex;
+    IngestBudget ingest_budget;
+    int compression_level;
+    atomic<uint64_t> compress_builds;
+    atomic<uint64_t> compress_hits;
+    atomic<uint64_t> dedup_links;
+    atomic<uint64_t> dedup_shared;
+    uint64_t last_version;
+
+    // Memory tier. Resident files sit on a CLOCK ring; evicting one writes
+    // its bytes to <spill_dir>/<hash> once and drops the buffer. A spill file
+    // is shared by every name with that content and kept until none is left,
+    // so a file read back and evicted again costs no second write.
+    size_t memory_budget;
+    string spill_dir;
+    size_t resident;
+    size_t spilled;
+    list<string> clock_ring;
+    list<string>::iterator clock_hand;
+    map<uint64_t, int> content_refs;
+    map<uint64_t, size_t> spill_files;
+    map<uint64_t, shared_ptr<SpillLoad>> spill_loads;
+    FrequencySketch sketch;
+    atomic<uint64_t> resident_gauge;
+    atomic<uint64_t> spilled_gauge;
+    atomic<uint64_t> memory_hits;
+    atomic<uint64_t> memory_misses;
+    atomic<uint64_t> evictions;
+    atomic<uint64_t> admissions_rejected;
+    atomic<uint64_t> coalesced_reads;
+    function<void(const string&, const FileVersion&, const FileData&, uint64_t)> on_change;
+
+    // changed is set to the new version if the contents differ from the
+    // current ones, and left alone otherwise.
+    shared_ptr<CompressedEntry> install(const string& filename, FileData& data, uint64_t hash,
+                                        size_t size, vector<string>& unlinks, FileVersion& changed);
+    void make_resident(const string& filename, StoredFile& entry, FileData data);
+    void drop_resident(StoredFile& entry);
+    StoredFile* clock_victim(bool advance);
+    void update_gauges();
+    string spill_path(uint64_t hash) const;
+    void enforce_budget();
+
+public:
+    FileStore();
+
+    // Makes data the current version of filename in a single step, dropping
+    // the compressed copy of the version it replaces. If identical bytes are
+    // already stored, filename shares that buffer and data is freed. The
+    // version number only advances if the contents actually change.
+    void publish(const string& filename, FileData data, uint64_t hash);
+    void publish(const string& filename, FileData data);
+
+    // Points filename at stored bytes with the given hash and size without
+    // receiving them again. Returns false if no such bytes are held. With no
+    // bytes to compare, a collision on hash and size links the wrong file.
+    bool link(const string& filename, uint64_t hash, size_t size);
+
+    // Adds lines to the end of filename as a new version, creating the file
+    // if missing. Costs amortized O(lines.size()): the file's buffer doubles
+    // when full, and GETs of earlier versions keep viewing their prefix of
+    // it. Returns false if a spilled copy cannot be read back, or if the file
+    // keeps being replaced meanwhile.
+    bool append(const string& filename, string_view lines);
+
+    FileData lookup(const string& filename);
+
+    // lookup() that also returns the version of the data it found, reading a
+    // spilled file back if needed.
+    FileData lookup(const string& filename, FileVersion& version);
+
+    // Non-blocking lookup: returns the data, and its prepared GET reply in
+    // response, if it is in memory. For a spilled file it returns null and
+    // opens its copy into spill_fd, to be passed to load_spilled() later. size
+    // is set either way; -1 in spill_fd and a null result mean no such file.
+    FileData lookup(const string& filename, FileVersion& version, size_t& size, int& spill_fd,
+                    shared_ptr<const WireResponse>& response);
+
+    // Reads a spilled version of filename from fd and closes it. Concurrent
+    // calls for the same bytes share one read, and a buffer some GET still
+    // holds is reused without reading. The bytes are kept in memory only if
+    // the file is used more often than the one eviction would drop for it
+    // (TinyLFU admission), so a scan over cold files cannot push out hot
+    // ones. Returns null on a read error.
+    FileData load_spilled(const string& filename, const FileVersion& version, int fd, size_t size);
+
+    // Caps bytes of file data held in memory; 0 means no limit. Files over
+    // the budget are evicted to spill_dir, which is created if needed and
+    // marked as the store's. Returns false if spill_dir cannot be used, or
+    // is neither empty nor marked.
+    bool set_memory_budget(size_t bytes, const string& spill_dir);
+
+    // Returns the plain GET reply for data, the given version of filename:
+    // the prepared one while data is current and resident, otherwise one
+    // built for this request.
+    shared_ptr<const WireResponse> response(const string& filename, const FileData& data,
+                                            const FileVersion& version);
+
+    // Returns the GET reply with the zlib encoding of data, a version of
+    // filename, compressing it on first use and caching the result until
+    // filename is replaced. Returns null when compression is off or would not
+    // make the body smaller.
+    shared_ptr<const WireResponse> compressed(const string& filename, const FileData& data,
+                                              const FileVersion& version);
+
+    // 0 disables compression; otherwise a zlib level from 1 to 9.
+    void set_compression_level(int level) { compression_level = level; }
+    int compression_level_setting() const { return compression_level; }
+    uint64_t compress_build_count() const { return compress_builds.load(memory_order_relaxed); }
+    uint64_t compress_hit_count() const { return compress_hits.load(memory_order_relaxed); }
+    uint64_t dedup_link_count() const { return dedup_links.load(memory_order_relaxed); }
+    uint64_t dedup_shared_count() const { return dedup_shared.load(memory_order_relaxed); }
+    size_t memory_budget_bytes() const { return memory_budget; }
+    uint64_t resident_bytes() const { return resident_gauge.load(memory_order_relaxed); }
+    uint64_t spilled_bytes() const { return spilled_gauge.load(memory_order_relaxed); }
+    uint64_t memory_hit_count() const { return memory_hits.load(memory_order_relaxed); }
+    uint64_t memory_miss_count() const { return memory_misses.load(memory_order_relaxed); }
+    uint64_t eviction_count() const { return evictions.load(memory_order_relaxed); }
+    uint64_t admission_reject_count() const { return admissions_rejected.load(memory_order_relaxed); }
+    uint64_t coalesced_read_count() const { return coalesced_reads.load(memory_order_relaxed); }
+
+    size_t file_count();
+
+    // The current version of filename and its data if that is in memory,
+    // null if it is only in the spill directory. Reads nothing, and is not
+    // counted as a use of the file. Returns false if there is no such file.
+    bool peek(const string& filename, FileVersion& version, FileData& data);
+
+    // Called with each new version, after publish(), link() or append()
+    // installed it and outside the store's locks. data is null when the
+    // version is held only in the spill directory. extended is the version
+    // an append() added lines to, 0 otherwise. Set before serving.
+    void set_change_listener(
+        function<void(const string&, const FileVersion&, const FileData&, uint64_t)> listener);
+
+    IngestBudget& ingest() { return ingest_budget; }
+    const IngestBudget& ingest() const { return ingest_budget; }
+
+    const LockStats& lock_stats() const { return storage_lock_stats; }
+};
+
+#endif
@@ -0,0 +1,404 @@
+#include "swarm.h"
+#include "compression.h"
+#include "protocol.h"
+#include "utils.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <queue>
+#include <random>
+#include <thread>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+
+const size_t READ_CHUNK = 64 * 1024;
+const int MAX_EVENTS = 256;
+
+enum class ClientState {
+    THINKING,
+    CONNECTING,
+    SENDING,
+    RECEIVING
+};
+
+enum class ResponsePhase {
+    STATUS,
+    SIZE,
+    BODY,
+    TRAILER
+};
+
+enum class ParseResult {
+    MORE,
+    DONE_OK,
+    DONE_FAIL
+};
+
+// One simulated client. Only ever touched by the event loop that owns it.
+struct SimClient {
+    int fd = -1;
+    ClientState state = ClientState::THINKING;
+    int remaining = 0;
+    minstd_rand gen;
+
+    LoadOp op;
+    long long start_ns = 0;
+
+    const string* out = nullptr;
+    string get_request;
+    size_t out_offset = 0;
+
+    ResponsePhase phase = ResponsePhase::STATUS;
+    string line;
+    size_t body_expected = 0;
+    size_t body_seen = 0;
+};
+
+struct Wakeup {
+    long long at_ns;
+    size_t client;
+
+    bool operator>(const Wakeup& other) const { return at_ns > other.at_ns; }
+};
+
+struct SharedInput {
+    const SwarmSpec& spec;
+    const vector<LoadFile>& files;
+    // PUT requests pre-serialized per file: header, newline-terminated lines, END.
+    vector<string> put_wire;
+    struct sockaddr_in server_addr;
+};
+
+// Raises the descriptor limit to the hard maximum; every in-flight request
+// holds one socket, so the default 1024 is far too low.
+void raise_fd_limit() {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+}
+
+// Advances the response parser over newly received bytes. GET bodies are
+// only counted, so memory per client stays constant whatever the file size.
+ParseResult feed_response(SimClient& c, const char* data, size_t len) {
+    size_t used = 0;
+    while (used < len) {
+        if (c.phase == ResponsePhase::BODY) {
+            size_t take = min(len - used, c.body_expected - c.body_seen);
+            c.body_seen += take;
+            used += take;
+            if (c.body_seen == c.body_expected) {
+                c.phase = ResponsePhase::TRAILER;
+            }
+            continue;
+        }
+
+        char ch = data[used++];
+        if (ch != '\n') {
+            c.line += ch;
+            if (c.line.size() > 256) {
+                return ParseResult::DONE_FAIL;
+            }
+            continue;
+        }
+
+        if (c.phase == ResponsePhase::STATUS) {
+            if (c.line != PROTOCOL_OK) {
+                return ParseResult::DONE_FAIL;
+            }
+            if (c.op.is_put) {
+                return ParseResult::DONE_OK;
+            }
+            c.phase = ResponsePhase::SIZE;
+        } else if (c.phase == ResponsePhase::SIZE) {
+            if (c.line.compare(0, PROTOCOL_ENCODING.size(), PROTOCOL_ENCODING) == 0) {
+                c.line.clear();
+                continue;
+            }
+            if (sscanf(c.line.c_str(), "SIZE %zu", &c.body_expected) != 1) {
+                return ParseResult::DONE_FAIL;
+            }
+            c.body_seen = 0;
+            c.phase = c.body_expected == 0 ? ResponsePhase::TRAILER : ResponsePhase::BODY;
+        } else {
+            return c.line == PROTOCOL_END ? ParseResult::DONE_OK : ParseResult::DONE_FAIL;
+        }
+        c.line.clear();
+    }
+    return ParseResult::MORE;
+}
+
+class EventLoop {
+public:
+    EventLoop(const SharedInput& input, int loop_id, const vector<long long>& first_start_ns)
+        : input(input), clients(first_start_ns.size()) {
+        epoll_fd = epoll_create1(0);
+        for (size_t i = 0; i < clients.size(); ++i) {
+            clients[i].remaining = input.spec.requests_per_client;
+            clients[i].gen.seed(input.spec.seed * 7919u + loop_id * 104729u + static_cast<unsigned>(i));
+            timers.push({first_start_ns[i], i});
+        }
+        active = clients.size();
+    }
+
+    ~EventLoop() {
+        if (epoll_fd >= 0) {
+            close(epoll_fd);
+        }
+    }
+
+    vector<LoadResult>& run() {
+        if (epoll_fd < 0) {
+            cerr << "[Swarm] epoll_create1 failed: " << strerror(errno) << endl;
+            return results;
+        }
+
+        epoll_event events[MAX_EVENTS];
+        while (active > 0) {
+            fire_timers();
+            if (active == 0) {
+                break;
+            }
+
+            int timeout_ms = -1;
+            if (!timers.empty()) {
+                long long wait_ns = timers.top().at_ns - get_current_time_ns();
+                timeout_ms = wait_ns <= 0 ? 0 : static_cast<int>((wait_ns + 999'999) / 1'000'000);
+            }
+
+            int n = epoll_wait(epoll_fd, events, MAX_EVENTS, timeout_ms);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                cerr << "[Swarm] epoll_wait failed: " << strerror(errno) << endl;
+                break;
+            }
+            for (int i = 0; i < n; ++i) {
+                handle_event(events[i].data.u64, events[i].events);
+            }
+        }
+        return results;
+    }
+
+private:
+    const SharedInput& input;
+    vector<SimClient> clients;
+    priority_queue<Wakeup, vector<Wakeup>, greater<Wakeup>> timers;
+    vector<LoadResult> results;
+    size_t active = 0;
+    int epoll_fd = -1;
+    char read_buf[READ_CHUNK];
+
+    void fire_timers() {
+        long long now = get_current_time_ns();
+        while (!timers.empty() && timers.top().at_ns <= now) {
+            size_t idx = timers.top().client;
+            timers.pop();
+            start_request(idx);
+        }
+    }
+
+    void start_request(size_t idx) {
+        SimClient& c = clients[idx];
+        const auto& files = input.files;
+
+        size_t file_idx = uniform_int_distribution<size_t>(0, files.size() - 1)(c.gen);
+        c.op.sequence = 0;
+        c.op.is_put = bernoulli_distribution(input.spec.put_ratio)(c.gen);
+        c.op.file = &files[file_idx];
+        c.start_ns = get_current_time_ns();
+        c.op.intended_ns = c.start_ns;
+
+        if (c.op.is_put) {
+            c.out = &input.put_wire[file_idx];
+        } else {
+            c.get_request = PROTOCOL_GET + " " + get_filename(c.op.file->path) +
+                            (input.spec.compress_level > 0 ? " " + ENCODING_ZLIB : string()) + "\n";
+            c.out = &c.get_request;
+        }
+        c.out_offset = 0;
+        c.phase = ResponsePhase::STATUS;
+        c.line.clear();
+
+        c.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (c.fd < 0) {
+            finish_request(idx, false);
+            return;
+        }
+        int rc = connect(c.fd, (const struct sockaddr*)&input.server_addr, sizeof(input.server_addr));
+        if (rc < 0 && errno != EINPROGRESS) {
+            finish_request(idx, false);
+            return;
+        }
+
+        c.state = ClientState::CONNECTING;
+        epoll_event ev;
+        ev.events = EPOLLOUT;
+        ev.data.u64 = idx;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, c.fd, &ev) < 0) {
+            finish_request(idx, false);
+        }
+    }
+
+    void handle_event(size_t idx, uint32_t events) {
+        SimClient& c = clients[idx];
+        if (c.state == ClientState::CONNECTING) {
+            int err = 0;
+            socklen_t err_len = sizeof(err);
+            getsockopt(c.fd, SOL_SOCKET, SO_ERROR, &err, &err_len);
+            if (err != 0) {
+                finish_request(idx, false);
+                return;
+            }
+            c.state = ClientState::SENDING;
+        }
+
+        if (c.state == ClientState::SENDING) {
+            if (events & (EPOLLERR | EPOLLHUP)) {
+                finish_request(idx, false);
+                return;
+            }
+            while (c.out_offset < c.out->size()) {
+                ssize_t sent = send(c.fd, c.out->data() + c.out_offset,
+                                    c.out->size() - c.out_offset, MSG_NOSIGNAL);
+                if (sent < 0) {
+                    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                        return;
+                    }
+                    finish_request(idx, false);
+                    return;
+                }
+                c.out_offset += sent;
+            }
+
+            c.state = ClientState::RECEIVING;
+            epoll_event ev;
+            ev.events = EPOLLIN;
+            ev.data.u64 = idx;
+            epoll_ctl(epoll_fd, EPOLL_CTL_MOD, c.fd, &ev);
+            return;
+        }
+
+        if (c.state == ClientState::RECEIVING) {
+            while (true) {
+                ssize_t received = recv(c.fd, read_buf, sizeof(read_buf), 0);
+                if (received < 0) {
+                    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                        return;
+                    }
+                    finish_request(idx, false);
+                    return;
+                }
+                if (received == 0) {
+                    finish_request(idx, false);
+                    return;
+                }
+                ParseResult result = feed_response(c, read_buf, received);
+                if (result != ParseResult::MORE) {
+                    finish_request(idx, result == ParseResult::DONE_OK);
+                    return;
+                }
+            }
+        }
+    }
+
+    void finish_request(size_t idx, bool success) {
+        SimClient& c = clients[idx];
+        if (c.fd >= 0) {
+            close(c.fd);
+            c.fd = -1;
+        }
+        long long now = get_current_time_ns();
+        results.push_back({c.op, c.start_ns, now, success});
+
+        c.state = ClientState::THINKING;
+        if (--c.remaining > 0) {
+            timers.push({now + input.spec.think_ms * 1'000'000LL, idx});
+        } else {
+            --active;
+        }
+    }
+};
+
+}
+
+vector<LoadResult> run_swarm(const SwarmSpec& spec, const vector<LoadFile>& files) {
+    if (files.empty() || spec.clients <= 0 || spec.requests_per_client <= 0) {
+        return {};
+    }
+    raise_fd_limit();
+
+    SharedInput input{spec, files, {}, {}};
+    memset(&input.server_addr, 0, sizeof(input.server_addr));
+    input.server_addr.sin_family = AF_INET;
+    input.server_addr.sin_port = htons(spec.server_port);
+    if (inet_pton(AF_INET, spec.server_ip.c_str(), &input.server_addr.sin_addr) != 1) {
+        cerr << "[Swarm] Invalid server address: " << spec.server_ip << endl;
+        return {};
+    }
+
+    for (const auto& f : files) {
+        string body;
+        read_file_data(f.path, body);
+        string compressed;
+        string wire = PROTOCOL_PUT + " " + get_filename(f.path) + "\n";
+        if (spec.compress_level > 0 && body.size() >= MIN_COMPRESS_SIZE &&
+            compress_data(body, compressed, spec.compress_level) && compressed.size() < body.size()) {
+            wire += PROTOCOL_ENCODING + " " + ENCODING_ZLIB + " " + to_string(body.size()) + "\n";
+            body.swap(compressed);
+        }
+        wire += PROTOCOL_SIZE + " " + to_string(body.size()) + "\n";
+        wire += body;
+        wire += PROTOCOL_END + "\n";
+        input.put_wire.push_back(move(wire));
+    }
+
+    // Spread first requests over the ramp so the server's listen backlog is
+    // not hit by every client in the same millisecond.
+    int loops = max(1, min(spec.loops, spec.clients));
+    vector<vector<long long>> first_start(loops);
+    mt19937 ramp_gen(spec.seed);
+    uniform_int_distribution<long long> ramp_dist(0, max(0, spec.ramp_ms) * 1'000'000LL);
+    long long start_ns = get_current_time_ns();
+    for (int i = 0; i < spec.clients; ++i) {
+        first_start[i % loops].push_back(start_ns + ramp_dist(ramp_gen));
+    }
+
+    vector<vector<LoadResult>> per_loop(loops);
+    vector<thread> threads;
+    for (int l = 0; l < loops; ++l) {
+        threads.emplace_back([&, l]() {
+            // EventLoop carries a 64 KiB read buffer, so keep it off the stack.
+            auto loop = make_unique<EventLoop>(input, l, first_start[l]);
+            per_loop[l] = move(loop->run());
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    vector<LoadResult> results;
+    for (auto& loop_results : per_loop) {
+        move(loop_results.begin(), loop_results.end(), back_inserter(results));
+    }
+    sort(results.begin(), results.end(), [](const LoadResult& a, const LoadResult& b) {
+        return a.send_ns < b.send_ns;
+    });
+    for (size_t i = 0; i < results.size(); ++i) {
+        results[i].op.sequence = i;
+    }
+    return results;
+}
@@ -0,0 +1,35 @@
+#ifndef SWARM_H
+#define SWARM_H
+
+#include "loadgen.h"
+#include <string>
+#include <vector>
+
+using namespace std;
+
+struct SwarmSpec {
+    string server_ip;
+    int server_port;
+    int clients;
+    int loops;
+    int requests_per_client;
+    int think_ms;
+    int ramp_ms;
+    double put_ratio;
+    unsigned seed;
+    int compress_level;
+    string report_prefix;
+
+    SwarmSpec() : server_ip("127.0.0.1"), server_port(9000), clients(1000), loops(4),
+                  requests_per_client(10), think_ms(10), ramp_ms(1000), put_ratio(0.5),
+                  seed(1), compress_level(0), report_prefix("swarm") {}
+};
+
+// Simulates many closed-loop clients, each doing connect / request / response /
+// think like test mode, but multiplexed over a few epoll threads with
+// non-blocking sockets instead of one blocking thread per client. GET bodies
+// are checked against the SIZE line and discarded rather than written to disk.
+// Latency runs from the start of connect() to the last response byte.
+vector<LoadResult> run_swarm(const SwarmSpec& spec, const vector<LoadFile>& files);
+
+#endif
@@ -0,0 +1,102 @@
+#ifndef TASK_H
+#define TASK_H
+
+#include "utils.h"
+#include <coroutine>
+#include <exception>
+#include <utility>
+
+using namespace std;
+
+// Why a RequestTask last gave its thread back.
+enum class TaskWait {
+    NONE,
+    SLICE,
+    WRITABLE,
+    READABLE,
+    // A PUT waiting for ingest budget.
+    BUDGET
+};
+
+// A request handler written as a coroutine. Each resume() runs it to its next
+// suspension point: the end of the time slice, or a socket that cannot take
+// or give more bytes yet. Progress lives in the coroutine frame, so a
+// suspended request needs no resume state in Request and holds no thread.
+class RequestTask {
+public:
+    struct promise_type {
+        bool result = false;
+        TaskWait wait = TaskWait::NONE;
+        long long slice_end_ns = 0;
+
+        RequestTask get_return_object() {
+            return RequestTask(coroutine_handle<promise_type>::from_promise(*this));
+        }
+        suspend_always initial_suspend() noexcept { return {}; }
+        suspend_always final_suspend() noexcept { return {}; }
+        void return_value(bool ok) { result = ok; }
+        void unhandled_exception() { terminate(); }
+    };
+
+    RequestTask(RequestTask&& other) noexcept : coro(exchange(other.coro, nullptr)) {}
+    RequestTask(const RequestTask&) = delete;
+    RequestTask& operator=(const RequestTask&) = delete;
+    ~RequestTask() {
+        if (coro) {
+            coro.destroy();
+        }
+    }
+
+    // Runs until the next suspension. A slice_end_ns of 0 never ends the slice.
+    void resume(long long slice_end_ns) {
+        coro.promise().wait = TaskWait::NONE;
+        coro.promise().slice_end_ns = slice_end_ns;
+        coro.resume();
+    }
+
+    bool done() const { return coro.done(); }
+    bool result() const { return coro.promise().result; }
+    TaskWait wait() const { return coro.promise().wait; }
+
+private:
+    explicit RequestTask(coroutine_handle<promise_type> handle) : coro(handle) {}
+
+    coroutine_handle<promise_type> coro;
+};
+
+// co_await end_of_slice() suspends only once the slice has run out.
+struct EndOfSlice {
+    bool await_ready() const noexcept { return false; }
+    bool await_suspend(coroutine_handle<RequestTask::promise_type> handle) const {
+        RequestTask::promise_type& promise = handle.promise();
+        if (promise.slice_end_ns == 0 || get_current_time_ns() < promise.slice_end_ns) {
+            return false;
+        }
+        promise.wait = TaskWait::SLICE;
+        return true;
+    }
+    void await_resume() const noexcept {}
+};
+
+inline EndOfSlice end_of_slice() {
+    return EndOfSlice();
+}
+
+// co_await wait_for(TaskWait::WRITABLE) suspends until the worker has parked
+// the request and its socket became ready, or, for BUDGET, until ingest
+// budget was released.
+struct WaitFor {
+    TaskWait wait;
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(coroutine_handle<RequestTask::promise_type> handle) const {
+        handle.promise().wait = wait;
+    }
+    void await_resume() const noexcept {}
+};
+
+inline WaitFor wait_for(TaskWait wait) {
+    return WaitFor{wait};
+}
+
+#endif
@@ -0,0 +1,212 @@
+#include "trace.h"
+#include "protocol.h"
+#include "utils.h"
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+
+using namespace std;
+
+namespace {
+
+const size_t MAX_COLLECTED_TRACES = 100000;
+
+atomic<int> sample_interval(0);
+atomic<uint64_t> accepted_counter(0);
+atomic<uint64_t> dropped_traces(0);
+atomic<int> next_thread_index(0);
+long long trace_epoch_ns = 0;
+
+mutex collector_mutex;
+vector<shared_ptr<RequestTrace>> collected;
+map<int, string> thread_names;
+
+thread_local int local_thread_index = -1;
+
+int current_thread_index() {
+    if (local_thread_index < 0) {
+        local_thread_index = next_thread_index.fetch_add(1, memory_order_relaxed);
+    }
+    return local_thread_index;
+}
+
+const char* type_name(RequestType type) {
+    switch (type) {
+        case RequestType::PUT: return "PUT";
+        case RequestType::GET: return "GET";
+        case RequestType::STATS: return "STATS";
+        default: return "UNKNOWN";
+    }
+}
+
+string json_escape(const string& s) {
+    string out;
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            out += ' ';
+        } else {
+            out += c;
+        }
+    }
+    return out;
+}
+
+double to_trace_us(long long time_ns) {
+    return (time_ns - trace_epoch_ns) / 1000.0;
+}
+
+}
+
+void configure_tracing(int sample_every) {
+    trace_epoch_ns = get_current_time_ns();
+    sample_interval.store(sample_every > 0 ? sample_every : 0, memory_order_relaxed);
+}
+
+bool tracing_enabled() {
+    return sample_interval.load(memory_order_relaxed) > 0;
+}
+
+void set_trace_thread_name(const string& name) {
+    int index = current_thread_index();
+    lock_guard<mutex> lock(collector_mutex);
+    thread_names[index] = name;
+}
+
+void maybe_start_trace(Request& request) {
+    int interval = sample_interval.load(memory_order_relaxed);
+    if (interval <= 0) {
+        return;
+    }
+    uint64_t n = accepted_counter.fetch_add(1, memory_order_relaxed);
+    if (n % interval != 0) {
+        return;
+    }
+    request.trace = make_shared<RequestTrace>();
+    request.trace->id = n;
+    request.trace->events.reserve(8);
+}
+
+void trace_event(Request& request, TracePhase phase) {
+    if (!request.trace) {
+        return;
+    }
+    request.trace->events.push_back({phase, get_current_time_ns(), current_thread_index()});
+}
+
+void finish_trace(Request& request) {
+    if (!request.trace) {
+        return;
+    }
+    request.trace->type = request.type;
+    request.trace->filename = request.filename;
+    request.trace->file_size = request.file_size;
+
+    lock_guard<mutex> lock(collector_mutex);
+    if (collected.size() >= MAX_COLLECTED_TRACES) {
+        dropped_traces.fetch_add(1, memory_order_relaxed);
+        return;
+    }
+    collected.push_back(request.trace);
+}
+
+// Worker and acceptor lanes live in pid 1, with one complete ("X") event per
+// execution slice so RR preemptions show up as separate blocks. Each sampled
+// request also gets its own lane in pid 2 showing queueing and I/O markers.
+bool write_chrome_trace(const string& filename) {
+    ofstream file(filename);
+    if (!file.is_open()) {
+        cerr << "Error: Cannot create trace file " << filename << endl;
+        return false;
+    }
+
+    lock_guard<mutex> lock(collector_mutex);
+    file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    bool first = true;
+    auto emit = [&](const string& event) {
+        file << (first ? "" : ",\n") << event;
+        first = false;
+    };
+
+    emit("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"Server threads\"}}");
+    emit("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":2,\"tid\":0,\"args\":{\"name\":\"Sampled requests\"}}");
+    for (const auto& entry : thread_names) {
+        emit("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" + to_string(entry.first) +
+             ",\"args\":{\"name\":\"" + json_escape(entry.second) + "\"}}");
+    }
+
+    for (const auto& trace : collected) {
+        string label = string(type_name(trace->type)) + " " + json_escape(trace->filename);
+        string args = "{\"request\":" + to_string(trace->id) +
+                      ",\"file_size\":" + to_string(trace->file_size) + "}";
+        string request_tid = to_string(trace->id);
+
+        emit("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":2,\"tid\":" + request_tid +
+             ",\"args\":{\"name\":\"#" + request_tid + " " + label + "\"}}");
+
+        const TraceEvent* accept = nullptr;
+        const TraceEvent* enqueue = nullptr;
+        const TraceEvent* slice_start = nullptr;
+        int slice = 0;
+
+        for (const auto& ev : trace->events) {
+            string ts = to_string(to_trace_us(ev.time_ns));
+            switch (ev.phase) {
+                case TracePhase::ACCEPT:
+                    accept = &ev;
+                    break;
+                case TracePhase::PARSE_END:
+                    if (accept) {
+                        emit("{\"name\":\"accept+parse " + label + "\",\"ph\":\"X\",\"pid\":1,\"tid\":" +
+                             to_string(ev.thread_index) + ",\"ts\":" + to_string(to_trace_us(accept->time_ns)) +
+                             ",\"dur\":" + to_string((ev.time_ns - accept->time_ns) / 1000.0) +
+                             ",\"args\":" + args + "}");
+                    }
+                    break;
+                case TracePhase::ENQUEUE:
+                    enqueue = &ev;
+                    break;
+                case TracePhase::SLICE_START:
+                    if (enqueue) {
+                        emit("{\"name\":\"queued\",\"ph\":\"X\",\"pid\":2,\"tid\":" + request_tid +
+                             ",\"ts\":" + to_string(to_trace_us(enqueue->time_ns)) +
+                             ",\"dur\":" + to_string((ev.time_ns - enqueue->time_ns) / 1000.0) + "}");
+                        enqueue = nullptr;
+                    }
+                    slice_start = &ev;
+                    break;
+                case TracePhase::SLICE_END:
+                    if (slice_start) {
+                        string slice_args = "{\"request\":" + request_tid + ",\"slice\":" + to_string(slice) + "}";
+                        emit("{\"name\":\"" + label + "\",\"ph\":\"X\",\"pid\":1,\"tid\":" +
+                             to_string(ev.thread_index) + ",\"ts\":" + to_string(to_trace_us(slice_start->time_ns)) +
+                             ",\"dur\":" + to_string((ev.time_ns - slice_start->time_ns) / 1000.0) +
+                             ",\"args\":" + slice_args + "}");
+                        emit("{\"name\":\"running\",\"ph\":\"X\",\"pid\":2,\"tid\":" + request_tid +
+                             ",\"ts\":" + to_string(to_trace_us(slice_start->time_ns)) +
+                             ",\"dur\":" + to_string((ev.time_ns - slice_start->time_ns) / 1000.0) +
+                             ",\"args\":" + slice_args + "}");
+                        slice_start = nullptr;
+                        ++slice;
+                    }
+                    break;
+                case TracePhase::FIRST_BYTE_OUT:
+                    emit("{\"name\":\"first byte out\",\"ph\":\"i\",\"s\":\"t\",\"pid\":2,\"tid\":" +
+                         request_tid + ",\"ts\":" + ts + "}");
+                    break;
+                case TracePhase::LAST_BYTE_OUT:
+                    emit("{\"name\":\"last byte out\",\"ph\":\"i\",\"s\":\"t\",\"pid\":2,\"tid\":" +
+                         request_tid + ",\"ts\":" + ts + "}");
+                    break;
+            }
+        }
+    }
+
+    file << "\n],\"otherData\":{\"sampled_requests\":" << collected.size()
+         << ",\"dropped_traces\":" << dropped_traces.load(memory_order_relaxed) << "}}\n";
+    return true;
+}
@@ -0,0 +1,55 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "protocol.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+enum class TracePhase {
+    ACCEPT,
+    PARSE_END,
+    ENQUEUE,
+    SLICE_START,
+    SLICE_END,
+    FIRST_BYTE_OUT,
+    LAST_BYTE_OUT
+};
+
+struct TraceEvent {
+    TracePhase phase;
+    long long time_ns;
+    int thread_index;
+};
+
+struct RequestTrace {
+    uint64_t id = 0;
+    RequestType type = RequestType::UNKNOWN;
+    string filename;
+    size_t file_size = 0;
+    vector<TraceEvent> events;
+};
+
+// Traces every sample_every-th accepted request; 0 disables tracing.
+void configure_tracing(int sample_every);
+
+bool tracing_enabled();
+
+// Names the calling thread's lane in the exported timeline.
+void set_trace_thread_name(const string& name);
+
+// Decides whether this request is sampled and, if so, attaches a trace.
+void maybe_start_trace(Request& request);
+
+void trace_event(Request& request, TracePhase phase);
+
+// Hands a finished request's trace to the collector. Only sampled requests
+// take the collector lock.
+void finish_trace(Request& request);
+
+bool write_chrome_trace(const string& filename);
+
+#endif
@@ -2,6 +2,7 @@
 #include <fstream>
 #include <sys/stat.h>
 #include <dirent.h>
+#include <sched.h>
 #include <iostream>
 
 using namespace std;
@@ -33,6 +34,24 @@ bool read_file_lines(const string& filename, vector<string>& lines) {
     return true;
 }
 
+bool read_file_data(const string& filename, string& data) {
+    ifstream file(filename, ios::binary | ios::ate);
+    if (!file.is_open()) {
+        cerr << "Error: Cannot open file " << filename << endl;
+        return false;
+    }
+
+    data.resize(static_cast<size_t>(file.tellg()));
+    file.seekg(0);
+    if (!file.read(&data[0], data.size())) {
+        return false;
+    }
+    if (!data.empty() && data.back() != '\n') {
+        data += '\n';
+    }
+    return true;
+}
+
 bool write_file_lines(const string& filename, const vector<string>& lines) {
   ofstream file(filename);
     if (!file.is_open()) {
@@ -92,4 +111,14 @@ string get_filename(const string& path) {
         return path;
     }
   return path.substr(pos + 1);
-}
\ No newline at end of file
+}
+
+bool pin_thread_to_cpu(pthread_t thread, int cpu) {
+    if (cpu < 0 || cpu >= CPU_SETSIZE) {
+        return false;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(thread, sizeof(set), &set) == 0;
+}
@@ -4,6 +4,7 @@
 #include <string>
 #include <vector>
 #include <chrono>
+#include <pthread.h>
 
 using namespace std;
 
@@ -13,6 +14,9 @@ double ns_to_ms(long long ns);
 
 bool read_file_lines(const string& filename, vector<string>& lines);
 
+// Reads a whole file into data, adding a final newline if the last line lacks one.
+bool read_file_data(const string& filename, string& data);
+
 bool write_file_lines(const string& filename, const vector<string>& lines);
 
 size_t get_file_size(const vector<string>& lines);
@@ -23,4 +27,7 @@ bool is_directory(const string& path);
 
 string get_filename(const string& path);
 
+// Restricts a thread to a single CPU. Fails if that CPU is not available.
+bool pin_thread_to_cpu(pthread_t thread, int cpu);
+
 #endif
\ No newline at end of file
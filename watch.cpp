@@ -0,0 +1,484 @@
+#include "watch.h"
+#include "hash.h"
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace std;
+
+static const string PUSH_END = PROTOCOL_END + "\n";
+
+WatchHub::WatchHub(FileStore& store, ServerStats& stats)
+    : store(store), stats(stats), epoll_fd(-1), wake_fd(-1), stop_fd(-1) {}
+
+WatchHub::~WatchHub() {
+    stop();
+}
+
+bool WatchHub::start() {
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    stop_fd = eventfd(0, EFD_CLOEXEC);
+    if (epoll_fd < 0 || wake_fd < 0 || stop_fd < 0) {
+        return false;
+    }
+    for (int fd : {wake_fd, stop_fd}) {
+        struct epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+            return false;
+        }
+    }
+    loop = thread(&WatchHub::run, this);
+    reader = thread(&WatchHub::read_spilled, this);
+    return true;
+}
+
+void WatchHub::stop() {
+    if (reader.joinable()) {
+        {
+            lock_guard<mutex> lock(load_mutex);
+            stopping = true;
+        }
+        load_cv.notify_one();
+        reader.join();
+    }
+    if (loop.joinable()) {
+        uint64_t one = 1;
+        ssize_t ignored = write(stop_fd, &one, sizeof(one));
+        (void)ignored;
+        loop.join();
+    }
+    while (!watchers.empty()) {
+        drop(watchers.begin()->first);
+    }
+    {
+        lock_guard<mutex> lock(pending_mutex);
+        for (const Joining& waiting : joining) {
+            close(waiting.fd);
+            stats.record_watch_end();
+        }
+        joining.clear();
+    }
+    for (int* fd : {&epoll_fd, &wake_fd, &stop_fd}) {
+        if (*fd >= 0) {
+            close(*fd);
+            *fd = -1;
+        }
+    }
+}
+
+void WatchHub::wake() {
+    uint64_t one = 1;
+    ssize_t ignored = write(wake_fd, &one, sizeof(one));
+    (void)ignored;
+}
+
+void WatchHub::add(int client_sock, const Request& request) {
+    {
+        lock_guard<mutex> lock(pending_mutex);
+        // Counted here, before the loop reads the current version, so that a
+        // change made in between is not missed.
+        ++watched[request.filename];
+        joining.push_back({client_sock, request.filename, request.watch_body, request.conditional,
+                           request.has_client_version, request.client_version});
+    }
+    stats.record_watch_start();
+    wake();
+}
+
+void WatchHub::notify(const string& filename, const FileVersion& version, const FileData& data,
+                      uint64_t extended) {
+    {
+        lock_guard<mutex> lock(pending_mutex);
+        if (watched.find(filename) == watched.end()) {
+            return;
+        }
+        Change& change = changes[filename];
+        if (version.number <= change.version.number) {
+            return;
+        }
+        // An APPEND to the pending version carries its run on.
+        uint64_t appended_from = extended;
+        if (extended != 0 && extended == change.version.number && change.appended_from != 0) {
+            appended_from = change.appended_from;
+        }
+        change.version = version;
+        change.data = data;
+        change.appended_from = appended_from;
+    }
+    wake();
+}
+
+void WatchHub::read_spilled() {
+    unique_lock<mutex> lock(load_mutex);
+    while (true) {
+        load_cv.wait(lock, [this] { return stopping || !loads.empty(); });
+        if (stopping) {
+            return;
+        }
+        string filename = move(loads.front());
+        loads.pop_front();
+        lock.unlock();
+        // On a read error the watchers wait for the next version.
+        FileVersion version;
+        FileData data = store.lookup(filename, version);
+        if (data) {
+            notify(filename, version, data);
+        }
+        lock.lock();
+    }
+}
+
+void WatchHub::run() {
+    struct epoll_event events[64];
+    while (true) {
+        int n = epoll_wait(epoll_fd, events, 64, -1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        for (int i = 0; i < n; ++i) {
+            int fd = events[i].data.fd;
+            if (fd == stop_fd) {
+                return;
+            }
+            if (fd == wake_fd) {
+                uint64_t count;
+                ssize_t ignored = read(wake_fd, &count, sizeof(count));
+                (void)ignored;
+                vector<Joining> joined;
+                map<string, Change> changed;
+                {
+                    lock_guard<mutex> lock(pending_mutex);
+                    joined.swap(joining);
+                    changed.swap(changes);
+                }
+                for (Joining& waiting : joined) {
+                    join(waiting);
+                }
+                for (auto& entry : changed) {
+                    apply(entry.first, entry.second);
+                }
+                continue;
+            }
+
+            auto it = watchers.find(fd);
+            if (it == watchers.end()) {
+                continue;
+            }
+            if (events[i].events & (EPOLLHUP | EPOLLERR)) {
+                drop(fd);
+                continue;
+            }
+            if (events[i].events & EPOLLIN) {
+                // A watcher has nothing more to say. End of input is only a
+                // half-close: it still gets pushes, and a closed one is
+                // found by the next send.
+                char scratch[256];
+                ssize_t got = recv(fd, scratch, sizeof(scratch), MSG_DONTWAIT);
+                if (got < 0 && errno != EAGAIN && errno != EINTR) {
+                    drop(fd);
+                    continue;
+                }
+                if (got == 0) {
+                    it->second.reading = false;
+                    arm(it->second);
+                }
+            }
+            if (events[i].events & EPOLLOUT) {
+                flush(it->second);
+            }
+        }
+    }
+}
+
+void WatchHub::join(Joining& joining) {
+    int fd = joining.fd;
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    struct epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+        close(fd);
+        stats.record_watch_end();
+        lock_guard<mutex> lock(pending_mutex);
+        if (--watched[joining.filename] == 0) {
+            watched.erase(joining.filename);
+        }
+        return;
+    }
+
+    Watcher& watcher = watchers[fd];
+    watcher.fd = fd;
+    watcher.armed = event.events;
+    watcher.filename = joining.filename;
+    watcher.body = joining.body;
+
+    Topic& topic = topics[joining.filename];
+    topic.watchers.insert(fd);
+    FileVersion current;
+    FileData data;
+    bool exists = store.peek(joining.filename, current, data);
+    if (exists && current.number > topic.version.number) {
+        advance(topic, current, data, 0);
+    }
+
+    // Without a tag, or with the current one, the client is up to date.
+    // Version numbers restart with the server, so only the hash is compared.
+    bool current_held = !joining.has_tag ||
+                        (joining.has_client_version && joining.client_version.hash == current.hash);
+    if (exists && current_held) {
+        watcher.known = current;
+        if (joining.body && data) {
+            watcher.has_sent = true;
+            watcher.sent_size = data->size();
+        }
+    }
+    auto reply = make_shared<Message>();
+    reply->head = PROTOCOL_OK + "\n" + PROTOCOL_VERSION + " " +
+                  (exists ? format_version(current) : VERSION_NONE) + "\n";
+    watcher.message = move(reply);
+    flush(watcher);
+}
+
+void WatchHub::apply(const string& filename, Change& change) {
+    auto it = topics.find(filename);
+    if (it == topics.end()) {
+        return;
+    }
+    Topic& topic = it->second;
+    uint64_t held = topic.version.number;
+    if (change.version.number < held) {
+        return;
+    }
+    if (change.version.number == held) {
+        // The reader's copy of data that was spilled.
+        if (!change.data || !topic.data.expired()) {
+            return;
+        }
+        topic.data = change.data;
+        topic.loading = 0;
+    } else {
+        // A run that began at or before the held version carries on the
+        // held version's own run.
+        uint64_t appended_from = change.appended_from;
+        if (appended_from != 0 && appended_from <= held && topic.appended_from != 0) {
+            appended_from = min(appended_from, topic.appended_from);
+        }
+        advance(topic, change.version, change.data, appended_from);
+    }
+    // flush() may drop a watcher, and the topic with the last one, so walk a
+    // copy.
+    vector<int> fds(topic.watchers.begin(), topic.watchers.end());
+    for (int fd : fds) {
+        auto wit = watchers.find(fd);
+        if (wit != watchers.end()) {
+            flush(wit->second);
+        }
+    }
+}
+
+void WatchHub::advance(Topic& topic, const FileVersion& version, const FileData& data,
+                       uint64_t appended_from) {
+    topic.version = version;
+    topic.appended_from = appended_from;
+    topic.data = data;
+    topic.notice.reset();
+    topic.full.reset();
+    topic.delta.reset();
+}
+
+bool WatchHub::extends(Topic& topic, const Watcher& watcher, const FileData& data) {
+    if (!watcher.has_sent || watcher.sent_size >= data->size()) {
+        return false;
+    }
+    // Each version in a run of APPENDs only adds lines to the one before, so
+    // that case costs no comparison. Otherwise the held version's hash must
+    // match the same number of leading bytes.
+    if (topic.appended_from != 0 && topic.appended_from <= watcher.known.number) {
+        return true;
+    }
+    return content_hash(data->data(), watcher.sent_size) == watcher.known.hash;
+}
+
+shared_ptr<const WatchHub::Message> WatchHub::message_for(Topic& topic, const Watcher& watcher) {
+    string tag = format_version(topic.version);
+    if (!watcher.body) {
+        if (!topic.notice) {
+            auto notice = make_shared<Message>();
+            notice->head = PROTOCOL_CHANGED + " " + tag + "\n";
+            topic.notice = move(notice);
+        }
+        return topic.notice;
+    }
+    FileData data = topic.data.lock();
+    if (!data) {
+        // Take the store's copy if it is still in memory. Otherwise the
+        // version is only in the spill directory: the reader loads it and
+        // apply() resumes the watcher.
+        FileVersion current;
+        if (!store.peek(watcher.filename, current, data) || current.number != topic.version.number ||
+            !data) {
+            if (topic.loading != topic.version.number) {
+                topic.loading = topic.version.number;
+                {
+                    lock_guard<mutex> lock(load_mutex);
+                    loads.push_back(watcher.filename);
+                }
+                load_cv.notify_one();
+            }
+            return nullptr;
+        }
+        topic.data = data;
+    }
+
+    shared_ptr<const Message> delta = topic.delta.lock();
+    if (delta && watcher.has_sent && watcher.sent_size == topic.delta_base &&
+        watcher.known.hash == topic.delta_hash) {
+        return delta;
+    }
+    if (extends(topic, watcher, data)) {
+        string_view added = data->substr(watcher.sent_size);
+        auto message = make_shared<Message>();
+        message->head = PROTOCOL_APPENDED + " " + tag + "\n" + PROTOCOL_SIZE + " " +
+                        to_string(added.size()) + "\n";
+        message->body = make_file_data(data, added);
+        message->size = data->size();
+        topic.delta = message;
+        topic.delta_base = watcher.sent_size;
+        topic.delta_hash = watcher.known.hash;
+        return message;
+    }
+    shared_ptr<const Message> full = topic.full.lock();
+    if (!full) {
+        auto message = make_shared<Message>();
+        message->head = PROTOCOL_CHANGED + " " + tag + "\n" + PROTOCOL_SIZE + " " +
+                        to_string(data->size()) + "\n";
+        message->body = data;
+        message->size = data->size();
+        topic.full = message;
+        full = move(message);
+    }
+    return full;
+}
+
+bool WatchHub::flush(Watcher& watcher) {
+    while (true) {
+        if (!watcher.message) {
+            Topic& topic = topics[watcher.filename];
+            if (topic.version.number <= watcher.known.number) {
+                break;
+            }
+            watcher.message = message_for(topic, watcher);
+            if (!watcher.message) {
+                break;
+            }
+            watcher.offset = 0;
+            watcher.known = topic.version;
+            if (watcher.body) {
+                watcher.has_sent = watcher.message->body != nullptr;
+                watcher.sent_size = watcher.message->size;
+            }
+            stats.record_watch_push();
+        }
+
+        const Message& message = *watcher.message;
+        size_t offset = watcher.offset;
+        struct iovec parts[3];
+        int count = 0;
+        if (offset < message.head.size()) {
+            parts[count++] = {const_cast<char*>(message.head.data() + offset),
+                              message.head.size() - offset};
+            offset = 0;
+        } else {
+            offset -= message.head.size();
+        }
+        if (message.body) {
+            string_view body = *message.body;
+            if (offset < body.size()) {
+                parts[count++] = {const_cast<char*>(body.data() + offset), body.size() - offset};
+                offset = 0;
+            } else {
+                offset -= body.size();
+            }
+            parts[count++] = {const_cast<char*>(PUSH_END.data() + offset), PUSH_END.size() - offset};
+        }
+        struct msghdr header = {};
+        header.msg_iov = parts;
+        header.msg_iovlen = count;
+        ssize_t sent = sendmsg(watcher.fd, &header, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent < 0 && errno == EAGAIN) {
+            break;
+        }
+        if (sent <= 0) {
+            drop(watcher.fd);
+            return false;
+        }
+        stats.record_bytes_out(sent);
+        watcher.offset += sent;
+        size_t total = message.head.size() + (message.body ? message.body->size() + PUSH_END.size() : 0);
+        if (watcher.offset == total) {
+            watcher.message.reset();
+        }
+    }
+
+    arm(watcher);
+    return true;
+}
+
+void WatchHub::arm(Watcher& watcher) {
+    // Wait for room only while there is something left to send, and for
+    // input until the watcher has shut down its side. EPOLLHUP and EPOLLERR
+    // are reported either way.
+    uint32_t events = 0;
+    if (watcher.reading) {
+        events |= EPOLLIN;
+    }
+    if (watcher.message) {
+        events |= EPOLLOUT;
+    }
+    if (events != watcher.armed) {
+        struct epoll_event event = {};
+        event.events = events;
+        event.data.fd = watcher.fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, watcher.fd, &event);
+        watcher.armed = events;
+    }
+}
+
+void WatchHub::drop(int fd) {
+    auto it = watchers.find(fd);
+    if (it == watchers.end()) {
+        return;
+    }
+    string filename = move(it->second.filename);
+    watchers.erase(it);
+    if (epoll_fd >= 0) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    }
+    close(fd);
+    stats.record_watch_end();
+
+    auto topic = topics.find(filename);
+    if (topic != topics.end()) {
+        topic->second.watchers.erase(fd);
+        if (topic->second.watchers.empty()) {
+            topics.erase(topic);
+        }
+    }
+    lock_guard<mutex> lock(pending_mutex);
+    if (--watched[filename] == 0) {
+        watched.erase(filename);
+        changes.erase(filename);
+    }
+}
@@ -0,0 +1,164 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include "protocol.h"
+#include "storage.h"
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// Holds the connections that sent WATCH and pushes each new version of the
+// watched file to them, from a thread of its own. A change is handed over
+// with one map insert, and each file's message is built once and shared by
+// every watcher. Sends never block: a watcher whose socket is full is
+// resumed by epoll and then skips straight to the latest version, so a slow
+// watcher delays neither a PUT nor the other watchers. The loop never reads
+// the spill directory: a version held only there is read back by a thread
+// of its own and then pushed to the BODY watchers. Apart from the messages
+// being sent, the hub keeps no file data alive; what the store drops or
+// spills is not held here outside its memory budget.
+//
+// Pushed messages:
+//   CHANGED <version>                        without BODY
+//   CHANGED <version> / SIZE n / body / END   the new contents
+//   APPENDED <version> / SIZE n / lines / END  the lines added since the
+//                                              version last sent, when the
+//                                              new one only extends it
+class WatchHub {
+public:
+    WatchHub(FileStore& store, ServerStats& stats);
+    ~WatchHub();
+
+    WatchHub(const WatchHub&) = delete;
+    WatchHub& operator=(const WatchHub&) = delete;
+
+    bool start();
+
+    // Closes every watcher.
+    void stop();
+
+    // Takes over client_sock for request, a WATCH. It is answered with OK and
+    // the current version of the file, or VERSION none.
+    void add(int client_sock, const Request& request);
+
+    // Records a new version of filename. Cheap when nobody watches it.
+    // extended is the version an APPEND added lines to, 0 otherwise.
+    void notify(const string& filename, const FileVersion& version, const FileData& data,
+                uint64_t extended = 0);
+
+private:
+    struct Message {
+        string head;
+        // Followed by END when set.
+        FileData body;
+        // With a body, the size of the file once it is applied.
+        size_t size = 0;
+    };
+
+    struct Joining {
+        int fd;
+        string filename;
+        bool body;
+        bool has_tag;
+        bool has_client_version;
+        FileVersion client_version;
+    };
+
+    // appended_from is the oldest version that data only adds lines to, by
+    // a run of APPENDs; 0 if there is none.
+    struct Change {
+        FileVersion version;
+        FileData data;
+        uint64_t appended_from = 0;
+    };
+
+    // The latest version of one watched file and the messages announcing it.
+    // data, full and delta are alive only while some watcher is being sent
+    // them. delta is the APPENDED message after the first delta_base bytes,
+    // which are the version hashed delta_hash.
+    struct Topic {
+        FileVersion version;
+        uint64_t appended_from = 0;
+        weak_ptr<const string_view> data;
+        shared_ptr<const Message> notice;
+        weak_ptr<const Message> full;
+        weak_ptr<const Message> delta;
+        size_t delta_base = 0;
+        uint64_t delta_hash = 0;
+        // Version whose spilled data was asked of the reader.
+        uint64_t loading = 0;
+        set<int> watchers;
+    };
+
+    struct Watcher {
+        int fd;
+        string filename;
+        bool body;
+        // Last version sent or already held, and with BODY whether its size
+        // is known.
+        FileVersion known;
+        bool has_sent = false;
+        size_t sent_size = 0;
+        shared_ptr<const Message> message;
+        size_t offset = 0;
+        // False once the watcher shut down its side.
+        bool reading = true;
+        // The epoll events registered for fd.
+        uint32_t armed = 0;
+    };
+
+    void run();
+    void join(Joining& joining);
+    void apply(const string& filename, Change& change);
+    void advance(Topic& topic, const FileVersion& version, const FileData& data,
+                 uint64_t appended_from);
+    // Whether topic's version only adds bytes to the version watcher holds.
+    bool extends(Topic& topic, const Watcher& watcher, const FileData& data);
+    // The message bringing watcher up to topic's version. Null while a BODY
+    // watcher waits for the reader to load that version from the spill
+    // directory.
+    shared_ptr<const Message> message_for(Topic& topic, const Watcher& watcher);
+    // Sends until the watcher is up to date or its socket is full. Returns
+    // false if the watcher was dropped.
+    bool flush(Watcher& watcher);
+    // Updates the epoll events watched for watcher.
+    void arm(Watcher& watcher);
+    void drop(int fd);
+    void wake();
+    // Reader thread: reads spilled versions back and hands them to notify().
+    void read_spilled();
+
+    FileStore& store;
+    ServerStats& stats;
+    int epoll_fd;
+    int wake_fd;
+    int stop_fd;
+    thread loop;
+
+    // Shared with notify() and add().
+    mutex pending_mutex;
+    map<string, int> watched;
+    map<string, Change> changes;
+    vector<Joining> joining;
+
+    // Files whose spilled data the loop is waiting for.
+    thread reader;
+    mutex load_mutex;
+    condition_variable load_cv;
+    deque<string> loads;
+    bool stopping = false;
+
+    // Owned by the loop thread.
+    map<string, Topic> topics;
+    map<int, Watcher> watchers;
+};
+
+#endif
@@ -0,0 +1,118 @@
+#include "worker_pool.h"
+#include "utils.h"
+#include <algorithm>
+
+using namespace std;
+
+namespace {
+
+template <typename T>
+void raise_to(atomic<T>& peak, T value) {
+    T seen = peak.load(memory_order_relaxed);
+    while (seen < value && !peak.compare_exchange_weak(seen, value, memory_order_relaxed)) {
+    }
+}
+
+}
+
+WorkerPool::WorkerPool(Scheduler& scheduler, PoolLimits limits, vector<int> ids,
+                       function<void(int)> run_worker)
+    : scheduler(scheduler), pool_limits(limits), ids(move(ids)), run_worker(move(run_worker)),
+      workers(0), busy(0), peak_busy(0), peak_wait_ns(0), pressure_ticks(0), spare_since_ns(0) {}
+
+WorkerPool::~WorkerPool() {
+    join();
+}
+
+void WorkerPool::start(int count) {
+    count = max(pool_limits.min_workers, min(count, pool_limits.max_workers));
+    while (workers < count && spawn()) {
+    }
+}
+
+void WorkerPool::begin_request(long long queue_wait_ns) {
+    raise_to(peak_busy, busy.fetch_add(1, memory_order_relaxed) + 1);
+    raise_to(peak_wait_ns, queue_wait_ns);
+}
+
+void WorkerPool::end_request() {
+    busy.fetch_sub(1, memory_order_relaxed);
+}
+
+bool WorkerPool::spawn() {
+    for (int id : ids) {
+        if (threads.count(id) == 0) {
+            threads.emplace(id, thread([this, id] {
+                run_worker(id);
+                lock_guard<mutex> lock(exited_mutex);
+                exited.push_back(id);
+            }));
+            ++workers;
+            return true;
+        }
+    }
+    // Every id is held, some by retired workers still finishing a request.
+    return false;
+}
+
+void WorkerPool::reap() {
+    vector<int> done;
+    {
+        lock_guard<mutex> lock(exited_mutex);
+        done.swap(exited);
+    }
+    for (int id : done) {
+        threads[id].join();
+        threads.erase(id);
+    }
+}
+
+bool WorkerPool::adjust(PoolDecision& decision) {
+    reap();
+    long long now = get_current_time_ns();
+    long long wait_ns = peak_wait_ns.exchange(0, memory_order_relaxed);
+    int busy_peak = peak_busy.exchange(busy.load(memory_order_relaxed), memory_order_relaxed);
+    size_t queued = scheduler.size();
+
+    bool waited = wait_ns > pool_limits.target_wait_ns;
+    bool saturated = busy_peak >= workers && queued > 0;
+    pressure_ticks = waited || saturated ? pressure_ticks + 1 : 0;
+    if (busy_peak + 2 > workers) {
+        spare_since_ns = 0;
+    } else if (spare_since_ns == 0) {
+        spare_since_ns = now;
+    }
+
+    decision.time_ns = now;
+    decision.from = workers;
+    decision.peak_wait_ms = ns_to_ms(wait_ns);
+    decision.peak_busy = busy_peak;
+    decision.queued = queued;
+
+    if (pressure_ticks >= GROW_TICKS && workers < pool_limits.max_workers && spawn()) {
+        pressure_ticks = 0;
+        spare_since_ns = 0;
+        decision.to = workers;
+        decision.reason = waited ? "queue_wait" : "saturated";
+        return true;
+    }
+    if (spare_since_ns != 0 && now - spare_since_ns >= pool_limits.idle_ns &&
+        workers > pool_limits.min_workers) {
+        scheduler.retire_one();
+        --workers;
+        decision.to = workers;
+        decision.reason = "idle";
+        return true;
+    }
+    return false;
+}
+
+void WorkerPool::join() {
+    for (auto& entry : threads) {
+        if (entry.second.joinable()) {
+            entry.second.join();
+        }
+    }
+    threads.clear();
+    exited.clear();
+}
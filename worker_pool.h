@@ -0,0 +1,93 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include "scheduler.h"
+#include <atomic>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// Bounds of an elastic pool. With min_workers == max_workers it never resizes.
+struct PoolLimits {
+    int min_workers = 1;
+    int max_workers = 1;
+    long long target_wait_ns = 0;
+    long long idle_ns = 0;
+};
+
+// One resize and the signals that triggered it.
+struct PoolDecision {
+    long long time_ns = 0;
+    int from = 0;
+    int to = 0;
+    string reason;
+    double peak_wait_ms = 0;
+    int peak_busy = 0;
+    size_t queued = 0;
+};
+
+// The worker threads serving one scheduler. adjust() is called every tick:
+// it adds a worker once the queue wait has exceeded the target, or every
+// worker was busy with requests still queued, for GROW_TICKS ticks in a row,
+// and retires one per tick once two or more workers have been spare for
+// idle_ns. The gap between the two conditions keeps the pool from
+// oscillating around a steady load.
+class WorkerPool {
+public:
+    static const int GROW_TICKS = 2;
+
+    // run_worker(id) is the worker loop. It returns once the scheduler hands
+    // it null, on shutdown or retirement. ids has one entry per possible
+    // worker, max_workers in all.
+    WorkerPool(Scheduler& scheduler, PoolLimits limits, vector<int> ids,
+               function<void(int)> run_worker);
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    void start(int workers);
+
+    // Called by each worker around every request it takes. queue_wait_ns is
+    // how long a fresh request waited, 0 for a requeued one.
+    void begin_request(long long queue_wait_ns);
+    void end_request();
+
+    // Resizes the pool if the signals since the last call say so, and
+    // describes the change in decision.
+    bool adjust(PoolDecision& decision);
+
+    // Joins every worker. The scheduler must be shut down first.
+    void join();
+
+    int size() const { return workers; }
+    const PoolLimits& limits() const { return pool_limits; }
+
+private:
+    bool spawn();
+    void reap();
+
+    Scheduler& scheduler;
+    PoolLimits pool_limits;
+    vector<int> ids;
+    function<void(int)> run_worker;
+
+    // Workers the pool wants; retired workers may still be finishing.
+    int workers;
+    map<int, thread> threads;
+    mutex exited_mutex;
+    vector<int> exited;
+
+    atomic<int> busy;
+    atomic<int> peak_busy;
+    atomic<long long> peak_wait_ns;
+    int pressure_ticks;
+    long long spare_since_ns;
+};
+
+#endif